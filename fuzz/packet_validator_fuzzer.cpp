@@ -0,0 +1,32 @@
+// libFuzzer target for the packet validator and the parser behind it.
+//
+// Build with Clang:
+//   cmake -S . -B build-fuzz -DCMAKE_CXX_COMPILER=clang++ -DENABLE_FUZZING=ON
+//   cmake --build build-fuzz --target packet-validator-fuzzer
+//   ./build-fuzz/packet-validator-fuzzer -max_len=512
+
+#include "../src/dns_packet.h"
+#include "../src/packet_validator.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (size > BUFFER_SIZE) {
+    return 0;
+  }
+
+  validate_packet(data, size);
+
+  // Anything the validator lets through must parse and answer without
+  // tripping the sanitizers or throwing.
+  if (validate_query(data, size) == PacketVerdict::Valid) {
+    char buffer[BUFFER_SIZE];
+    std::memcpy(buffer, data, size);
+    auto packet = DNSPacket(buffer, size);
+    auto response = DNSPacket::respond_to_packet(packet);
+    response.get_packet_vector();
+  }
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include "admission_control.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <climits>
+
+AdmissionControl::AdmissionControl(size_t max_inflight, size_t max_inflight_per_client, size_t memory_budget) {
+  this->max_inflight = max_inflight;
+  this->max_inflight_per_client = max_inflight_per_client;
+  this->memory_budget = memory_budget;
+  this->inflight.store(0);
+  this->inflight_bytes.store(0);
+  this->client_inflight = std::make_unique<std::array<std::atomic<uint32_t>, ADMISSION_CLIENT_TABLE_SIZE>>();
+  this->interval_start_ms.store(now_ms());
+  this->interval_min_delay_ms.store(INT64_MAX);
+  this->delayed.store(false);
+}
+
+int64_t AdmissionControl::now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::atomic<uint32_t> &AdmissionControl::client_slot(const sockaddr_in &client) {
+  uint64_t key = ntohl(client.sin_addr.s_addr);
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return (*this->client_inflight)[key % ADMISSION_CLIENT_TABLE_SIZE];
+}
+
+// ============================================================================
+// In-flight Limits
+// ============================================================================
+
+Admission AdmissionControl::acquire(const sockaddr_in &client, size_t cost) {
+  // A verdict nobody has renewed for a couple of intervals is from before
+  // the server went idle, not about the queue now.
+  if (this->delayed.load(std::memory_order_relaxed) &&
+      now_ms() - this->interval_start_ms.load(std::memory_order_relaxed) < 2 * QUEUE_DELAY_INTERVAL_MS) {
+    return Admission::Overload;
+  }
+
+  // Take each slot optimistically and hand it back if that went over.
+  auto &client_count = client_slot(client);
+  if (client_count.fetch_add(1) >= this->max_inflight_per_client && this->max_inflight_per_client > 0) {
+    client_count.fetch_sub(1);
+    return Admission::Refuse;
+  }
+  if (this->inflight.fetch_add(1) >= this->max_inflight && this->max_inflight > 0) {
+    this->inflight.fetch_sub(1);
+    client_count.fetch_sub(1);
+    return Admission::Overload;
+  }
+  if (this->inflight_bytes.fetch_add(cost) + cost > this->memory_budget && this->memory_budget > 0) {
+    this->inflight_bytes.fetch_sub(cost);
+    this->inflight.fetch_sub(1);
+    client_count.fetch_sub(1);
+    return Admission::Overload;
+  }
+  return Admission::Admit;
+}
+
+void AdmissionControl::release(const sockaddr_in &client, size_t cost) {
+  client_slot(client).fetch_sub(1);
+  this->inflight.fetch_sub(1);
+  this->inflight_bytes.fetch_sub(cost);
+}
+
+size_t AdmissionControl::get_inflight() const {
+  return this->inflight.load();
+}
+
+// ============================================================================
+// Queueing Delay
+// ============================================================================
+
+bool AdmissionControl::record_queue_delay(int64_t delay_ms) {
+  int64_t minimum = this->interval_min_delay_ms.load(std::memory_order_relaxed);
+  while (delay_ms < minimum && !this->interval_min_delay_ms.compare_exchange_weak(minimum, delay_ms)) {
+  }
+
+  // Whoever first sees the interval end closes it. A burst drains within an
+  // interval and leaves a small minimum; only a standing queue keeps even the
+  // luckiest query waiting past the target.
+  int64_t now = now_ms();
+  int64_t start = this->interval_start_ms.load(std::memory_order_relaxed);
+  if (now - start >= QUEUE_DELAY_INTERVAL_MS && this->interval_start_ms.compare_exchange_strong(start, now)) {
+    int64_t interval_minimum = this->interval_min_delay_ms.exchange(INT64_MAX);
+    this->delayed.store(interval_minimum != INT64_MAX && interval_minimum > QUEUE_DELAY_TARGET_MS,
+                        std::memory_order_relaxed);
+  }
+  return delay_ms < QUEUE_DELAY_DROP_MS;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Slots in the per-client in-flight table. Allocated once, like the rate
+// limiter's tables; clients that land on the same slot share its count.
+const int ADMISSION_CLIENT_TABLE_SIZE = 1 << 16;
+
+// Queueing delay a busy server is allowed to sit at. Queries waiting longer
+// than this for a whole interval mean a standing queue, not a burst.
+const int64_t QUEUE_DELAY_TARGET_MS = 50;
+const int64_t QUEUE_DELAY_INTERVAL_MS = 100;
+// A query that waited this long is dropped unanswered: its client has
+// already retried or given up.
+const int64_t QUEUE_DELAY_DROP_MS = 1000;
+
+enum class Admission {
+  Admit,
+  // The client already has its share of queries in flight: REFUSED.
+  Refuse,
+  // The server is over a global limit or behind on its queue: SERVFAIL.
+  Overload,
+};
+
+// Hard limits on queries waiting on upstream, so overload degrades into fast
+// REFUSED/SERVFAIL answers instead of unbounded tables and queues. A query
+// holds a slot from admission until its reply is built: one in the global
+// count, one in its client's count and an estimate of its memory in the byte
+// budget. On top of that, queueing delay is tracked CoDel style: while the
+// smallest delay seen in each interval stays above the target, new upstream
+// work is shed. Zero disables a limit.
+//
+// Lock-free, so the pipeline's resolution threads can share it.
+class AdmissionControl {
+private:
+  size_t max_inflight;
+  size_t max_inflight_per_client;
+  size_t memory_budget;
+
+  std::atomic<size_t> inflight;
+  std::atomic<size_t> inflight_bytes;
+  std::unique_ptr<std::array<std::atomic<uint32_t>, ADMISSION_CLIENT_TABLE_SIZE>> client_inflight;
+
+  std::atomic<int64_t> interval_start_ms;
+  std::atomic<int64_t> interval_min_delay_ms;
+  std::atomic<bool> delayed;
+
+  static int64_t now_ms();
+  std::atomic<uint32_t> &client_slot(const sockaddr_in &client);
+
+public:
+  AdmissionControl(size_t max_inflight, size_t max_inflight_per_client, size_t memory_budget);
+
+  // Takes a slot for a query about to wait on upstream, charging `cost`
+  // bytes, unless a limit says no.
+  Admission acquire(const sockaddr_in &client, size_t cost);
+  // Gives back what acquire took.
+  void release(const sockaddr_in &client, size_t cost);
+
+  // Feeds in how long a query waited before we got to it. Returns false if
+  // it waited past QUEUE_DELAY_DROP_MS and should be dropped.
+  bool record_queue_delay(int64_t delay_ms);
+
+  size_t get_inflight() const;
+};
@@ -2,12 +2,12 @@
 #include <vector>
 // #include <iostream>
 
-Answer::Answer(std::vector<unsigned char> domain_name,
+Answer::Answer(WireName domain_name,
                std::array<unsigned char, 2> type,
                std::array<unsigned char, 2> ans_class,
                std::array<unsigned char, 4> ttl,
                std::array<unsigned char, 2> length,
-               std::vector<unsigned char> data) {
+               RData data) {
   this->domain_name = domain_name;
   this->type = type;
   this->ans_class = ans_class;
@@ -16,11 +16,9 @@ Answer::Answer(std::vector<unsigned char> domain_name,
   this->data = data;
 }
 
-void Answer::add_answer_into_return_packet(std::vector<unsigned char>* return_packet) {
+void Answer::add_answer_into_return_packet(std::vector<unsigned char>* return_packet) const {
   // Copy in the domain name first
-  for (auto domain_char : this->domain_name) {
-    return_packet->push_back(domain_char);
-  }
+  this->domain_name.add_name_into_return_packet(return_packet);
 
   // Copy in the type
   return_packet->push_back(this->type[0]);
@@ -31,8 +29,8 @@ void Answer::add_answer_into_return_packet(std::vector<unsigned char>* return_pa
   return_packet->push_back(this->ans_class[1]);
 
   // Copy in the ttl
-  return_packet->push_back(this->ttl[1]);
   return_packet->push_back(this->ttl[0]);
+  return_packet->push_back(this->ttl[1]);
   return_packet->push_back(this->ttl[2]);
   return_packet->push_back(this->ttl[3]);
 
@@ -41,31 +39,42 @@ void Answer::add_answer_into_return_packet(std::vector<unsigned char>* return_pa
   return_packet->push_back(this->length[1]);
 
   // Copy data
-  for (auto data_char : this->data) {
-    return_packet->push_back(data_char);
-  }
+  this->data.add_into_return_packet(return_packet);
 }
 
-std::vector<unsigned char> Answer::get_data() {
+const RData& Answer::get_data() const {
   return this->data;
 }
 
-std::vector<unsigned char> Answer::get_domain_name() {
+const WireName& Answer::get_domain_name() const {
   return this->domain_name;
 }
 
-std::array<unsigned char, 2> Answer::get_type() {
+std::array<unsigned char, 2> Answer::get_type() const {
   return this->type;
 }
 
-std::array<unsigned char, 2> Answer::get_ans_class() {
+std::array<unsigned char, 2> Answer::get_ans_class() const {
   return this->ans_class;
 }
 
-std::array<unsigned char, 4> Answer::get_ttl() {
+std::array<unsigned char, 4> Answer::get_ttl() const {
   return this->ttl;
 }
 
-std::array<unsigned char, 2> Answer::get_length() {
+std::array<unsigned char, 2> Answer::get_length() const {
   return this->length;
+}
+
+uint16_t Answer::get_type_code() const {
+  return (this->type[0] << 8) | this->type[1];
+}
+
+uint32_t Answer::get_ttl_seconds() const {
+  return record_codec::read_u32(this->ttl.data());
+}
+
+void Answer::set_ttl_seconds(uint32_t ttl) {
+  this->ttl = {static_cast<unsigned char>(ttl >> 24), static_cast<unsigned char>((ttl >> 16) & 0xFF),
+               static_cast<unsigned char>((ttl >> 8) & 0xFF), static_cast<unsigned char>(ttl & 0xFF)};
 }
\ No newline at end of file
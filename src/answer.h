@@ -1,27 +1,64 @@
+#pragma once
+
+#include "record_codec.h"
+#include "wire_name.h"
 #include <array>
 #include <vector>
 
 class Answer {
 private:
-  std::vector<unsigned char> domain_name;
+  WireName domain_name;
   std::array<unsigned char, 2> type;
   std::array<unsigned char, 2> ans_class;
   std::array<unsigned char, 4> ttl;
   std::array<unsigned char, 2> length;
-  std::vector<unsigned char> data;
+  RData data;
 
 public:
-  Answer(std::vector<unsigned char> domain_name,
+  Answer(WireName domain_name,
          std::array<unsigned char, 2> type,
          std::array<unsigned char, 2> ans_class,
          std::array<unsigned char, 4> ttl, std::array<unsigned char, 2> length,
-         std::vector<unsigned char> data);
-
-  void add_answer_into_return_packet(std::vector<unsigned char>* return_packet);
-  std::vector<unsigned char> get_data();
-  std::vector<unsigned char> get_domain_name();
-  std::array<unsigned char, 2> get_type();
-  std::array<unsigned char, 2> get_ans_class();
-  std::array<unsigned char, 4> get_ttl();
-  std::array<unsigned char, 2> get_length();
-};
\ No newline at end of file
+         RData data);
+
+  void add_answer_into_return_packet(std::vector<unsigned char>* return_packet) const;
+  const RData& get_data() const;
+  const WireName& get_domain_name() const;
+  std::array<unsigned char, 2> get_type() const;
+  std::array<unsigned char, 2> get_ans_class() const;
+  std::array<unsigned char, 4> get_ttl() const;
+  std::array<unsigned char, 2> get_length() const;
+  uint16_t get_type_code() const;
+  uint32_t get_ttl_seconds() const;
+  void set_ttl_seconds(uint32_t ttl);
+
+  // Builds a record from typed data. RDATA is still kept in wire format, so
+  // serialising the answer stays a copy.
+  template <RecordType Type>
+  static Answer make(const WireName& domain_name, uint16_t ans_class, uint32_t ttl,
+                     const typename RecordCodec<Type>::Value& value);
+
+  // Decodes the RDATA as Type. False if the record is another type or its
+  // RDATA doesn't match the layout.
+  template <RecordType Type>
+  bool as(typename RecordCodec<Type>::Value* value) const;
+};
+
+template <RecordType Type>
+Answer Answer::make(const WireName& domain_name, uint16_t ans_class, uint32_t ttl,
+                    const typename RecordCodec<Type>::Value& value) {
+  RData data = encode_rdata<Type>(value);
+  uint16_t type_code = static_cast<uint16_t>(Type);
+  return Answer(domain_name,
+                {static_cast<unsigned char>(type_code >> 8), static_cast<unsigned char>(type_code & 0xFF)},
+                {static_cast<unsigned char>(ans_class >> 8), static_cast<unsigned char>(ans_class & 0xFF)},
+                {static_cast<unsigned char>(ttl >> 24), static_cast<unsigned char>((ttl >> 16) & 0xFF),
+                 static_cast<unsigned char>((ttl >> 8) & 0xFF), static_cast<unsigned char>(ttl & 0xFF)},
+                {static_cast<unsigned char>(data.size() >> 8), static_cast<unsigned char>(data.size() & 0xFF)},
+                data);
+}
+
+template <RecordType Type>
+bool Answer::as(typename RecordCodec<Type>::Value* value) const {
+  return get_type_code() == static_cast<uint16_t>(Type) && decode_rdata<Type>(this->data, value);
+}
\ No newline at end of file
@@ -0,0 +1,551 @@
+#include "blocklist.h"
+#include "name_kernels.h"
+#include "record_codec.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+// Image layout, all integers big-endian so an image works on any machine:
+//
+//   "DNSB" | version u32 | entry count u32 | node count u32 |
+//   edge count u32 | label bytes u32 | root node u32
+//   nodes:  first edge u32 | flags (top 2 bits) and edge count u32
+//   edges:  label offset u32 | child node u32
+//   labels: length-prefixed lowercase labels
+//
+// A node's edges are contiguous and sorted by label, so each step of a walk is
+// a binary search. Labels are stored once and sorted, so sorting edges by
+// label offset sorts them by label too.
+const char BLOCKLIST_MAGIC[4] = {'D', 'N', 'S', 'B'};
+const uint32_t BLOCKLIST_VERSION = 1;
+const size_t BLOCKLIST_HEADER_SIZE = 28;
+const size_t BLOCKLIST_NODE_SIZE = 8;
+const size_t BLOCKLIST_EDGE_SIZE = 8;
+
+// The name ending at this node is listed.
+const uint32_t EXACT_FLAG = 1;
+// Every name below this node is listed.
+const uint32_t WILDCARD_FLAG = 2;
+const int NODE_FLAGS_SHIFT = 30;
+const uint32_t NODE_EDGE_COUNT_MASK = (1U << NODE_FLAGS_SHIFT) - 1;
+
+const std::string WILDCARD_PREFIX = "*.";
+
+static void write_u32(std::vector<unsigned char> *out, uint32_t value) {
+  out->push_back(value >> 24);
+  out->push_back((value >> 16) & 0xFF);
+  out->push_back((value >> 8) & 0xFF);
+  out->push_back(value & 0xFF);
+}
+
+// ============================================================================
+// Blocklist Compilation
+// ============================================================================
+
+// One name from the source: its labels, root first, are
+// `sequence[offset, offset + count)`.
+struct SourceEntry {
+  uint32_t offset;
+  uint32_t count;
+  uint32_t flags;
+};
+
+struct SourceList {
+  std::vector<std::string> labels;
+  std::unordered_map<std::string, uint32_t> label_ids;
+  std::vector<uint32_t> sequence;
+  std::vector<SourceEntry> entries;
+};
+
+static void add_source_name(SourceList &list, std::string text, bool from_hosts_line) {
+  uint32_t flags = EXACT_FLAG;
+  if (text.starts_with(WILDCARD_PREFIX)) {
+    flags = WILDCARD_FLAG;
+    text = text.substr(WILDCARD_PREFIX.size());
+  }
+  if (!text.empty() && text.back() == '.') {
+    text.pop_back();
+  }
+
+  std::vector<std::string> labels;
+  size_t wire_size = 1;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = std::min(text.find('.', start), text.size());
+    size_t label_size = end - start;
+    wire_size += 1 + label_size;
+    if (label_size == 0 || label_size > 63 || wire_size > MAX_WIRE_NAME_SIZE) {
+      throw std::runtime_error("Invalid domain name " + text);
+    }
+    std::string label = text.substr(start, label_size);
+    lowercase_wire_name(reinterpret_cast<unsigned char *>(label.data()),
+                        reinterpret_cast<const unsigned char *>(label.data()), label.size());
+    labels.push_back(label);
+    start = end + 1;
+  }
+  // Hosts files map localhost and friends; those aren't meant as blocks.
+  if (from_hosts_line && labels.size() < 2) {
+    return;
+  }
+
+  SourceEntry entry{static_cast<uint32_t>(list.sequence.size()), static_cast<uint32_t>(labels.size()), flags};
+  for (auto label = labels.rbegin(); label != labels.rend(); label++) {
+    auto [id, inserted] = list.label_ids.try_emplace(*label, list.labels.size());
+    if (inserted) {
+      list.labels.push_back(*label);
+    }
+    list.sequence.push_back(id->second);
+  }
+  list.entries.push_back(entry);
+}
+
+static SourceList read_source_list(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Failed to open blocklist " + path);
+  }
+
+  SourceList list;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::vector<std::string> names;
+    std::string field;
+    while (fields >> field) {
+      names.push_back(field);
+    }
+    if (names.empty()) {
+      continue;
+    }
+
+    // "<address> <name>..." is a hosts file line.
+    unsigned char address[16];
+    bool hosts_line = inet_pton(AF_INET, names[0].c_str(), address) == 1 ||
+                      inet_pton(AF_INET6, names[0].c_str(), address) == 1;
+    try {
+      for (size_t i = hosts_line ? 1 : 0; i < names.size(); i++) {
+        add_source_name(list, names[i], hosts_line);
+      }
+    } catch (const std::exception &error) {
+      throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + error.what());
+    }
+  }
+  return list;
+}
+
+// Finished nodes, in the order they are finished: children before parents.
+// Each node is registered by its flags and edges, so a node identical to one
+// already finished is dropped in favour of it.
+class DafsaBuilder {
+private:
+  struct NodeHash {
+    const DafsaBuilder *builder;
+    size_t operator()(uint32_t node) const {
+      size_t hash = this->builder->node_words[2 * node + 1];
+      uint32_t first = this->builder->node_words[2 * node];
+      uint32_t count = hash & NODE_EDGE_COUNT_MASK;
+      for (uint32_t i = 2 * first; i < 2 * (first + count); i++) {
+        hash = hash * 0x100000001B3ULL ^ this->builder->edge_words[i];
+      }
+      return hash;
+    }
+  };
+  struct NodeEqual {
+    const DafsaBuilder *builder;
+    bool operator()(uint32_t first_node, uint32_t second_node) const {
+      const auto &nodes = this->builder->node_words;
+      const auto &edges = this->builder->edge_words;
+      if (nodes[2 * first_node + 1] != nodes[2 * second_node + 1]) {
+        return false;
+      }
+      uint32_t count = nodes[2 * first_node + 1] & NODE_EDGE_COUNT_MASK;
+      return std::equal(edges.begin() + 2 * nodes[2 * first_node],
+                        edges.begin() + 2 * (nodes[2 * first_node] + count),
+                        edges.begin() + 2 * nodes[2 * second_node]);
+    }
+  };
+
+  std::unordered_set<uint32_t, NodeHash, NodeEqual> registry;
+
+public:
+  // Two words per node (first edge, flags and edge count) and two per edge
+  // (label id, child node).
+  std::vector<uint32_t> node_words;
+  std::vector<uint32_t> edge_words;
+
+  DafsaBuilder() : registry(1024, NodeHash{this}, NodeEqual{this}) {}
+
+  uint32_t finish_node(uint32_t flags, const std::vector<std::pair<uint32_t, uint32_t>> &edges) {
+    if (edges.size() > NODE_EDGE_COUNT_MASK) {
+      throw std::runtime_error("Blocklist has too many names under one domain");
+    }
+    uint32_t node = this->node_words.size() / 2;
+    uint32_t first_edge = this->edge_words.size() / 2;
+    for (const auto &[label, child] : edges) {
+      this->edge_words.push_back(label);
+      this->edge_words.push_back(child);
+    }
+    this->node_words.push_back(first_edge);
+    this->node_words.push_back(flags << NODE_FLAGS_SHIFT | static_cast<uint32_t>(edges.size()));
+
+    auto [existing, inserted] = this->registry.insert(node);
+    if (!inserted) {
+      this->node_words.resize(2 * node);
+      this->edge_words.resize(2 * first_edge);
+      return *existing;
+    }
+    return node;
+  }
+};
+
+// Incremental construction over sorted input (Daciuk et al., 2000). Names
+// arrive in order, so once a name diverges from the previous one, the nodes
+// below the divergence can never gain another edge and are finished on the
+// spot. Memory stays at the minimised automaton plus one path.
+std::vector<unsigned char> Blocklist::compile(const std::string &path) {
+  SourceList list = read_source_list(path);
+
+  // Renumber labels in sorted order, so comparing ids compares labels and
+  // edges come out sorted the way match() searches them.
+  std::vector<uint32_t> order(list.labels.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](uint32_t first, uint32_t second) { return list.labels[first] < list.labels[second]; });
+  std::vector<uint32_t> rank(order.size());
+  for (uint32_t i = 0; i < order.size(); i++) {
+    rank[order[i]] = i;
+  }
+  for (auto &label : list.sequence) {
+    label = rank[label];
+  }
+
+  auto labels_of = [&](const SourceEntry &entry) {
+    return std::make_pair(list.sequence.begin() + entry.offset,
+                          list.sequence.begin() + entry.offset + entry.count);
+  };
+  std::sort(list.entries.begin(), list.entries.end(), [&](const SourceEntry &first, const SourceEntry &second) {
+    auto [first_begin, first_end] = labels_of(first);
+    auto [second_begin, second_end] = labels_of(second);
+    return std::lexicographical_compare(first_begin, first_end, second_begin, second_end);
+  });
+
+  struct PendingNode {
+    uint32_t flags;
+    // The last edge leads to the next node on the path until it's finished.
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+  };
+  DafsaBuilder builder;
+  std::vector<PendingNode> pending(1, PendingNode{0, {}});
+  auto finish_path_below = [&](size_t depth) {
+    while (pending.size() > depth + 1) {
+      uint32_t node = builder.finish_node(pending.back().flags, pending.back().edges);
+      pending.pop_back();
+      pending.back().edges.back().second = node;
+    }
+  };
+
+  for (const auto &entry : list.entries) {
+    auto [begin, end] = labels_of(entry);
+    // Depth shared with the previous name, which is exactly the pending path.
+    size_t shared = 0;
+    while (shared + 1 < pending.size() && begin + shared != end &&
+           pending[shared].edges.back().first == *(begin + shared)) {
+      shared++;
+    }
+    finish_path_below(shared);
+    for (auto label = begin + shared; label != end; label++) {
+      pending.back().edges.emplace_back(*label, 0);
+      pending.push_back(PendingNode{0, {}});
+    }
+    pending.back().flags |= entry.flags;
+  }
+  finish_path_below(0);
+  uint32_t root = builder.finish_node(pending[0].flags, pending[0].edges);
+
+  // Lay the labels out in id order and point edges at them.
+  std::vector<unsigned char> label_pool;
+  std::vector<uint32_t> label_offsets(order.size());
+  for (uint32_t id = 0; id < order.size(); id++) {
+    const std::string &label = list.labels[order[id]];
+    label_offsets[id] = label_pool.size();
+    label_pool.push_back(label.size());
+    label_pool.insert(label_pool.end(), label.begin(), label.end());
+  }
+
+  std::vector<unsigned char> image(BLOCKLIST_MAGIC, BLOCKLIST_MAGIC + sizeof(BLOCKLIST_MAGIC));
+  uint32_t node_count = builder.node_words.size() / 2;
+  uint32_t edge_count = builder.edge_words.size() / 2;
+  image.reserve(BLOCKLIST_HEADER_SIZE + node_count * BLOCKLIST_NODE_SIZE + edge_count * BLOCKLIST_EDGE_SIZE +
+                label_pool.size());
+  write_u32(&image, BLOCKLIST_VERSION);
+  write_u32(&image, list.entries.size());
+  write_u32(&image, node_count);
+  write_u32(&image, edge_count);
+  write_u32(&image, label_pool.size());
+  write_u32(&image, root);
+  for (uint32_t word : builder.node_words) {
+    write_u32(&image, word);
+  }
+  for (size_t i = 0; i < builder.edge_words.size(); i += 2) {
+    write_u32(&image, label_offsets[builder.edge_words[i]]);
+    write_u32(&image, builder.edge_words[i + 1]);
+  }
+  image.insert(image.end(), label_pool.begin(), label_pool.end());
+  return image;
+}
+
+size_t Blocklist::compile_file(const std::string &source, const std::string &output) {
+  auto image = compile(source);
+
+  std::string temporary_path = output + ".tmp";
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(image.data()), image.size());
+    if (!file) {
+      throw std::runtime_error("Failed to write blocklist image " + temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), output.c_str()) != 0) {
+    throw std::runtime_error("Failed to replace blocklist image " + output + ": " + strerror(errno));
+  }
+  return record_codec::read_u32(image.data() + 8);
+}
+
+// ============================================================================
+// Blocklist Loading
+// ============================================================================
+
+Blocklist::Blocklist()
+    : data(nullptr), size(0), mapping(nullptr), entry_count(0), node_count(0), edge_count(0),
+      label_bytes(0), root(0), nodes(nullptr), edges(nullptr), labels(nullptr) {}
+
+Blocklist::~Blocklist() {
+  release();
+}
+
+Blocklist::Blocklist(Blocklist &&other) noexcept : Blocklist() {
+  *this = std::move(other);
+}
+
+Blocklist &Blocklist::operator=(Blocklist &&other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  release();
+  // Moving the vector keeps its heap buffer, so the views stay valid.
+  this->image = std::move(other.image);
+  this->mapping = other.mapping;
+  this->data = other.data;
+  this->size = other.size;
+  this->entry_count = other.entry_count;
+  this->node_count = other.node_count;
+  this->edge_count = other.edge_count;
+  this->label_bytes = other.label_bytes;
+  this->root = other.root;
+  this->nodes = other.nodes;
+  this->edges = other.edges;
+  this->labels = other.labels;
+
+  other.mapping = nullptr;
+  other.data = nullptr;
+  other.size = 0;
+  other.node_count = 0;
+  return *this;
+}
+
+void Blocklist::release() {
+  if (this->mapping != nullptr) {
+    munmap(this->mapping, this->size);
+    this->mapping = nullptr;
+  }
+}
+
+bool Blocklist::attach(const unsigned char *data, size_t size) {
+  if (size < BLOCKLIST_HEADER_SIZE || std::memcmp(data, BLOCKLIST_MAGIC, sizeof(BLOCKLIST_MAGIC)) != 0 ||
+      record_codec::read_u32(data + 4) != BLOCKLIST_VERSION) {
+    return false;
+  }
+  uint32_t entry_count = record_codec::read_u32(data + 8);
+  uint32_t node_count = record_codec::read_u32(data + 12);
+  uint32_t edge_count = record_codec::read_u32(data + 16);
+  uint32_t label_bytes = record_codec::read_u32(data + 20);
+  uint32_t root = record_codec::read_u32(data + 24);
+  if (BLOCKLIST_HEADER_SIZE + static_cast<uint64_t>(node_count) * BLOCKLIST_NODE_SIZE +
+              static_cast<uint64_t>(edge_count) * BLOCKLIST_EDGE_SIZE + label_bytes !=
+          size ||
+      root >= node_count) {
+    return false;
+  }
+  const unsigned char *nodes = data + BLOCKLIST_HEADER_SIZE;
+  const unsigned char *edges = nodes + static_cast<size_t>(node_count) * BLOCKLIST_NODE_SIZE;
+  const unsigned char *labels = edges + static_cast<size_t>(edge_count) * BLOCKLIST_EDGE_SIZE;
+
+  // Check every offset once here so a walk never has to.
+  for (uint32_t node = 0; node < node_count; node++) {
+    uint64_t first_edge = record_codec::read_u32(nodes + node * BLOCKLIST_NODE_SIZE);
+    uint32_t count = record_codec::read_u32(nodes + node * BLOCKLIST_NODE_SIZE + 4) & NODE_EDGE_COUNT_MASK;
+    if (first_edge + count > edge_count) {
+      return false;
+    }
+  }
+  for (uint32_t edge = 0; edge < edge_count; edge++) {
+    uint64_t label_offset = record_codec::read_u32(edges + edge * BLOCKLIST_EDGE_SIZE);
+    uint32_t child = record_codec::read_u32(edges + edge * BLOCKLIST_EDGE_SIZE + 4);
+    if (child >= node_count || label_offset >= label_bytes) {
+      return false;
+    }
+    size_t label_size = labels[label_offset];
+    if (label_size == 0 || label_size > 63 || label_offset + 1 + label_size > label_bytes) {
+      return false;
+    }
+  }
+
+  this->data = data;
+  this->size = size;
+  this->entry_count = entry_count;
+  this->node_count = node_count;
+  this->edge_count = edge_count;
+  this->label_bytes = label_bytes;
+  this->root = root;
+  this->nodes = nodes;
+  this->edges = edges;
+  this->labels = labels;
+  return true;
+}
+
+Blocklist Blocklist::load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open blocklist " + path + ": " + strerror(errno));
+  }
+  struct stat file_status;
+  if (fstat(fd, &file_status) != 0) {
+    close(fd);
+    throw std::runtime_error("Failed to read blocklist " + path + ": " + strerror(errno));
+  }
+
+  Blocklist blocklist;
+  size_t size = file_status.st_size;
+  if (size >= BLOCKLIST_HEADER_SIZE) {
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Failed to map blocklist " + path + ": " + strerror(errno));
+    }
+    auto data = static_cast<const unsigned char *>(mapping);
+    if (std::memcmp(data, BLOCKLIST_MAGIC, sizeof(BLOCKLIST_MAGIC)) == 0) {
+      close(fd);
+      if (!blocklist.attach(data, size)) {
+        munmap(mapping, size);
+        throw std::runtime_error("Blocklist image " + path + " is malformed");
+      }
+      blocklist.mapping = mapping;
+      return blocklist;
+    }
+    munmap(mapping, size);
+  }
+  close(fd);
+
+  // Not an image: compile the text list.
+  blocklist.image = compile(path);
+  blocklist.attach(blocklist.image.data(), blocklist.image.size());
+  return blocklist;
+}
+
+// ============================================================================
+// Blocklist Matching
+// ============================================================================
+
+int Blocklist::find_edge(uint32_t node, const unsigned char *label, size_t label_size) const {
+  const unsigned char *node_bytes = this->nodes + static_cast<size_t>(node) * BLOCKLIST_NODE_SIZE;
+  uint32_t low = record_codec::read_u32(node_bytes);
+  uint32_t high = low + (record_codec::read_u32(node_bytes + 4) & NODE_EDGE_COUNT_MASK);
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    const unsigned char *candidate =
+        this->labels + record_codec::read_u32(this->edges + static_cast<size_t>(middle) * BLOCKLIST_EDGE_SIZE);
+    size_t candidate_size = candidate[0];
+    // Same order as std::string, which the compiler sorted labels with.
+    int order = std::memcmp(candidate + 1, label, std::min(candidate_size, label_size));
+    if (order == 0) {
+      order = candidate_size < label_size ? -1 : (candidate_size > label_size ? 1 : 0);
+    }
+    if (order == 0) {
+      return middle;
+    }
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return -1;
+}
+
+BlocklistMatch Blocklist::match(const WireName &name) const {
+  if (empty() || name.get_label_count() < 0) {
+    return BlocklistMatch::None;
+  }
+
+  // Labels are walked from the root down, so find where each one starts.
+  WireName canonical = name.to_canonical();
+  const unsigned char *bytes = canonical.data();
+  unsigned char label_starts[MAX_WIRE_NAME_SIZE / 2];
+  int label_count = 0;
+  for (size_t offset = 0; bytes[offset] != 0; offset += bytes[offset] + 1) {
+    label_starts[label_count++] = offset;
+  }
+
+  uint32_t node = this->root;
+  for (int i = label_count - 1; i >= 0; i--) {
+    uint32_t flags =
+        record_codec::read_u32(this->nodes + static_cast<size_t>(node) * BLOCKLIST_NODE_SIZE + 4) >>
+        NODE_FLAGS_SHIFT;
+    // Labels remain, so the name is strictly below this node.
+    if ((flags & WILDCARD_FLAG) != 0) {
+      return BlocklistMatch::Wildcard;
+    }
+    const unsigned char *label = bytes + label_starts[i];
+    int edge = find_edge(node, label + 1, label[0]);
+    if (edge == -1) {
+      return BlocklistMatch::None;
+    }
+    node = record_codec::read_u32(this->edges + static_cast<size_t>(edge) * BLOCKLIST_EDGE_SIZE + 4);
+  }
+
+  uint32_t flags =
+      record_codec::read_u32(this->nodes + static_cast<size_t>(node) * BLOCKLIST_NODE_SIZE + 4) >>
+      NODE_FLAGS_SHIFT;
+  return (flags & EXACT_FLAG) != 0 ? BlocklistMatch::Exact : BlocklistMatch::None;
+}
+
+// ============================================================================
+// Blocklist Getters
+// ============================================================================
+
+size_t Blocklist::get_entry_count() const {
+  return this->entry_count;
+}
+
+size_t Blocklist::get_image_size() const {
+  return this->size;
+}
+
+bool Blocklist::empty() const {
+  return this->node_count == 0;
+}
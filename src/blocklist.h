@@ -0,0 +1,76 @@
+#pragma once
+
+#include "wire_name.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class BlocklistMatch {
+  None,
+  // The name itself is listed.
+  Exact,
+  // The name sits somewhere below a "*." entry.
+  Wildcard,
+};
+
+// Names we refuse to resolve, compiled into a reversed-label DAFSA: a trie
+// over labels read from the root down ("com", "example", "ads"), minimised so
+// that identical subtrees are stored once. Every leaf collapses into the same
+// node, and so do the repeated subtrees of big lists ("ads", "tracking", ...),
+// which keeps millions of names to a few bytes each. Matching walks the
+// query's labels once and settles exact and wildcard entries in that walk.
+//
+// The source is a text file with one name per line. "*.example.com" blocks
+// every name below example.com; list example.com as well to block the apex.
+// Hosts-file lines ("0.0.0.0 ads.example.com") are accepted, skipping
+// single-label names like localhost. '#' starts a comment.
+//
+// A compiled image can be written once with compile_file and mapped straight
+// into memory at startup instead of compiling the text again.
+class Blocklist {
+private:
+  // Points into `mapping` or `image`, whichever holds the compiled list.
+  const unsigned char *data;
+  size_t size;
+  void *mapping;
+  std::vector<unsigned char> image;
+
+  uint32_t entry_count;
+  uint32_t node_count;
+  uint32_t edge_count;
+  uint32_t label_bytes;
+  uint32_t root;
+  const unsigned char *nodes;
+  const unsigned char *edges;
+  const unsigned char *labels;
+
+  // Reads and checks the header and every offset so match() can trust them.
+  // Returns false if the image is malformed.
+  bool attach(const unsigned char *data, size_t size);
+  int find_edge(uint32_t node, const unsigned char *label, size_t label_size) const;
+  void release();
+
+public:
+  Blocklist();
+  ~Blocklist();
+  Blocklist(Blocklist &&other) noexcept;
+  Blocklist &operator=(Blocklist &&other) noexcept;
+  Blocklist(const Blocklist &) = delete;
+  Blocklist &operator=(const Blocklist &) = delete;
+
+  // Compiles the text list at `path` into an image. Throws
+  // std::runtime_error naming the line on anything it can't parse.
+  static std::vector<unsigned char> compile(const std::string &path);
+  // Compiles `source` and writes the image to `output`. Returns the number
+  // of entries.
+  static size_t compile_file(const std::string &source, const std::string &output);
+  // Maps a compiled image, or compiles a text list in memory.
+  static Blocklist load(const std::string &path);
+
+  BlocklistMatch match(const WireName &name) const;
+
+  size_t get_entry_count() const;
+  size_t get_image_size() const;
+  bool empty() const;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Size of the fixed DNS header.
+const int HEADER_BYTE_SIZE = 12;
+
+// Largest UDP message we read or send (RFC 1035 4.2.1).
+const int BUFFER_SIZE = 512;
+
+// Largest UDP reply we take from upstream. Pass-through queries carry the
+// client's EDNS payload size, so replies to them can be bigger than
+// BUFFER_SIZE.
+const int MAX_UPSTREAM_UDP_SIZE = 4096;
+// Largest UDP reply we send a client, whatever its EDNS payload size allows.
+const int MAX_UDP_REPLY_SIZE = 4096;
+
+// Largest message over TCP, where each one is prefixed by a two-byte length
+// (RFC 1035 4.2.2).
+const int MAX_MESSAGE_SIZE = 65535;
+
+// TC bit in the third header byte: the reply didn't fit and was cut short.
+const unsigned char TRUNCATION_FLAG = 0x02;
+// QR and RD bits in the third header byte.
+const unsigned char RESPONSE_FLAG = 0x80;
+const unsigned char RECURSION_DESIRED_FLAG = 0x01;
+
+// EDNS pseudo-record type; its class field is the sender's UDP payload size
+// (RFC 6891 6.1.2).
+const uint16_t OPT_RECORD_TYPE = 41;
+
+// Response codes (RFC 1035 4.1.1).
+const unsigned char RCODE_NO_ERROR = 0x00;
+const unsigned char RCODE_FORMAT_ERROR = 0x01;
+const unsigned char RCODE_SERVER_FAILURE = 0x02;
+const unsigned char RCODE_NAME_ERROR = 0x03;
+const unsigned char RCODE_NOT_IMPLEMENTED = 0x04;
+const unsigned char RCODE_REFUSED = 0x05;
@@ -1,5 +1,7 @@
 
 #include "dns_packet.h"
+#include "packet_validator.h"
+#include "record_codec.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -9,36 +11,47 @@
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
+#include <stdexcept>
 
 const std::string DOMAIN_NAME = "codecrafters.io";
 const std::string NAME_DELIMETER = ".";
-const int HEADER_BYTE_SIZE = 12;
-const int BUFFER_SIZE = 512;
+
+// What create_answer_section serves for names we answer locally.
+const uint32_t LOCAL_TTL = 60;
+const RecordCodec<RecordType::A>::Value LOCAL_IPV4_ADDRESS = {8, 8, 8, 8};
+// 2001:4860:4860::8888
+const RecordCodec<RecordType::AAAA>::Value LOCAL_IPV6_ADDRESS = {
+    0x20, 0x01, 0x48, 0x60, 0x48, 0x60, 0, 0, 0, 0, 0, 0, 0, 0, 0x88, 0x88};
+const uint16_t LOCAL_MX_PREFERENCE = 10;
 
 // ============================================================================
 // DNS PACKET Construction
 // ============================================================================
 
-DNSPacket::DNSPacket(char buf[BUFFER_SIZE]) {
+DNSPacket::DNSPacket(const char* buf, int size) {
   this->buffer_pointer = 0;
-  copy_dns_packet(buf);
+  copy_dns_packet(buf, size);
 }
 
 DNSPacket::DNSPacket() {
+  this->buffer_size = 0;
   this->buffer_pointer = 0;
 }
 
-void DNSPacket::copy_dns_packet(char buf[BUFFER_SIZE]) {
-  copy_buffer(buf);
+void DNSPacket::copy_dns_packet(const char* buf, int size) {
+  copy_buffer(buf, size);
   copy_header();
   copy_question_section();
   copy_answer_section();
+  copy_authority_section();
+  copy_additional_section();
 }
 
 std::vector<unsigned char> DNSPacket::create_question_packet(Question question) {
   std::vector<unsigned char> return_packet;
 
   // Copy transaction ID from buffer (original query)
+  const char* buffer = get_buffer();
   return_packet.push_back(buffer[0]);
   return_packet.push_back(buffer[1]);
 
@@ -83,6 +96,10 @@ std::vector<unsigned char> DNSPacket::get_packet_vector() {
   for (auto i = 0; i < this->header.size(); i++) {
     return_packet.push_back(this->header[i]);
   }
+  // Forwarded answers don't have to match the question count, so the answer
+  // count always reflects what we actually send.
+  return_packet[6] = (this->answer_vector.size() >> 8) & 0xFF;
+  return_packet[7] = this->answer_vector.size() & 0xFF;
 
   // Question section
   for (auto i = 0; i < this->question_vector.size(); i++) {
@@ -94,21 +111,91 @@ std::vector<unsigned char> DNSPacket::get_packet_vector() {
     this->answer_vector[i].add_answer_into_return_packet(&return_packet);
   }
 
+  // Authority section
+  return_packet[8] = (this->authority_vector.size() >> 8) & 0xFF;
+  return_packet[9] = this->authority_vector.size() & 0xFF;
+  for (auto i = 0; i < this->authority_vector.size(); i++) {
+    this->authority_vector[i].add_answer_into_return_packet(&return_packet);
+  }
+
+  // Additional section
+  return_packet[10] = (this->additional_vector.size() >> 8) & 0xFF;
+  return_packet[11] = this->additional_vector.size() & 0xFF;
+  for (auto i = 0; i < this->additional_vector.size(); i++) {
+    this->additional_vector[i].add_answer_into_return_packet(&return_packet);
+  }
+
+  return return_packet;
+}
+
+// Header and questions only, with TC set, telling the client to retry over
+// TCP.
+std::vector<unsigned char> DNSPacket::get_truncated_packet_vector() {
+  std::vector<unsigned char> return_packet;
+
+  // Header section with TC set and no records.
+  for (auto i = 0; i < this->header.size(); i++) {
+    return_packet.push_back(this->header[i]);
+  }
+  return_packet[2] |= 0x02;
+  for (auto i = 6; i < HEADER_BYTE_SIZE; i++) {
+    return_packet[i] = 0x00;
+  }
+
+  // Question section
+  for (auto i = 0; i < this->question_vector.size(); i++) {
+    this->question_vector[i].add_question_into_return_packet(&return_packet);
+  }
+
   return return_packet;
 }
 
-std::vector<Answer> DNSPacket::get_answer_section() {
+int DNSPacket::get_question_count() const {
+  return this->question_count;
+}
+
+int DNSPacket::get_transaction_id() const {
+  return convert_unsigned_char_tuple_into_int(this->header[0], this->header[1]);
+}
+
+const std::vector<Question>& DNSPacket::get_question_section() const {
+  return this->question_vector;
+}
+
+const std::vector<Answer>& DNSPacket::get_answer_section() const {
   return this->answer_vector;
 }
 
+const std::vector<Answer>& DNSPacket::get_authority_section() const {
+  return this->authority_vector;
+}
+
+const std::vector<Answer>& DNSPacket::get_additional_section() const {
+  return this->additional_vector;
+}
+
+unsigned char DNSPacket::get_response_code() const {
+  return this->header[3] & 0x0F;
+}
+
 // ============================================================================
 // DNS PACKET Buffer Helpers
 // ============================================================================
 
-void DNSPacket::copy_buffer(char buf[BUFFER_SIZE]) {
-  for (int i = 0; i < BUFFER_SIZE; i++) {
-    this->buffer[i] = buf[i];
+void DNSPacket::copy_buffer(const char* buf, int size) {
+  this->buffer_size = size < MAX_MESSAGE_SIZE ? size : MAX_MESSAGE_SIZE;
+  if (this->buffer_size > BUFFER_SIZE) {
+    this->large_buffer.assign(buf, buf + this->buffer_size);
+    return;
   }
+  this->large_buffer.clear();
+  std::memcpy(this->buffer, buf, this->buffer_size);
+  // Anything past the datagram reads as zero.
+  std::memset(this->buffer + this->buffer_size, 0, BUFFER_SIZE - this->buffer_size);
+}
+
+const char* DNSPacket::get_buffer() const {
+  return this->large_buffer.empty() ? this->buffer : this->large_buffer.data();
 }
 
 // ============================================================================
@@ -116,14 +203,16 @@ void DNSPacket::copy_buffer(char buf[BUFFER_SIZE]) {
 // ============================================================================
 
 void DNSPacket::copy_header() {
+  const char* buffer = get_buffer();
   for (auto i = 0; i < HEADER_BYTE_SIZE; i++) {
-    this->header[i] = this->buffer[i];
+    this->header[i] = buffer[i];
   }
   // We've created the header so now our index is at 12. Header range: [0, 11].
   this->buffer_pointer = HEADER_BYTE_SIZE;
 }
 
 void DNSPacket::create_header() {
+  const char* buffer = get_buffer();
   // Create 12 byte response
   // Packet Identifier (ID) - same as ID of query packet - 16 bit.
   this->header[0] = buffer[0];
@@ -183,20 +272,22 @@ void DNSPacket::copy_question_section() {
 }
 
 void DNSPacket::copy_question() {
-  std::vector<unsigned char> domain_vector = copy_domain_name();
+  WireName domain_vector = copy_domain_name();
+  require_bytes(4);
+  const char* buffer = get_buffer();
 
   // consume 4 more bytes:
   //  - 2 bytes for the type
   std::array<unsigned char, 2> type;
   for (auto i = 0; i < 2; i++) {
-    char buffer_item = this->buffer[this->buffer_pointer];
+    char buffer_item = buffer[this->buffer_pointer];
     type[i] = buffer_item;
     this->buffer_pointer++;
   }
   //  - 2 bytes for the class
   std::array<unsigned char, 2> ques_class;
   for (auto i = 0; i < 2; i++) {
-    char buffer_item = this->buffer[this->buffer_pointer];
+    char buffer_item = buffer[this->buffer_pointer];
     ques_class[i] = buffer_item;
     this->buffer_pointer++;
   }
@@ -217,133 +308,166 @@ void DNSPacket::copy_answer_section() {
       DNSPacket::convert_unsigned_char_tuple_into_int(high_char, low_char);
 
   for (auto i = 0; i < this->answer_count; i++) {
-    // Add domain name
-    auto domain_name = copy_domain_name();
-    // We'll add the type. Size of 2 bytes. Default to 1.
-    std::array<unsigned char, 2> type;
-    for (auto i = 0; i < type.size(); i++) {
-      type[i] = buffer[this->buffer_pointer];
-      this->buffer_pointer++;
-    }
-    //  We'll add the class. Size of 2 bytes. Default to 1.
-    std::array<unsigned char, 2> ans_class;
-    for (auto i = 0; i < ans_class.size(); i++) {
-      ans_class[i] = buffer[this->buffer_pointer];
-      this->buffer_pointer++;
-    }
-    // Setting TTL. Size of 4 bytes. Default to 60 seconds.
-    std::array<unsigned char, 4> ttl;
-    for (auto i = 0; i < ttl.size(); i++) {
-      ttl[i] = buffer[this->buffer_pointer];
-      this->buffer_pointer++;
-    }
-    // Length of Data. Size of 2 bytes.
-    std::array<unsigned char, 2> length;
-    for (auto i = 0; i < length.size(); i++) {
-      length[i] = buffer[this->buffer_pointer];
-      this->buffer_pointer++;
-    }
-    // Data. Variable size. Read from buffer based on length field.
-    std::vector<unsigned char> data;
-    int data_length = convert_unsigned_char_tuple_into_int(length[0], length[1]);
-    for (auto j = 0; j < data_length; j++) {
-      data.push_back(buffer[this->buffer_pointer]);
-      this->buffer_pointer++;
-    }
-
-    auto answer = Answer(domain_name, type, ans_class, ttl, length, data);
-    answer_vector.push_back(answer);
+    copy_resource_record(&this->answer_vector);
   }
 }
 
-// For now, we are only answering with a single answer.
-void DNSPacket::create_answer_section() {
-  for (auto i = 0; i < this->question_count; i++) {
-    // Add domain name for the first question and so on
-    auto domain_name = this->question_vector[i].get_domain_name();
-
-    // We'll add the type. Size of 2 bytes. Default to 1.
-    std::array<unsigned char, 2> type {0x00, 0x01};
-    
-    //  We'll add the class. Size of 2 bytes. Default to 1.
-    std::array<unsigned char, 2> ans_class {0x00, 0x01};
-  
-    // Setting TTL. Size of 4 bytes. Default to 60 seconds.
-    std::array<unsigned char, 4> ttl {0x00, 0x00, 0x00, 0x3c};
-    
-    // Length of Data. Size of 2 bytes. Default to 4.
-    std::array<unsigned char, 2> length {0x00, 0x04};
-    
-    // Data. Variable size. Default to an IP address (8.8.8.8).
-    std::vector<unsigned char> data;
-    for (auto j = 0; j < 4; j++) {
-      data.push_back(0x08);
-    }
+// ============================================================================
+// DNS PACKET Authority Helpers
+// ============================================================================
 
-    auto answer = Answer(domain_name, type, ans_class, ttl, length, data);
-    answer_vector.push_back(answer);
+void DNSPacket::copy_authority_section() {
+  unsigned char high_char = this->header[8];
+  unsigned char low_char = this->header[9];
+
+  this->authority_count =
+      DNSPacket::convert_unsigned_char_tuple_into_int(high_char, low_char);
+
+  for (auto i = 0; i < this->authority_count; i++) {
+    copy_resource_record(&this->authority_vector);
   }
 }
 
-void DNSPacket::create_answer_section_with_forwarding_address(sockaddr_in forwarding_address) {
-  for (auto i = 0; i < this->question_count; i++) {
-    // Create a new socket for forwarding
-    int forwardSocket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (forwardSocket == -1) {
-      perror("Failed to create forward socket");
-      continue;
-    }
+// ============================================================================
+// DNS PACKET Additional Helpers
+// ============================================================================
 
-    int bytesRead;
-    char buffer[BUFFER_SIZE];
-    socklen_t serverAddrLen = sizeof(forwarding_address);
+void DNSPacket::copy_additional_section() {
+  unsigned char high_char = this->header[10];
+  unsigned char low_char = this->header[11];
 
-    auto question = this->question_vector[i];
-    auto packet = create_question_packet(question);
+  this->additional_count =
+      DNSPacket::convert_unsigned_char_tuple_into_int(high_char, low_char);
 
-    // Forward packet
-    ssize_t sent_bytes = sendto(forwardSocket, packet.data(), packet.size(), 0, reinterpret_cast<struct sockaddr *>(&forwarding_address), sizeof(forwarding_address));
-    if (sent_bytes == -1) {
-      perror("Failed to send forward query");
-      close(forwardSocket);
-      continue;
-    }
-    std::cout << "Sent " << sent_bytes << " bytes to forwarder" << std::endl;
-
-    // Listen to response
-    bytesRead = recvfrom(forwardSocket, buffer, sizeof(buffer), 0,
-    reinterpret_cast<struct sockaddr *>(&forwarding_address),
-    &serverAddrLen);
-    if (bytesRead == -1) {
-      perror("Error receiving data from forward server");
-      close(forwardSocket);
-      break;
-    }
-    buffer[bytesRead] = '\0';
+  for (auto i = 0; i < this->additional_count; i++) {
+    copy_resource_record(&this->additional_vector);
+  }
+}
 
-    std::cout << "Received " << bytesRead << " forwarding bytes: " << buffer << std::endl;
+// ============================================================================
+// DNS PACKET Resource Record Helpers
+// ============================================================================
+
+void DNSPacket::copy_resource_record(std::vector<Answer>* records) {
+  // Add domain name
+  auto domain_name = copy_domain_name();
+  require_bytes(10);
+  const char* buffer = get_buffer();
+  // We'll add the type. Size of 2 bytes. Default to 1.
+  std::array<unsigned char, 2> type;
+  for (auto i = 0; i < type.size(); i++) {
+    type[i] = buffer[this->buffer_pointer];
+    this->buffer_pointer++;
+  }
+  //  We'll add the class. Size of 2 bytes. Default to 1.
+  std::array<unsigned char, 2> ans_class;
+  for (auto i = 0; i < ans_class.size(); i++) {
+    ans_class[i] = buffer[this->buffer_pointer];
+    this->buffer_pointer++;
+  }
+  // Setting TTL. Size of 4 bytes. Default to 60 seconds.
+  std::array<unsigned char, 4> ttl;
+  for (auto i = 0; i < ttl.size(); i++) {
+    ttl[i] = buffer[this->buffer_pointer];
+    this->buffer_pointer++;
+  }
+  // Length of Data. Size of 2 bytes.
+  std::array<unsigned char, 2> length;
+  for (auto i = 0; i < length.size(); i++) {
+    length[i] = buffer[this->buffer_pointer];
+    this->buffer_pointer++;
+  }
+  // Data. Variable size. Names inside it are decompressed, so the record
+  // stands on its own once it leaves this packet.
+  int data_length = convert_unsigned_char_tuple_into_int(length[0], length[1]);
+  require_bytes(data_length);
+  RData data;
+  int type_code = convert_unsigned_char_tuple_into_int(type[0], type[1]);
+  if (!copy_record_data(type_code, data_length, &data)) {
+    return;
+  }
+  length = {static_cast<unsigned char>(data.size() >> 8), static_cast<unsigned char>(data.size() & 0xFF)};
 
-    // Parse response
-    DNSPacket server_response_packet = DNSPacket(buffer);
-    // std::cout << "Forwarder response: " << std::endl;
-    // server_response_packet.print_dns_packet();
-    auto server_response_answer_section = server_response_packet.get_answer_section();
+  records->push_back(Answer(domain_name, type, ans_class, ttl, length, data));
+}
 
-    if (server_response_answer_section.size() >= 1) {
-      // Add all answers from the forwarding server
-      for (const auto& server_answer : server_response_answer_section) {
-        this->answer_vector.push_back(server_answer);
-      }
+// Copies the RDATA at the buffer pointer. Known types go through their codec;
+// returns false (skipping the record) if the RDATA doesn't fit the type's
+// layout.
+bool DNSPacket::copy_record_data(int type_code, int data_length, RData* data) {
+  auto packet = reinterpret_cast<const unsigned char*>(get_buffer());
+  bool decoded = true;
+  bool known_type = visit_record_type(type_code, [&]<RecordType Type>() {
+    typename RecordCodec<Type>::Value value;
+    decoded = RecordCodec<Type>::read(packet, this->buffer_size, this->buffer_pointer, data_length, &value);
+    if (decoded) {
+      RecordCodec<Type>::write(value, data);
     }
+  });
+  if (!known_type) {
+    data->append(packet + this->buffer_pointer, data_length);
+  }
+  this->buffer_pointer += data_length;
+  return decoded;
+}
+
+void DNSPacket::create_answer_section() {
+  for (const auto& question : this->question_vector) {
+    auto answers = create_local_answers(question);
+    this->answer_vector.insert(this->answer_vector.end(), answers.begin(), answers.end());
+  }
+}
+
+// Answers a question with its own type and class. Types we have no local
+// data for get no answer (NODATA).
+std::vector<Answer> DNSPacket::create_local_answers(const Question& question) {
+  std::vector<Answer> answers;
+  const auto& domain_name = question.get_domain_name();
+  auto ans_class = question.get_class_code();
 
-    close(forwardSocket);
+  switch (static_cast<RecordType>(question.get_type_code())) {
+    case RecordType::A:
+      answers.push_back(Answer::make<RecordType::A>(domain_name, ans_class, LOCAL_TTL, LOCAL_IPV4_ADDRESS));
+      break;
+    case RecordType::AAAA:
+      answers.push_back(Answer::make<RecordType::AAAA>(domain_name, ans_class, LOCAL_TTL, LOCAL_IPV6_ADDRESS));
+      break;
+    case RecordType::MX:
+      answers.push_back(Answer::make<RecordType::MX>(domain_name, ans_class, LOCAL_TTL, {LOCAL_MX_PREFERENCE, domain_name}));
+      break;
+    default:
+      break;
   }
+  return answers;
 }
 
 // ============================================================================
 // DNS PACKET Response Helpers
 // ============================================================================
 
+std::vector<unsigned char> DNSPacket::create_upstream_query(const Question& question, int transaction_id,
+                                                            bool recursion_desired) {
+  auto packet = create_question_packet(question);
+  packet[0] = (transaction_id >> 8) & 0xFF;
+  packet[1] = transaction_id & 0xFF;
+  if (!recursion_desired) {
+    packet[2] &= ~0x01;
+  }
+  return packet;
+}
+
+void DNSPacket::add_answers(const std::vector<Answer>& answers) {
+  this->answer_vector.insert(this->answer_vector.end(), answers.begin(), answers.end());
+}
+
+void DNSPacket::add_authority_records(const std::vector<Answer>& records) {
+  this->authority_vector.insert(this->authority_vector.end(), records.begin(), records.end());
+}
+
+void DNSPacket::set_response_code(unsigned char response_code) {
+  this->header[3] = (this->header[3] & 0xF0) | (response_code & 0x0F);
+}
+
 DNSPacket DNSPacket::respond_to_packet(DNSPacket packet) {
   auto response_packet = DNSPacket();
   response_packet.mutate_for_response(packet);
@@ -353,92 +477,72 @@ DNSPacket DNSPacket::respond_to_packet(DNSPacket packet) {
 void DNSPacket::mutate_for_response(DNSPacket packet) {
   auto buffer_vector = packet.get_packet_vector();
 
-  char buffer[BUFFER_SIZE];
-  auto buffer_data = buffer_vector.data();
-  for (auto i = 0; i < BUFFER_SIZE; i++) {
-    buffer[i] = buffer_data[i];
-  }
-
   this->buffer_pointer = 0;
-  copy_buffer(buffer);
+  copy_buffer(reinterpret_cast<char*>(buffer_vector.data()), buffer_vector.size());
   create_header();
   copy_question_section();
   create_answer_section();
 }
 
-DNSPacket DNSPacket::forward_packet(DNSPacket packet, sockaddr_in forwarding_address) {
+DNSPacket DNSPacket::prepare_forward_response(DNSPacket packet) {
   auto response_packet = DNSPacket();
-  response_packet.mutate_for_forward_response(packet, forwarding_address);
+  response_packet.mutate_for_pending_forward_response(packet);
   return response_packet;
 }
 
-void DNSPacket::mutate_for_forward_response(DNSPacket packet, sockaddr_in forwarding_address) {
+void DNSPacket::mutate_for_pending_forward_response(DNSPacket packet) {
   auto buffer_vector = packet.get_packet_vector();
 
-  char buffer[BUFFER_SIZE];
-  auto buffer_data = buffer_vector.data();
-  for (auto i = 0; i < BUFFER_SIZE; i++) {
-    buffer[i] = buffer_data[i];
-  }
-
   this->buffer_pointer = 0;
-  copy_buffer(buffer);
+  copy_buffer(reinterpret_cast<char*>(buffer_vector.data()), buffer_vector.size());
   create_header();
   copy_question_section();
-  create_answer_section_with_forwarding_address(forwarding_address);
+}
+
+std::vector<unsigned char> DNSPacket::create_error_packet(const char* query, unsigned char response_code) {
+  std::vector<unsigned char> return_packet;
+
+  // Transaction ID from the query.
+  return_packet.push_back(query[0]);
+  return_packet.push_back(query[1]);
+
+  // QR=1, keep the OPCODE and RD of the query.
+  unsigned char opcode = (0x0F << 3) & query[2];
+  unsigned char recursion_desired = 0x01 & query[2];
+  return_packet.push_back((1 << 7) | opcode | recursion_desired);
+  return_packet.push_back(response_code);
+
+  // No sections: QDCOUNT, ANCOUNT, NSCOUNT and ARCOUNT are all zero.
+  for (auto i = 0; i < 8; i++) {
+    return_packet.push_back(0x00);
+  }
+
+  return return_packet;
 }
 
 // ============================================================================
 // DNS PACKET Utility Helpers
 // ============================================================================
 
-void DNSPacket::copy_pointer(std::vector<unsigned char> &domain_vector, int pointer_loc) {
-  unsigned char buffer_item = this->buffer[pointer_loc];
-  while (buffer_item != 0x00) {
-    domain_vector.push_back(buffer_item);
-    pointer_loc++;
-    buffer_item = this->buffer[pointer_loc];
-  }
-  // The 0x00 - the null byte that indicates that the
-  // domain name has ended.
-  domain_vector.push_back(buffer_item);
-}
-
-std::vector<unsigned char> DNSPacket::copy_domain_name() {
-  std::vector<unsigned char> domain_vector;
-  // We're going to copy over the domain name
-  unsigned char buffer_item = this->buffer[this->buffer_pointer];
-
-  while (buffer_item != 0x00) {
-    // Check if buffer_item is a pointer. Pointers begin with two filled in bits:
-    // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    // | 1  1|                OFFSET                   |
-    // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    auto pointer_flag = 0xc0;
-    unsigned char buffer_item_flag = buffer_item & pointer_flag;
-    bool is_merged_item_in_pointer_format = (buffer_item_flag ^ 0xc0) == 0x00;
-
-    if (is_merged_item_in_pointer_format) {
-      auto pointer_offset = buffer_item & 0x3F;
-      auto next_offset = this->buffer[this->buffer_pointer + 1];
-      int pointer_loc = convert_unsigned_char_tuple_into_int(pointer_offset, next_offset);
-      copy_pointer(domain_vector, pointer_loc);
-      // pass this pointer, the next (which is part of the pointer computation), and finish on the next.
-      this->buffer_pointer += 2;
-    } else {
-      domain_vector.push_back(buffer_item);
-      this->buffer_pointer++;
-    }
-
-    buffer_item = this->buffer[this->buffer_pointer];
+WireName DNSPacket::copy_domain_name() {
+  // Collect the labels inline and build the name once at the end, so its
+  // metadata and hash are only computed a single time. Pointers are followed
+  // with the same bounds and loop checks the validator uses.
+  InlineBuffer<MAX_WIRE_NAME_SIZE> domain_bytes;
+  int name_end = read_wire_name(reinterpret_cast<const unsigned char*>(get_buffer()),
+                                this->buffer_size, this->buffer_pointer, &domain_bytes);
+  if (name_end == -1) {
+    throw std::runtime_error("Malformed domain name in packet");
   }
+  this->buffer_pointer = name_end;
 
-  // The 0x00 - the null byte that indicates that the
-  // domain name has ended.
-  domain_vector.push_back(buffer_item);
-  this->buffer_pointer++;
+  return WireName(domain_bytes.data(), domain_bytes.size());
+}
 
-  return domain_vector;
+void DNSPacket::require_bytes(int count) {
+  if (this->buffer_pointer + count > this->buffer_size) {
+    throw std::runtime_error("Packet ends before the end of a record");
+  }
 }
 
 int DNSPacket::convert_unsigned_char_tuple_into_int(unsigned char char_one,
@@ -451,7 +555,7 @@ int DNSPacket::convert_unsigned_char_tuple_into_int(unsigned char char_one,
 // ============================================================================
 
 // Helper: Convert domain name label sequence to readable string
-static std::string label_to_string(const std::vector<unsigned char>& label_sequence) {
+static std::string label_to_string(const WireName& label_sequence) {
   std::string domain_name = "";
   size_t i = 0;
 
@@ -480,16 +584,32 @@ static std::string label_to_string(const std::vector<unsigned char>& label_seque
 static std::string type_to_string(unsigned char high, unsigned char low) {
   int type_value = DNSPacket::convert_unsigned_char_tuple_into_int(high, low);
 
-  switch (type_value) {
-    case 1: return "A (IPv4 address)";
-    case 2: return "NS (Name Server)";
-    case 5: return "CNAME (Canonical Name)";
-    case 6: return "SOA (Start of Authority)";
-    case 15: return "MX (Mail Exchange)";
-    case 16: return "TXT (Text)";
-    case 28: return "AAAA (IPv6 address)";
-    default: return "Unknown (" + std::to_string(type_value) + ")";
+  std::string name = "Unknown (" + std::to_string(type_value) + ")";
+  visit_record_type(type_value, [&]<RecordType Type>() {
+    name = RecordCodec<Type>::NAME;
+  });
+  return name;
+}
+
+// Helper: Get RDATA in presentation form, or hex for types we can't decode
+static std::string data_to_string(const Answer& answer) {
+  std::string text;
+  bool decoded = false;
+  visit_record_type(answer.get_type_code(), [&]<RecordType Type>() {
+    typename RecordCodec<Type>::Value value;
+    decoded = answer.as<Type>(&value);
+    if (decoded) {
+      text = RecordCodec<Type>::to_string(value);
+    }
+  });
+  if (!decoded) {
+    char hex[4];
+    for (auto byte : answer.get_data()) {
+      snprintf(hex, sizeof(hex), "%02x ", byte);
+      text += hex;
+    }
   }
+  return text;
 }
 
 // Helper: Get DNS class as string
@@ -584,86 +704,82 @@ void DNSPacket::print_all_questions() {
   for (size_t i = 0; i < question_vector.size(); i++) {
     std::cout << "  [Question " << (i + 1) << "]" << std::endl;
 
-    auto domain_name = question_vector[i].get_domain_name();
+    const auto& domain_name = question_vector[i].get_domain_name();
     std::string domain_str = label_to_string(domain_name);
     std::cout << "    Name:   " << domain_str << std::endl;
-    std::cout << "    Type:   A (IPv4 address)" << std::endl;
-    std::cout << "    Class:  IN (Internet)" << std::endl;
+    auto type = question_vector[i].get_type();
+    std::cout << "    Type:   " << type_to_string(type[0], type[1]) << std::endl;
+    auto ques_class = question_vector[i].get_ques_class();
+    std::cout << "    Class:  " << class_to_string(ques_class[0], ques_class[1]) << std::endl;
     std::cout << std::endl;
   }
 }
 
-// Print all Answers
-void DNSPacket::print_all_answers() {
-  if (answer_vector.empty()) {
+// Helper: Print one resource record section
+static void print_records(const std::string& title, const std::string& label,
+                          const std::vector<Answer>& records) {
+  if (records.empty()) {
     std::cout << "╔════════════════════════════════════════════════════════════════╗" << std::endl;
-    std::cout << "║                        ANSWER SECTION                          ║" << std::endl;
+    std::cout << title << std::endl;
     std::cout << "╚════════════════════════════════════════════════════════════════╝" << std::endl;
     std::cout << "  (empty)" << std::endl << std::endl;
     return;
   }
 
   std::cout << "╔════════════════════════════════════════════════════════════════╗" << std::endl;
-  std::cout << "║                        ANSWER SECTION                          ║" << std::endl;
+  std::cout << title << std::endl;
   std::cout << "╚════════════════════════════════════════════════════════════════╝" << std::endl;
 
-  for (size_t i = 0; i < answer_vector.size(); i++) {
-    std::cout << "  [Answer " << (i + 1) << "]" << std::endl;
+  for (size_t i = 0; i < records.size(); i++) {
+    std::cout << "  [" << label << " " << (i + 1) << "]" << std::endl;
 
     // Domain Name
-    auto domain_name = answer_vector[i].get_domain_name();
+    const auto& domain_name = records[i].get_domain_name();
     std::string domain_str = label_to_string(domain_name);
     std::cout << "    Name:        " << domain_str << std::endl;
 
     // Type
-    auto type = answer_vector[i].get_type();
+    auto type = records[i].get_type();
     std::cout << "    Type:        " << type_to_string(type[0], type[1]) << std::endl;
 
     // Class
-    auto ans_class = answer_vector[i].get_ans_class();
+    auto ans_class = records[i].get_ans_class();
     std::cout << "    Class:       " << class_to_string(ans_class[0], ans_class[1]) << std::endl;
 
     // TTL
-    auto ttl = answer_vector[i].get_ttl();
+    auto ttl = records[i].get_ttl();
     int ttl_value = (ttl[0] << 24) | (ttl[1] << 16) | (ttl[2] << 8) | ttl[3];
     std::cout << "    TTL:         " << ttl_value << " seconds" << std::endl;
 
     // Data Length
-    auto length = answer_vector[i].get_length();
-    int length_value = convert_unsigned_char_tuple_into_int(length[0], length[1]);
+    auto length = records[i].get_length();
+    int length_value = DNSPacket::convert_unsigned_char_tuple_into_int(length[0], length[1]);
     std::cout << "    Data Length: " << length_value << " bytes" << std::endl;
 
     // Data
-    auto data = answer_vector[i].get_data();
-    int type_value = convert_unsigned_char_tuple_into_int(type[0], type[1]);
-
-    if (type_value == 1 && data.size() == 4) {
-      // A record - IPv4 address
-      std::cout << "    Data:        "
-                << static_cast<int>(data[0]) << "."
-                << static_cast<int>(data[1]) << "."
-                << static_cast<int>(data[2]) << "."
-                << static_cast<int>(data[3]) << std::endl;
-    } else if (type_value == 28 && data.size() == 16) {
-      // AAAA record - IPv6 address
-      std::cout << "    Data:        ";
-      for (size_t j = 0; j < data.size(); j += 2) {
-        printf("%02x%02x", data[j], data[j+1]);
-        if (j < data.size() - 2) std::cout << ":";
-      }
-      std::cout << std::endl;
-    } else {
-      // Other types - hex
-      std::cout << "    Data:        ";
-      for (size_t j = 0; j < data.size(); j++) {
-        printf("%02x ", data[j]);
-      }
-      std::cout << std::endl;
-    }
+    std::cout << "    Data:        " << data_to_string(records[i]) << std::endl;
     std::cout << std::endl;
   }
 }
 
+// Print all Answers
+void DNSPacket::print_all_answers() {
+  print_records("║                        ANSWER SECTION                          ║", "Answer",
+                answer_vector);
+}
+
+// Print all Authority records
+void DNSPacket::print_all_authorities() {
+  print_records("║                       AUTHORITY SECTION                        ║", "Authority",
+                authority_vector);
+}
+
+// Print all Additional Records
+void DNSPacket::print_all_additionals() {
+  print_records("║                      ADDITIONAL SECTION                        ║", "Additional",
+                additional_vector);
+}
+
 // Print the entire DNS Packet
 void DNSPacket::print_dns_packet() {
   std::cout << "\n";
@@ -675,6 +791,8 @@ void DNSPacket::print_dns_packet() {
   print_header();
   print_all_questions();
   print_all_answers();
+  print_all_authorities();
+  print_all_additionals();
 
   std::cout << "================================================================" << std::endl;
   std::cout << "                       END OF DNS PACKET                        " << std::endl;
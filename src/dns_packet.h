@@ -1,4 +1,7 @@
+#pragma once
+
 #include "answer.h"
+#include "dns_constants.h"
 #include "question.h"
 #include <netinet/in.h>
 #include <array>
@@ -7,13 +10,17 @@
 
 class DNSPacket {
   private:
-    // Buffer Input
-    char buffer[512];
+    // Buffer Input. Datagrams fit the inline buffer; only TCP replies are
+    // ever longer, and those go to large_buffer instead.
+    char buffer[BUFFER_SIZE];
+    std::vector<char> large_buffer;
+    int buffer_size;
     int buffer_pointer;
-    void copy_buffer(char buffer[512]);
+    void copy_buffer(const char* buffer, int size);
+    const char* get_buffer() const;
     
     // DNS Packet construction
-    void copy_dns_packet(char buffer[512]);
+    void copy_dns_packet(const char* buffer, int size);
     std::vector<unsigned char> create_question_packet(Question question);
 
     // Stored header
@@ -33,33 +40,64 @@ class DNSPacket {
     void copy_answer_section();
     void create_answer_section();
 
-    // Shared utilities
-    std::vector<unsigned char> copy_domain_name();
-    void copy_pointer(std::vector<unsigned char> &domain_vector, int pointer_loc);
+    // Stored authority section
+    int authority_count;
+    std::vector<Answer> authority_vector;
+    void copy_authority_section();
+
+    // Stored additional section
+    int additional_count;
+    std::vector<Answer> additional_vector;
+    void copy_additional_section();
 
-    // Forwarder Helpers
-    void create_answer_section_with_forwarding_address(sockaddr_in forwarding_address);
+    // Shared utilities
+    void copy_resource_record(std::vector<Answer>* records);
+    bool copy_record_data(int type_code, int data_length, RData* data);
+    WireName copy_domain_name();
+    void require_bytes(int count);
   public:
     // Constructors
     DNSPacket();
-    DNSPacket(char buffer[512]);
+    // The datagram must already have passed validate_packet.
+    DNSPacket(const char* buffer, int size);
 
     // Getters
     std::vector<unsigned char> get_packet_vector();
-    std::vector<Answer> get_answer_section();
+    std::vector<unsigned char> get_truncated_packet_vector();
+    int get_question_count() const;
+    int get_transaction_id() const;
+    const std::vector<Question>& get_question_section() const;
+    const std::vector<Answer>& get_answer_section() const;
+    const std::vector<Answer>& get_authority_section() const;
+    const std::vector<Answer>& get_additional_section() const;
+    unsigned char get_response_code() const;
 
     //  Helpers
     static int convert_unsigned_char_tuple_into_int(unsigned char char_one, unsigned char char_two);
 
     // Responses
     static DNSPacket respond_to_packet(DNSPacket packet);
-    static DNSPacket forward_packet(DNSPacket packet, sockaddr_in forwarding_address);
+    static std::vector<unsigned char> create_error_packet(const char* query, unsigned char response_code);
     void mutate_for_response(DNSPacket packet);
-    void mutate_for_forward_response(DNSPacket packet, sockaddr_in forwarding_address);
+
+    static std::vector<Answer> create_local_answers(const Question& question);
+
+    // Forwarding: the response starts with no answers, the caller sends each
+    // upstream query itself and adds the answers it resolves.
+    static DNSPacket prepare_forward_response(DNSPacket packet);
+    void mutate_for_pending_forward_response(DNSPacket packet);
+    // Forwarded queries keep the client's RD bit; iterative ones clear it.
+    std::vector<unsigned char> create_upstream_query(const Question& question, int transaction_id,
+                                                     bool recursion_desired);
+    void add_answers(const std::vector<Answer>& answers);
+    void add_authority_records(const std::vector<Answer>& records);
+    void set_response_code(unsigned char response_code);
 
     // Print functions
     void print_dns_packet();
     void print_header();
     void print_all_questions();
     void print_all_answers();
+    void print_all_authorities();
+    void print_all_additionals();
 };
\ No newline at end of file
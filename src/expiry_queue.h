@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Min-heap of a map's keys by expiry time, so a bounded cache can find the
+// entry to evict in O(log n) instead of sweeping the whole map. The map's
+// values need an `expires_at` field. Entries replaced or erased behind the
+// heap's back leave stale items; those are skipped when they surface and
+// thrown away wholesale once they outnumber the live ones. Not thread safe:
+// it lives under its cache's lock.
+template <typename Key>
+class ExpiryQueue {
+private:
+  // Stale items we put up with beyond one per live entry before rebuilding.
+  static constexpr size_t COMPACT_SLACK = 1024;
+
+  struct Item {
+    int64_t expires_at;
+    Key key;
+  };
+
+  std::vector<Item> heap;
+
+  static bool expires_later(const Item &a, const Item &b) {
+    return a.expires_at > b.expires_at;
+  }
+
+public:
+  // Call whenever `key` is stored in `map` with this expiry.
+  template <typename Map>
+  void push(const Map &map, const Key &key, int64_t expires_at) {
+    if (this->heap.size() >= 2 * map.size() + COMPACT_SLACK) {
+      this->heap.clear();
+      for (const auto &[live_key, value] : map) {
+        this->heap.push_back(Item{value.expires_at, live_key});
+      }
+      std::make_heap(this->heap.begin(), this->heap.end(), expires_later);
+    }
+    this->heap.push_back(Item{expires_at, key});
+    std::push_heap(this->heap.begin(), this->heap.end(), expires_later);
+  }
+
+  // Erases the entry of `map` that expires first: an expired one if there
+  // is any, otherwise the one with the least time left. Returns false if
+  // there was nothing to erase.
+  template <typename Map>
+  bool evict_first(Map &map) {
+    while (!this->heap.empty()) {
+      std::pop_heap(this->heap.begin(), this->heap.end(), expires_later);
+      Item item = std::move(this->heap.back());
+      this->heap.pop_back();
+      auto entry = map.find(item.key);
+      if (entry != map.end() && entry->second.expires_at == item.expires_at) {
+        map.erase(entry);
+        return true;
+      }
+    }
+    return false;
+  }
+};
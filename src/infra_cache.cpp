@@ -0,0 +1,158 @@
+#include "infra_cache.h"
+#include <algorithm>
+#include <chrono>
+
+// Weight of a new RTT sample in the smoothed RTT, as 1/N (RFC 6298 uses 1/8).
+const int64_t RTT_SAMPLE_WEIGHT = 8;
+// Servers passed over by select_server keep this share of their smoothed RTT.
+const int64_t RTT_DECAY_PERCENT = 98;
+
+InfraCache::InfraCache(size_t max_entries) {
+  this->max_entries = max_entries;
+}
+
+int64_t InfraCache::now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+template <typename Map>
+void InfraCache::make_room(Map &map, ExpiryQueue<WireName> &expiry) {
+  // Same policy as the answer cache: expired entries first, then the one
+  // closest to expiring.
+  while (map.size() >= this->max_entries && expiry.evict_first(map)) {
+  }
+}
+
+// ============================================================================
+// Delegations
+// ============================================================================
+
+void InfraCache::set_root_hints(const std::vector<WireName> &nameservers,
+                                const std::unordered_map<WireName, std::vector<uint32_t>> &hint_addresses) {
+  std::lock_guard lock(this->mutex);
+  this->root_nameservers = nameservers;
+  this->root_hint_addresses = hint_addresses;
+}
+
+void InfraCache::store_delegation(const WireName &zone, const std::vector<WireName> &nameservers,
+                                  uint32_t ttl) {
+  std::lock_guard lock(this->mutex);
+  if (ttl == 0 || nameservers.empty() || this->max_entries == 0) {
+    return;
+  }
+  int64_t now = now_ms();
+  int64_t expires_at = now + ttl * 1000LL;
+  this->delegations.erase(zone);
+  make_room(this->delegations, this->delegation_expiry);
+  this->delegations.emplace(zone, DelegationEntry{nameservers, expires_at});
+  this->delegation_expiry.push(this->delegations, zone, expires_at);
+}
+
+Delegation InfraCache::find_delegation(const WireName &name) const {
+  std::lock_guard lock(this->mutex);
+  int64_t now = now_ms();
+  WireName zone = name;
+  while (zone.get_label_count() > 0) {
+    auto entry = this->delegations.find(zone);
+    if (entry != this->delegations.end() && entry->second.expires_at > now) {
+      return Delegation{zone, entry->second.nameservers};
+    }
+    zone = zone.get_parent();
+  }
+  return Delegation{WireName(), this->root_nameservers};
+}
+
+// ============================================================================
+// Nameserver Addresses
+// ============================================================================
+
+void InfraCache::store_addresses(const WireName &nameserver, const std::vector<uint32_t> &server_addresses,
+                                 uint32_t ttl) {
+  std::lock_guard lock(this->mutex);
+  if (ttl == 0 || server_addresses.empty() || this->max_entries == 0) {
+    return;
+  }
+  int64_t now = now_ms();
+  int64_t expires_at = now + ttl * 1000LL;
+  this->addresses.erase(nameserver);
+  make_room(this->addresses, this->address_expiry);
+  this->addresses.emplace(nameserver, AddressEntry{server_addresses, expires_at});
+  this->address_expiry.push(this->addresses, nameserver, expires_at);
+}
+
+bool InfraCache::lookup_addresses(const WireName &nameserver, std::vector<uint32_t> *server_addresses) const {
+  std::lock_guard lock(this->mutex);
+  auto entry = this->addresses.find(nameserver);
+  if (entry != this->addresses.end() && entry->second.expires_at > now_ms()) {
+    server_addresses->insert(server_addresses->end(), entry->second.addresses.begin(),
+                             entry->second.addresses.end());
+    return true;
+  }
+
+  auto hint = this->root_hint_addresses.find(nameserver);
+  if (hint != this->root_hint_addresses.end() && !hint->second.empty()) {
+    server_addresses->insert(server_addresses->end(), hint->second.begin(), hint->second.end());
+    return true;
+  }
+  return false;
+}
+
+// ============================================================================
+// Server Selection
+// ============================================================================
+
+void InfraCache::set_rtt(uint32_t address, int64_t rtt_ms) {
+  if (this->server_rtts.find(address) == this->server_rtts.end() &&
+      this->server_rtts.size() >= this->max_entries && !this->server_rtts.empty()) {
+    this->server_rtts.erase(this->server_rtts.begin());
+  }
+  this->server_rtts[address] = std::clamp<int64_t>(rtt_ms, 1, MAX_SERVER_RTT_MS);
+}
+
+void InfraCache::record_rtt(uint32_t address, int64_t rtt_ms) {
+  std::lock_guard lock(this->mutex);
+  auto entry = this->server_rtts.find(address);
+  if (entry == this->server_rtts.end()) {
+    set_rtt(address, rtt_ms);
+    return;
+  }
+  set_rtt(address, (entry->second * (RTT_SAMPLE_WEIGHT - 1) + rtt_ms) / RTT_SAMPLE_WEIGHT);
+}
+
+void InfraCache::record_failure(uint32_t address, int64_t timeout_ms) {
+  std::lock_guard lock(this->mutex);
+  set_rtt(address, std::max(find_rtt(address) * 2, timeout_ms));
+}
+
+int64_t InfraCache::get_rtt(uint32_t address) const {
+  std::lock_guard lock(this->mutex);
+  return find_rtt(address);
+}
+
+int64_t InfraCache::find_rtt(uint32_t address) const {
+  auto entry = this->server_rtts.find(address);
+  if (entry == this->server_rtts.end()) {
+    return UNKNOWN_SERVER_RTT_MS;
+  }
+  return entry->second;
+}
+
+uint32_t InfraCache::select_server(const std::vector<uint32_t> &candidates) {
+  std::lock_guard lock(this->mutex);
+  uint32_t best = candidates[0];
+  for (auto candidate : candidates) {
+    if (find_rtt(candidate) < find_rtt(best)) {
+      best = candidate;
+    }
+  }
+
+  for (auto candidate : candidates) {
+    auto entry = this->server_rtts.find(candidate);
+    if (candidate != best && entry != this->server_rtts.end()) {
+      entry->second = entry->second * RTT_DECAY_PERCENT / 100;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "expiry_queue.h"
+#include "wire_name.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Smoothed round-trip time we assume for a nameserver we've never queried.
+// Zero, so every server of a zone gets tried once before the fastest wins.
+const int64_t UNKNOWN_SERVER_RTT_MS = 0;
+// Ceiling for a smoothed RTT, however many timeouts a server racks up.
+const int64_t MAX_SERVER_RTT_MS = 10000;
+
+// A zone cut: the nameservers a parent zone delegated `zone` to.
+struct Delegation {
+  WireName zone;
+  std::vector<WireName> nameservers;
+};
+
+// What iterative resolution knows about the DNS infrastructure, kept apart
+// from the answer cache: delegations learned from referrals, nameserver
+// addresses (glue or looked up), and a smoothed RTT per server address used to
+// pick which server of a zone to ask. The root delegation comes from the root
+// hints and never expires. Every call takes the cache's lock, so resolver
+// threads can share one.
+class InfraCache {
+private:
+  struct DelegationEntry {
+    std::vector<WireName> nameservers;
+    int64_t expires_at;
+  };
+
+  struct AddressEntry {
+    // IPv4 addresses in network byte order.
+    std::vector<uint32_t> addresses;
+    int64_t expires_at;
+  };
+
+  // The root hints live outside the bounded maps so they're never evicted.
+  std::vector<WireName> root_nameservers;
+  std::unordered_map<WireName, std::vector<uint32_t>> root_hint_addresses;
+
+  std::unordered_map<WireName, DelegationEntry> delegations;
+  std::unordered_map<WireName, AddressEntry> addresses;
+  // Eviction order for the two maps above, as in the answer cache.
+  ExpiryQueue<WireName> delegation_expiry;
+  ExpiryQueue<WireName> address_expiry;
+  // Smoothed RTT in milliseconds, keyed by address in network byte order.
+  std::unordered_map<uint32_t, int64_t> server_rtts;
+  size_t max_entries;
+  mutable std::mutex mutex;
+
+  template <typename Map>
+  void make_room(Map &map, ExpiryQueue<WireName> &expiry);
+  void set_rtt(uint32_t address, int64_t rtt_ms);
+  int64_t find_rtt(uint32_t address) const;
+
+public:
+  InfraCache(size_t max_entries);
+
+  static int64_t now_ms();
+
+  // Installs the root delegation from the root hints.
+  void set_root_hints(const std::vector<WireName> &nameservers,
+                      const std::unordered_map<WireName, std::vector<uint32_t>> &hint_addresses);
+
+  // Records that `zone` is served by `nameservers`, as a referral told us.
+  void store_delegation(const WireName &zone, const std::vector<WireName> &nameservers, uint32_t ttl);
+
+  // The deepest live delegation at or above `name`. There's always one, since
+  // the root hints cover everything.
+  Delegation find_delegation(const WireName &name) const;
+
+  void store_addresses(const WireName &nameserver, const std::vector<uint32_t> &server_addresses,
+                       uint32_t ttl);
+  // Appends the live addresses we hold for a nameserver name. Returns false
+  // if there are none.
+  bool lookup_addresses(const WireName &nameserver, std::vector<uint32_t> *server_addresses) const;
+
+  // Folds a measured round trip into the server's smoothed RTT.
+  void record_rtt(uint32_t address, int64_t rtt_ms);
+  // Backs the server off after a timeout or a useless reply.
+  void record_failure(uint32_t address, int64_t timeout_ms);
+  int64_t get_rtt(uint32_t address) const;
+
+  // Picks the candidate with the lowest smoothed RTT. The ones passed over
+  // decay a little, so a server that was slow once is tried again later.
+  uint32_t select_server(const std::vector<uint32_t> &candidates);
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Fixed-capacity byte buffer that keeps its contents inline instead of on the
+// heap. DNS bounds every field we store (names, RDATA) so we never need to
+// grow past a known capacity, and copying one of these is a single memcpy.
+template <size_t Capacity>
+class InlineBuffer {
+private:
+  std::array<unsigned char, Capacity> bytes;
+  size_t length;
+
+public:
+  InlineBuffer() : length(0) {}
+
+  InlineBuffer(const unsigned char* data, size_t size) : length(0) {
+    append(data, size);
+  }
+
+  void push_back(unsigned char byte) {
+    if (this->length >= Capacity) {
+      throw std::length_error("InlineBuffer capacity exceeded");
+    }
+    this->bytes[this->length] = byte;
+    this->length++;
+  }
+
+  void append(const unsigned char* data, size_t size) {
+    if (size > Capacity - this->length) {
+      throw std::length_error("InlineBuffer capacity exceeded");
+    }
+    if (size > 0) {
+      std::memcpy(this->bytes.data() + this->length, data, size);
+    }
+    this->length += size;
+  }
+
+  void clear() { this->length = 0; }
+
+  const unsigned char* data() const { return this->bytes.data(); }
+  unsigned char* data() { return this->bytes.data(); }
+  size_t size() const { return this->length; }
+  bool empty() const { return this->length == 0; }
+  static constexpr size_t capacity() { return Capacity; }
+
+  unsigned char operator[](size_t index) const { return this->bytes[index]; }
+
+  const unsigned char* begin() const { return this->bytes.data(); }
+  const unsigned char* end() const { return this->bytes.data() + this->length; }
+
+  void add_into_return_packet(std::vector<unsigned char>* return_packet) const {
+    return_packet->insert(return_packet->end(), begin(), end());
+  }
+
+  bool operator==(const InlineBuffer& other) const {
+    return this->length == other.length &&
+           std::memcmp(this->bytes.data(), other.bytes.data(), this->length) == 0;
+  }
+};
+
+// Byte buffer that keeps up to InlineCapacity bytes inline, like
+// InlineBuffer, and moves to the heap past that, up to MaxSize. For fields
+// that are nearly always small but may legitimately be large.
+template <size_t InlineCapacity, size_t MaxSize>
+class SpillBuffer {
+private:
+  std::array<unsigned char, InlineCapacity> bytes;
+  // Holds the contents instead of `bytes` once they outgrow it.
+  std::vector<unsigned char> heap;
+  size_t length;
+
+  void reserve_for(size_t size) {
+    if (size > MaxSize - this->length) {
+      throw std::length_error("SpillBuffer capacity exceeded");
+    }
+    if (this->heap.empty() && this->length + size > InlineCapacity) {
+      this->heap.assign(this->bytes.data(), this->bytes.data() + this->length);
+    }
+    if (!this->heap.empty() || this->length + size > InlineCapacity) {
+      this->heap.resize(this->length + size);
+    }
+  }
+
+public:
+  SpillBuffer() : length(0) {}
+
+  SpillBuffer(const unsigned char* data, size_t size) : length(0) {
+    append(data, size);
+  }
+
+  void push_back(unsigned char byte) {
+    append(&byte, 1);
+  }
+
+  void append(const unsigned char* data, size_t size) {
+    reserve_for(size);
+    if (size > 0) {
+      std::memcpy(this->data() + this->length, data, size);
+    }
+    this->length += size;
+  }
+
+  void clear() {
+    this->length = 0;
+    this->heap.clear();
+  }
+
+  const unsigned char* data() const { return this->heap.empty() ? this->bytes.data() : this->heap.data(); }
+  unsigned char* data() { return this->heap.empty() ? this->bytes.data() : this->heap.data(); }
+  size_t size() const { return this->length; }
+  bool empty() const { return this->length == 0; }
+  static constexpr size_t capacity() { return MaxSize; }
+
+  unsigned char operator[](size_t index) const { return data()[index]; }
+
+  const unsigned char* begin() const { return data(); }
+  const unsigned char* end() const { return data() + this->length; }
+
+  void add_into_return_packet(std::vector<unsigned char>* return_packet) const {
+    return_packet->insert(return_packet->end(), begin(), end());
+  }
+
+  bool operator==(const SpillBuffer& other) const {
+    return this->length == other.length && std::memcmp(data(), other.data(), this->length) == 0;
+  }
+};
@@ -0,0 +1,104 @@
+#include "local_zone.h"
+#include "record_codec.h"
+#include <arpa/inet.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+LocalZone::LocalZone() {}
+
+static Answer make_record(const WireName &name, uint32_t ttl, const std::string &type,
+                          const std::string &data) {
+  if (type == "A") {
+    RecordCodec<RecordType::A>::Value address;
+    if (inet_pton(AF_INET, data.c_str(), address.data()) != 1) {
+      throw std::runtime_error("Invalid IPv4 address " + data);
+    }
+    return Answer::make<RecordType::A>(name, CLASS_IN, ttl, address);
+  }
+  if (type == "AAAA") {
+    RecordCodec<RecordType::AAAA>::Value address;
+    if (inet_pton(AF_INET6, data.c_str(), address.data()) != 1) {
+      throw std::runtime_error("Invalid IPv6 address " + data);
+    }
+    return Answer::make<RecordType::AAAA>(name, CLASS_IN, ttl, address);
+  }
+  if (type == "CNAME") {
+    return Answer::make<RecordType::CNAME>(name, CLASS_IN, ttl, record_codec::name_from_string(data));
+  }
+  if (type == "NS") {
+    return Answer::make<RecordType::NS>(name, CLASS_IN, ttl, record_codec::name_from_string(data));
+  }
+  if (type == "MX") {
+    std::istringstream mx_fields(data);
+    uint16_t preference;
+    std::string exchange;
+    if (!(mx_fields >> preference >> exchange)) {
+      throw std::runtime_error("Expected <preference> <exchange> for MX");
+    }
+    return Answer::make<RecordType::MX>(name, CLASS_IN, ttl,
+                                        {preference, record_codec::name_from_string(exchange)});
+  }
+  if (type == "TXT") {
+    return Answer::make<RecordType::TXT>(name, CLASS_IN, ttl,
+                                         RecordCodec<RecordType::TXT>::from_string(data));
+  }
+  throw std::runtime_error("Unsupported record type " + type);
+}
+
+LocalZone LocalZone::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Failed to open zone file " + path);
+  }
+
+  LocalZone zone;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#' || line[first] == ';') {
+      continue;
+    }
+    try {
+      zone.add_record(line);
+    } catch (const std::exception &error) {
+      throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + error.what());
+    }
+  }
+  return zone;
+}
+
+void LocalZone::add_record(const std::string &line) {
+  std::istringstream fields(line);
+  std::string name_text;
+  uint32_t ttl;
+  std::string type;
+  if (!(fields >> name_text >> ttl >> type)) {
+    throw std::runtime_error("Expected <name> <ttl> <type> <data>");
+  }
+
+  auto name = record_codec::name_from_string(name_text);
+  std::string data;
+  std::getline(fields >> std::ws, data);
+  while (!data.empty() && (data.back() == '\r' || data.back() == ' ' || data.back() == '\t')) {
+    data.pop_back();
+  }
+
+  auto record = make_record(name, ttl, type, data);
+  this->rrsets[RecordKey{name, record.get_type_code()}].push_back(record);
+}
+
+bool LocalZone::lookup(const WireName &name, uint16_t type, std::vector<Answer> *records) const {
+  auto rrset = this->rrsets.find(RecordKey{name, type});
+  if (rrset == this->rrsets.end()) {
+    return false;
+  }
+  records->insert(records->end(), rrset->second.begin(), rrset->second.end());
+  return true;
+}
+
+bool LocalZone::empty() const {
+  return this->rrsets.empty();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "answer.h"
+#include "record_cache.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Records we serve ourselves, loaded once from a zone file. One record per
+// line, in presentation form:
+//
+//   www.example.com.   300  CNAME  cdn.example.net.
+//   cdn.example.net    60   A      192.0.2.10
+//   example.com        3600 MX     10 mail.example.com
+//   example.com        3600 TXT    v=spf1 -all
+//
+// Supported types are A, AAAA, CNAME, NS, MX and TXT. Blank lines and lines
+// starting with '#' or ';' are ignored. The class is always IN.
+class LocalZone {
+private:
+  std::unordered_map<RecordKey, std::vector<Answer>> rrsets;
+
+  void add_record(const std::string &line);
+
+public:
+  LocalZone();
+
+  // Throws std::runtime_error naming the line on anything it can't parse.
+  static LocalZone load(const std::string &path);
+
+  // Appends the RRset and returns true if the zone has one for the key.
+  bool lookup(const WireName &name, uint16_t type, std::vector<Answer> *records) const;
+
+  bool empty() const;
+};
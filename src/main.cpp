@@ -1,96 +1,96 @@
+#include "blocklist.h"
 #include "dns_packet.h"
+#include "pipeline_backend.h"
+#include "query_handler.h"
+#include "receive_timestamp.h"
+#include "server_options.h"
+#include "shutdown.h"
+#include "uring_backend.h"
+#include "xdp_backend.h"
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <netinet/in.h>
+#include <optional>
 #include <ostream>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
-#include <memory>
 #include <stdlib.h>
 
-std::string RESOLVER_FLAG = "--resolver";
-std::string ADDRESS_DELIMETER = ":";
-
-std::unique_ptr<sockaddr_in> make_sockaddr(const std::string &ip_address_str,
-                          const std::string &port_address_str) {
-  auto port_address = std::stoi(port_address_str);
-  auto unasigned_int_port_address = static_cast<uint16_t>(port_address);
-  auto addr = std::make_unique<sockaddr_in>();
-  addr->sin_family = AF_INET;
-  addr->sin_port = htons(unasigned_int_port_address);
-
-  if (inet_pton(AF_INET, ip_address_str.c_str(), &addr->sin_addr) != 1) {
-    throw std::runtime_error("Invalid IPv4 address");
-  }
-
-  return addr;
-}
+void run_socket_backend(int udpSocket, QueryHandler &handler) {
+  int bytesRead;
+  char buffer[BUFFER_SIZE];
+  struct sockaddr_in clientAddress;
+  // Room for the kernel's receive timestamp, for the queueing delay.
+  alignas(cmsghdr) char control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+  iovec payload = {buffer, sizeof(buffer)};
 
-int main(int argc, char *argv[]) {
-  std::string ip_address_str = "";
-  std::string port_address_str = "";
-
-  // When an argument is passed we expect to forward our packet.
-  if (argc > 1) {
-    if (argc != 3) {
-      // We should only expect two arguments in addition.
-      throw std::runtime_error(
-          "Expected two arguments. The --resolver flag and the address.");
-    }
+  // Wake up at least once a second for housekeeping.
+  timeval tick = {1, 0};
+  setsockopt(udpSocket, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+  enable_receive_timestamps(udpSocket);
 
-    if (std::strcmp(RESOLVER_FLAG.c_str(), argv[1]) != 0) {
-      // We should have expected the resolver flag
-      throw std::runtime_error("Expected the --resolver flag.");
+  while (!shutdown_requested()) {
+    // Receive data
+    msghdr message = {};
+    message.msg_name = &clientAddress;
+    message.msg_namelen = sizeof(clientAddress);
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    bytesRead = recvmsg(udpSocket, &message, 0);
+    if (bytesRead == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        handler.tick();
+        continue;
+      }
+      perror("Error receiving data");
+      break;
     }
 
-    std::string forward_address = argv[2];
-    auto delimeter_location = forward_address.find(ADDRESS_DELIMETER);
+    std::cout << "Received " << bytesRead << " bytes" << std::endl;
 
-    if (delimeter_location == std::string::npos) {
-      // The delimeter location was not found.
-      throw std::runtime_error(
-          "There was an error parsing the forwarding address.");
+    // Queries that waited in the socket buffer past the drop threshold aren't
+    // worth answering any more.
+    int64_t delay_ms = receive_delay_ms(message);
+    if (delay_ms >= 0 && !handler.record_queue_delay(delay_ms)) {
+      continue;
     }
 
-    ip_address_str = forward_address.substr(0, delimeter_location);
-    port_address_str =
-        forward_address.substr(delimeter_location + 1, forward_address.size());
-
-    std::cout << "Forwarding to address with ip " << ip_address_str
-              << " and port " << port_address_str << std::endl;
+    handler.handle_query(buffer, bytesRead, clientAddress, [&](std::vector<unsigned char> &response) {
+      // Send response
+      if (sendto(udpSocket, response.data(), response.size(), 0,
+                 reinterpret_cast<struct sockaddr *>(&clientAddress),
+                 sizeof(clientAddress)) == -1) {
+        perror("Failed to send response");
+      }
+    });
   }
+}
 
-  // Flush after every std::cout / std::cerr
-  std::cout << std::unitbuf;
-  std::cerr << std::unitbuf;
-
-  // Disable output buffering
-  setbuf(stdout, NULL);
-
-  // You can use print statements as follows for debugging, they'll be visible
-  // when running tests.
-  std::cout << "Logs from your program will appear here!" << std::endl;
-
-  int udpSocket;
-  struct sockaddr_in clientAddress;
-
-  udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+// A UDP socket bound to port 2053. Returns -1, after logging why, on failure.
+static int open_listen_socket() {
+  int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
   if (udpSocket == -1) {
     std::cerr << "Socket creation failed: " << strerror(errno) << "..."
               << std::endl;
-    return 1;
+    return -1;
   }
 
   // Since the tester restarts your program quite often, setting REUSE_PORT
-  // ensures that we don't run into 'Address already in use' errors
+  // ensures that we don't run into 'Address already in use' errors. It also
+  // lets the pipeline backend bind one socket per I/O thread.
   int reuse = 1;
   if (setsockopt(udpSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) <
       0) {
     std::cerr << "SO_REUSEPORT failed: " << strerror(errno) << std::endl;
-    return 1;
+    close(udpSocket);
+    return -1;
   }
 
   sockaddr_in serv_addr = {
@@ -102,48 +102,115 @@ int main(int argc, char *argv[]) {
   if (bind(udpSocket, reinterpret_cast<struct sockaddr *>(&serv_addr),
            sizeof(serv_addr)) != 0) {
     std::cerr << "Bind failed: " << strerror(errno) << std::endl;
-    return 1;
+    close(udpSocket);
+    return -1;
   }
+  return udpSocket;
+}
 
-  int bytesRead;
-  char buffer[512];
-  socklen_t clientAddrLen = sizeof(clientAddress);
+int main(int argc, char *argv[]) {
+  auto options = parse_server_options(argc, argv);
 
-  while (true) {
-    // Receive data
-    bytesRead = recvfrom(udpSocket, buffer, sizeof(buffer), 0,
-                         reinterpret_cast<struct sockaddr *>(&clientAddress),
-                         &clientAddrLen);
-    if (bytesRead == -1) {
-      perror("Error receiving data");
-      break;
-    }
+  if (!options.compile_blocklist.empty()) {
+    auto entries = Blocklist::compile_file(options.blocklist, options.compile_blocklist);
+    std::cout << "Compiled " << entries << " names from " << options.blocklist << " into "
+              << options.compile_blocklist << std::endl;
+    return 0;
+  }
+
+  // When a resolver is passed we expect to forward our packet.
+  if (options.is_forwarding()) {
+    std::cout << "Forwarding to address with ip " << options.resolver_ip
+              << " and port " << options.resolver_port << std::endl;
+  }
+  if (options.is_iterative()) {
+    std::cout << "Resolving iteratively from the root hints in " << options.root_hints << std::endl;
+  }
+
+  auto handler = QueryHandler(options);
+  install_shutdown_handlers();
+
+  // Flush after every std::cout / std::cerr
+  std::cout << std::unitbuf;
+  std::cerr << std::unitbuf;
+
+  // Disable output buffering
+  setbuf(stdout, NULL);
 
-    buffer[bytesRead] = '\0';
-    std::cout << "Received " << bytesRead << " bytes: " << buffer << std::endl;
+  // You can use print statements as follows for debugging, they'll be visible
+  // when running tests.
+  std::cout << "Logs from your program will appear here!" << std::endl;
 
-    auto packet_received = DNSPacket(buffer);
-    // std::cout << "Packet Received: " << std::endl;
-    // packet_received.print_dns_packet();
+  int udpSocket = open_listen_socket();
+  if (udpSocket == -1) {
+    return 1;
+  }
 
-    auto forward_sockaddr = *make_sockaddr(ip_address_str, port_address_str).release();
+  bool served = false;
+
+  // Only a backend that can't be set up falls back to the socket backend. One
+  // that fails while serving takes the process down with it, rather than
+  // quietly carrying on with another.
+  if (!options.xdp_interface.empty()) {
+    std::optional<XdpBackend> backend;
+    try {
+      backend.emplace(udpSocket, handler, options);
+    } catch (const std::runtime_error &error) {
+      std::cerr << error.what() << ". Falling back to the socket backend." << std::endl;
+    }
+    if (backend) {
+      std::cout << "Using the AF_XDP fast path on " << options.xdp_interface << std::endl;
+      backend->run();
+      served = true;
+    }
+  }
 
-    DNSPacket response_packet =
-        (!ip_address_str.empty() && !port_address_str.empty())
-            ? DNSPacket::forward_packet(packet_received, forward_sockaddr)
-            : DNSPacket::respond_to_packet(packet_received);
-    // std::cout << "Response from this server: " << std::endl;
-    // response_packet.print_dns_packet();
-    std::vector<unsigned char> response = response_packet.get_packet_vector();
+  if (!served && options.io_backend == "uring") {
+    std::optional<UringBackend> backend;
+    try {
+      backend.emplace(udpSocket, handler);
+    } catch (const std::runtime_error &error) {
+      std::cerr << error.what() << ". Falling back to the socket backend." << std::endl;
+    }
+    if (backend) {
+      std::cout << "Using the io_uring backend" << std::endl;
+      backend->run();
+      served = true;
+    }
+  }
 
-    // Send response
-    if (sendto(udpSocket, response.data(), response.size(), 0,
-               reinterpret_cast<struct sockaddr *>(&clientAddress),
-               sizeof(clientAddress)) == -1) {
-      perror("Failed to send response");
+  if (!served && options.io_backend == "pipeline") {
+    // The kernel shards clients across sockets sharing the port.
+    std::vector<int> sockets = {udpSocket};
+    while (static_cast<int>(sockets.size()) < options.io_threads) {
+      int extra_socket = open_listen_socket();
+      if (extra_socket == -1) {
+        break;
+      }
+      sockets.push_back(extra_socket);
+    }
+    std::optional<PipelineBackend> backend;
+    try {
+      backend.emplace(sockets, handler, options.resolver_threads);
+    } catch (const std::runtime_error &error) {
+      std::cerr << error.what() << ". Falling back to the socket backend." << std::endl;
     }
+    if (backend) {
+      std::cout << "Using the staged pipeline with " << sockets.size() << " I/O and "
+                << options.resolver_threads << " resolution threads" << std::endl;
+      backend->run();
+      served = true;
+    }
+    for (size_t i = 1; i < sockets.size(); i++) {
+      close(sockets[i]);
+    }
+  }
+
+  if (!served) {
+    run_socket_backend(udpSocket, handler);
   }
 
+  handler.save_cache_snapshot();
   close(udpSocket);
 
   return 0;
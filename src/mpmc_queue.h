@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// Bounded multi-producer, multi-consumer ring (Vyukov's design). Every cell
+// carries a sequence number saying whether it's ready to be written or read
+// on the current lap, so producers only contend on the enqueue position and
+// consumers on the dequeue position, and a push or pop is a single CAS when
+// uncontended. Nothing ever blocks: try_push fails when the ring is full and
+// try_pop when it's empty.
+template <typename T>
+class MpmcQueue {
+private:
+  // Producers and consumers each hammer their own position; keep the two on
+  // separate cache lines.
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_position;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_position;
+
+public:
+  // Capacity must be a power of two.
+  explicit MpmcQueue(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+      throw std::invalid_argument("MpmcQueue capacity must be a power of two");
+    }
+    this->cells = std::make_unique<Cell[]>(capacity);
+    for (size_t i = 0; i < capacity; i++) {
+      this->cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    this->mask = capacity - 1;
+    this->enqueue_position.store(0, std::memory_order_relaxed);
+    this->dequeue_position.store(0, std::memory_order_relaxed);
+  }
+
+  MpmcQueue(const MpmcQueue &) = delete;
+  MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+  // Moves the value in and returns true, or returns false if the ring is full.
+  bool try_push(T &value) {
+    size_t position = this->enqueue_position.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = this->cells[position & this->mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (lap == 0) {
+        if (this->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lap < 0) {
+        // The consumer a lap behind hasn't freed this cell yet.
+        return false;
+      } else {
+        position = this->enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Moves the oldest value out and returns true, or returns false if the ring
+  // is empty.
+  bool try_pop(T *value) {
+    size_t position = this->dequeue_position.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = this->cells[position & this->mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (lap == 0) {
+        if (this->dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          *value = std::move(cell.value);
+          cell.sequence.store(position + this->mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lap < 0) {
+        // No producer has filled this cell yet.
+        return false;
+      } else {
+        position = this->dequeue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
@@ -0,0 +1,197 @@
+#include "name_kernels.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Hashing lowercases into a stack buffer this many bytes at a time. Names are
+// at most 255 bytes, so in practice a name is a single chunk.
+const size_t HASH_CHUNK_SIZE = 256;
+
+// ============================================================================
+// Scalar kernels
+// ============================================================================
+
+static unsigned char to_lower_ascii(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static void lowercase_scalar(unsigned char* destination, const unsigned char* source, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    destination[i] = to_lower_ascii(source[i]);
+  }
+}
+
+static bool equal_scalar(const unsigned char* first, const unsigned char* second, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (to_lower_ascii(first[i]) != to_lower_ascii(second[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ============================================================================
+// SSE2 / AVX2 kernels
+// ============================================================================
+
+#if defined(__x86_64__)
+
+// Sets 0x20 in every byte that lies in ['A', 'Z']. Bytes >= 0x80 compare as
+// negative in the signed compares and are left alone.
+static inline __m128i lowercase_mask_sse2(__m128i v) {
+  __m128i at_least_a = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+  __m128i at_most_z = _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1));
+  return _mm_and_si128(_mm_and_si128(at_least_a, at_most_z), _mm_set1_epi8(0x20));
+}
+
+static void lowercase_sse2(unsigned char* destination, const unsigned char* source, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i),
+                     _mm_or_si128(v, lowercase_mask_sse2(v)));
+  }
+  lowercase_scalar(destination + i, source + i, size - i);
+}
+
+static bool equal_sse2(const unsigned char* first, const unsigned char* second, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i));
+    a = _mm_or_si128(a, lowercase_mask_sse2(a));
+    b = _mm_or_si128(b, lowercase_mask_sse2(b));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) {
+      return false;
+    }
+  }
+  return equal_scalar(first + i, second + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lowercase_mask_avx2(__m256i v) {
+  __m256i at_least_a = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1));
+  __m256i at_most_z = _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v);
+  return _mm256_and_si256(_mm256_and_si256(at_least_a, at_most_z), _mm256_set1_epi8(0x20));
+}
+
+__attribute__((target("avx2")))
+static void lowercase_avx2(unsigned char* destination, const unsigned char* source, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i),
+                        _mm256_or_si256(v, lowercase_mask_avx2(v)));
+  }
+  lowercase_sse2(destination + i, source + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static bool equal_avx2(const unsigned char* first, const unsigned char* second, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + i));
+    a = _mm256_or_si256(a, lowercase_mask_avx2(a));
+    b = _mm256_or_si256(b, lowercase_mask_avx2(b));
+    if (static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b))) != 0xFFFFFFFFu) {
+      return false;
+    }
+  }
+  return equal_sse2(first + i, second + i, size - i);
+}
+
+#endif
+
+// ============================================================================
+// Runtime dispatch
+// ============================================================================
+
+struct NameKernels {
+  void (*lowercase)(unsigned char*, const unsigned char*, size_t);
+  bool (*equal)(const unsigned char*, const unsigned char*, size_t);
+  const char* isa;
+};
+
+static NameKernels select_kernels() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {lowercase_avx2, equal_avx2, "avx2"};
+  }
+  // SSE2 is part of the x86-64 baseline.
+  return {lowercase_sse2, equal_sse2, "sse2"};
+#else
+  return {lowercase_scalar, equal_scalar, "scalar"};
+#endif
+}
+
+// Function-local so that names built during static initialisation of other
+// translation units still see a selected kernel set.
+static const NameKernels& kernels() {
+  static const NameKernels selected = select_kernels();
+  return selected;
+}
+
+// ============================================================================
+// Public entry points
+// ============================================================================
+
+void lowercase_wire_name(unsigned char* destination, const unsigned char* source, size_t size) {
+  kernels().lowercase(destination, source, size);
+}
+
+bool wire_names_equal(const unsigned char* first, const unsigned char* second, size_t size) {
+  return kernels().equal(first, second, size);
+}
+
+uint64_t hash_wire_name(const unsigned char* data, size_t size) {
+  // Lowercase with the vector kernel, then fold the result in 8-byte words.
+  // The word mix is the same on every ISA so hashes are stable.
+  alignas(32) unsigned char lowered[HASH_CHUNK_SIZE + 8];
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+
+  for (size_t offset = 0; offset < size; offset += HASH_CHUNK_SIZE) {
+    size_t chunk_size = size - offset < HASH_CHUNK_SIZE ? size - offset : HASH_CHUNK_SIZE;
+    lowercase_wire_name(lowered, data + offset, chunk_size);
+    // Zero-pad to a whole word.
+    std::memset(lowered + chunk_size, 0, 8);
+
+    for (size_t i = 0; i < chunk_size; i += 8) {
+      uint64_t word;
+      std::memcpy(&word, lowered + i, sizeof(word));
+      hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 32;
+    }
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+int scan_wire_labels(const unsigned char* data, size_t size) {
+  // Label boundaries form a chain (each length byte locates the next), so
+  // this hops once per label rather than once per byte.
+  int label_count = 0;
+  size_t i = 0;
+  while (i < size) {
+    unsigned char label_length = data[i];
+    if (label_length == 0x00) {
+      return i + 1 == size ? label_count : -1;
+    }
+    if (label_length > 63) {
+      return -1;
+    }
+    label_count++;
+    i += label_length + 1;
+  }
+  return -1;
+}
+
+const char* name_kernels_isa() {
+  return kernels().isa;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte kernels for wire-format names. Each one has a scalar version and, on
+// x86-64, SSE2 and AVX2 versions; the widest one the CPU supports is picked
+// once at startup. All versions return identical results, so hashes never
+// depend on the machine that computed them.
+
+// Lowercases ASCII letters. Label length bytes are at most 63, below 'A', so
+// the whole wire name can be lowercased in one sweep without walking labels.
+void lowercase_wire_name(unsigned char* destination, const unsigned char* source, size_t size);
+
+// Case-insensitive hash of a wire name.
+uint64_t hash_wire_name(const unsigned char* data, size_t size);
+
+// Case-insensitive equality of two wire names of the same size.
+bool wire_names_equal(const unsigned char* first, const unsigned char* second, size_t size);
+
+// Walks the label boundaries of an uncompressed wire name and returns the
+// number of labels, or -1 if a label is longer than 63 bytes, uses the
+// compression bits, or the root label isn't the last byte.
+int scan_wire_labels(const unsigned char* data, size_t size);
+
+// Name of the instruction set the kernels were dispatched to.
+const char* name_kernels_isa();
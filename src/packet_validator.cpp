@@ -0,0 +1,126 @@
+#include "packet_validator.h"
+#include "dns_constants.h"
+
+// Smallest possible question: root name, type and class.
+const size_t MIN_QUESTION_SIZE = 5;
+// Smallest possible resource record: root name, type, class, TTL, RDLENGTH.
+const size_t MIN_RECORD_SIZE = 11;
+
+static size_t read_count(const unsigned char* packet, size_t offset) {
+  return (static_cast<size_t>(packet[offset]) << 8) | packet[offset + 1];
+}
+
+int read_wire_name(const unsigned char* packet, size_t size, size_t offset,
+                   InlineBuffer<MAX_WIRE_NAME_SIZE>* name_bytes) {
+  size_t position = offset;
+  // Every pointer must land before the previous jump target (or before the
+  // name itself for the first one). Offsets strictly decrease, so following
+  // pointers always terminates.
+  size_t jump_limit = offset;
+  int end_offset = -1;
+  size_t name_length = 0;
+
+  while (true) {
+    if (position >= size) {
+      return -1;
+    }
+    unsigned char label_length = packet[position];
+
+    // Pointer: two high bits set, 14-bit offset.
+    if ((label_length & 0xC0) == 0xC0) {
+      if (position + 1 >= size) {
+        return -1;
+      }
+      size_t target = (static_cast<size_t>(label_length & 0x3F) << 8) | packet[position + 1];
+      if (target >= jump_limit) {
+        return -1;
+      }
+      if (end_offset == -1) {
+        end_offset = position + 2;
+      }
+      jump_limit = target;
+      position = target;
+      continue;
+    }
+
+    // 0x40 and 0x80 are reserved label types.
+    if ((label_length & 0xC0) != 0x00) {
+      return -1;
+    }
+
+    name_length += label_length + 1;
+    if (name_length > MAX_WIRE_NAME_SIZE) {
+      return -1;
+    }
+
+    if (label_length == 0x00) {
+      if (name_bytes != nullptr) {
+        name_bytes->push_back(0x00);
+      }
+      return end_offset == -1 ? position + 1 : end_offset;
+    }
+
+    if (position + 1 + label_length > size) {
+      return -1;
+    }
+    if (name_bytes != nullptr) {
+      name_bytes->append(packet + position, label_length + 1);
+    }
+    position += label_length + 1;
+  }
+}
+
+PacketVerdict validate_packet(const unsigned char* packet, size_t size) {
+  // Without a full header there's no ID to answer with.
+  if (size < HEADER_BYTE_SIZE) {
+    return PacketVerdict::Drop;
+  }
+
+  size_t question_count = read_count(packet, 4);
+  size_t record_count = read_count(packet, 6) + read_count(packet, 8) + read_count(packet, 10);
+
+  // Fast rejection: the counts alone claim more bytes than we received.
+  if (question_count * MIN_QUESTION_SIZE + record_count * MIN_RECORD_SIZE >
+      size - HEADER_BYTE_SIZE) {
+    return PacketVerdict::Malformed;
+  }
+
+  size_t offset = HEADER_BYTE_SIZE;
+  for (size_t i = 0; i < question_count; i++) {
+    int name_end = read_wire_name(packet, size, offset, nullptr);
+    // Type and class follow the name.
+    if (name_end == -1 || static_cast<size_t>(name_end) + 4 > size) {
+      return PacketVerdict::Malformed;
+    }
+    offset = name_end + 4;
+  }
+
+  for (size_t i = 0; i < record_count; i++) {
+    int name_end = read_wire_name(packet, size, offset, nullptr);
+    // Type, class, TTL and RDLENGTH follow the name.
+    if (name_end == -1 || static_cast<size_t>(name_end) + 10 > size) {
+      return PacketVerdict::Malformed;
+    }
+    size_t data_length = read_count(packet, name_end + 8);
+    if (name_end + 10 + data_length > size) {
+      return PacketVerdict::Malformed;
+    }
+    offset = name_end + 10 + data_length;
+  }
+
+  return PacketVerdict::Valid;
+}
+
+PacketVerdict validate_query(const unsigned char* packet, size_t size) {
+  if (size < HEADER_BYTE_SIZE) {
+    return PacketVerdict::Drop;
+  }
+  // Never answer responses, that's how reflection loops start.
+  if ((packet[2] & 0x80) != 0) {
+    return PacketVerdict::Drop;
+  }
+  if (read_count(packet, 4) == 0) {
+    return PacketVerdict::Malformed;
+  }
+  return validate_packet(packet, size);
+}
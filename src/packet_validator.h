@@ -0,0 +1,31 @@
+#pragma once
+
+#include "wire_name.h"
+#include <cstddef>
+
+// Outcome of validating a datagram before we parse it.
+enum class PacketVerdict {
+  // Every length, pointer and count checks out against the datagram size.
+  Valid,
+  // Has a header we can answer, but the rest is malformed. Reply FORMERR.
+  Malformed,
+  // Not worth a reply (too short to carry an ID, or not a query).
+  Drop,
+};
+
+// Single pass over the header and every section, checking lengths, pointer
+// targets and record counts against the real datagram size. It never
+// allocates and touches each byte at most once per name walk, so hostile
+// packets are rejected in bounded time.
+PacketVerdict validate_packet(const unsigned char* packet, size_t size);
+
+// validate_packet plus the checks that only apply to queries we're asked to
+// answer: QR must be clear and there must be at least one question.
+PacketVerdict validate_query(const unsigned char* packet, size_t size);
+
+// Walks the (possibly compressed) name at offset, following pointers only
+// backwards so a pointer loop can't spin. Copies the uncompressed name into
+// name_bytes when given. Returns the offset just past the name in place, or
+// -1 if the name is malformed or runs past the datagram.
+int read_wire_name(const unsigned char* packet, size_t size, size_t offset,
+                   InlineBuffer<MAX_WIRE_NAME_SIZE>* name_bytes);
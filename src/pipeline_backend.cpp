@@ -0,0 +1,244 @@
+#include "pipeline_backend.h"
+#include "receive_timestamp.h"
+#include "shutdown.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// Packets an I/O thread reads in a row before it sends queued replies again.
+const int PIPELINE_RECEIVE_BATCH = 64;
+// Longest an idle I/O thread sleeps before it looks at `stopping` again.
+const int PIPELINE_POLL_TIMEOUT_MS = 1000;
+// How often run() calls handler.tick().
+const int PIPELINE_TICK_MS = 1000;
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+PipelineBackend::IoThread::IoThread(int socket) : replies(PIPELINE_QUEUE_SIZE) {
+  this->socket = socket;
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->wake_fd == -1) {
+    throw std::runtime_error("Failed to create an eventfd for an I/O thread");
+  }
+  this->sleeping.store(false);
+  this->next_resolver = 0;
+}
+
+PipelineBackend::IoThread::~IoThread() {
+  close(this->wake_fd);
+}
+
+PipelineBackend::PipelineBackend(const std::vector<int> &sockets, QueryHandler &handler, int resolver_threads)
+    : handler(handler) {
+  for (int socket : sockets) {
+    this->io_threads.push_back(std::make_unique<IoThread>(socket));
+    enable_receive_timestamps(socket);
+  }
+  for (int i = 0; i < resolver_threads; i++) {
+    this->resolver_queues.push_back(std::make_unique<MpmcQueue<PipelineQuery>>(PIPELINE_QUEUE_SIZE));
+  }
+  this->work_signal.store(0);
+  this->idle_resolvers.store(0);
+  this->stopping.store(false);
+}
+
+void PipelineBackend::run() {
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < this->resolver_queues.size(); i++) {
+    threads.emplace_back(&PipelineBackend::run_resolver_thread, this, i);
+  }
+  for (size_t i = 0; i < this->io_threads.size(); i++) {
+    threads.emplace_back(&PipelineBackend::run_io_thread, this, i);
+  }
+
+  while (!shutdown_requested()) {
+    // Returns early with EINTR when the shutdown signal lands on this thread.
+    poll(nullptr, 0, PIPELINE_TICK_MS);
+    this->handler.tick();
+  }
+
+  stop();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void PipelineBackend::stop() {
+  this->stopping.store(true);
+  this->work_signal.fetch_add(1);
+  this->work_signal.notify_all();
+  for (auto &io : this->io_threads) {
+    uint64_t wakeup = 1;
+    ssize_t written = write(io->wake_fd, &wakeup, sizeof(wakeup));
+    (void)written;
+  }
+}
+
+// ============================================================================
+// I/O Threads
+// ============================================================================
+
+void PipelineBackend::run_io_thread(int index) {
+  IoThread &io = *this->io_threads[index];
+  pollfd descriptors[2] = {{io.socket, POLLIN, 0}, {io.wake_fd, POLLIN, 0}};
+
+  while (!this->stopping.load(std::memory_order_relaxed)) {
+    bool busy = send_replies(io);
+    busy = receive_queries(io, index) || busy;
+    if (busy) {
+      continue;
+    }
+
+    // Say we're going to sleep before the last look at the reply queue. A
+    // resolution thread queues its reply before it checks the flag, so either
+    // we see the reply here or it sees the flag and wakes us.
+    io.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!send_replies(io) && poll(descriptors, 2, PIPELINE_POLL_TIMEOUT_MS) > 0 &&
+        (descriptors[1].revents & POLLIN) != 0) {
+      uint64_t wakeups;
+      ssize_t drained = read(io.wake_fd, &wakeups, sizeof(wakeups));
+      (void)drained;
+    }
+    io.sleeping.store(false, std::memory_order_relaxed);
+  }
+}
+
+bool PipelineBackend::receive_queries(IoThread &io, int index) {
+  bool received = false;
+  PipelineQuery query;
+  alignas(cmsghdr) char control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+  iovec payload = {query.bytes.data(), query.bytes.size()};
+  int64_t now = now_ms();
+  for (int i = 0; i < PIPELINE_RECEIVE_BATCH; i++) {
+    msghdr message = {};
+    message.msg_name = &query.client;
+    message.msg_namelen = sizeof(query.client);
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t size = recvmsg(io.socket, &message, MSG_DONTWAIT);
+    if (size == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("Error receiving data");
+      }
+      break;
+    }
+    received = true;
+    query.size = size;
+    query.io_thread = index;
+    // Backdated by the time it spent in the socket buffer, when the kernel
+    // says.
+    int64_t buffered_ms = receive_delay_ms(message);
+    query.received_ms = buffered_ms < 0 ? now : now - buffered_ms;
+    // Dropped if every resolution queue is full.
+    queue_query(io, query);
+  }
+  return received;
+}
+
+bool PipelineBackend::queue_query(IoThread &io, PipelineQuery &query) {
+  size_t count = this->resolver_queues.size();
+  for (size_t i = 0; i < count; i++) {
+    size_t target = (io.next_resolver + i) % count;
+    if (this->resolver_queues[target]->try_push(query)) {
+      io.next_resolver = target + 1;
+      this->work_signal.fetch_add(1);
+      if (this->idle_resolvers.load() > 0) {
+        this->work_signal.notify_one();
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PipelineBackend::send_replies(IoThread &io) {
+  bool sent = false;
+  PipelineReply reply;
+  while (io.replies.try_pop(&reply)) {
+    sent = true;
+    if (sendto(io.socket, reply.bytes.data(), reply.bytes.size(), 0,
+               reinterpret_cast<const sockaddr *>(&reply.client), sizeof(reply.client)) == -1) {
+      perror("Failed to send response");
+    }
+  }
+  return sent;
+}
+
+// ============================================================================
+// Resolution Threads
+// ============================================================================
+
+void PipelineBackend::run_resolver_thread(int index) {
+  PipelineQuery query;
+  while (!this->stopping.load(std::memory_order_relaxed)) {
+    if (take_query(index, &query)) {
+      serve_query(query);
+      continue;
+    }
+
+    // Read the signal, then look once more: a query queued after this look
+    // has bumped the signal, so the wait returns straight away.
+    uint32_t seen = this->work_signal.load();
+    if (take_query(index, &query)) {
+      serve_query(query);
+      continue;
+    }
+    this->idle_resolvers.fetch_add(1);
+    this->work_signal.wait(seen);
+    this->idle_resolvers.fetch_sub(1);
+  }
+}
+
+bool PipelineBackend::take_query(int index, PipelineQuery *query) {
+  // Our own queue first, then steal from the others.
+  size_t count = this->resolver_queues.size();
+  for (size_t i = 0; i < count; i++) {
+    if (this->resolver_queues[(index + i) % count]->try_pop(query)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PipelineBackend::serve_query(const PipelineQuery &query) {
+  // Too stale to be worth answering; the client has retried by now.
+  if (!this->handler.record_queue_delay(now_ms() - query.received_ms)) {
+    return;
+  }
+
+  this->handler.handle_query(query.bytes.data(), query.size, query.client, [&](std::vector<unsigned char> &bytes) {
+    queue_reply(query, std::move(bytes));
+  });
+}
+
+// Hands a reply to the I/O thread that received the query, waking it if it's
+// asleep.
+void PipelineBackend::queue_reply(const PipelineQuery &query, std::vector<unsigned char> bytes) {
+  PipelineReply reply;
+  reply.bytes = std::move(bytes);
+  reply.client = query.client;
+
+  IoThread &io = *this->io_threads[query.io_thread];
+  if (!io.replies.try_push(reply)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (io.sleeping.load(std::memory_order_relaxed) && io.sleeping.exchange(false)) {
+    uint64_t wakeup = 1;
+    ssize_t written = write(io.wake_fd, &wakeup, sizeof(wakeup));
+    (void)written;
+  }
+}
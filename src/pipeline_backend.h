@@ -0,0 +1,92 @@
+#pragma once
+
+#include "dns_constants.h"
+#include "mpmc_queue.h"
+#include "query_handler.h"
+#include <netinet/in.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Queries waiting for each resolution thread, and replies waiting for each
+// I/O thread.
+const size_t PIPELINE_QUEUE_SIZE = 4096;
+
+// Staged backend. I/O threads own the listening sockets, one each, all bound
+// to the same port with SO_REUSEPORT so the kernel shards clients between
+// them, and do nothing but receive and send. Every query goes over a bounded
+// lock-free queue to a pool of resolution threads that run handle_query,
+// including the synchronous upstream round trips, so cache misses and zone
+// lookups never hold up packet I/O and the two pools can be sized apart.
+//
+// Each resolution thread has its own queue, filled round-robin by the I/O
+// threads; a resolution thread with nothing queued steals from the others.
+// Replies go back over a queue per I/O thread. When the queues are full the
+// query or reply is dropped, as an overflowing socket buffer would. Time spent
+// in the socket buffer and the resolution queues is the queueing delay
+// admission control sheds on.
+class PipelineBackend {
+private:
+  struct PipelineQuery {
+    std::array<char, BUFFER_SIZE> bytes;
+    int size;
+    sockaddr_in client;
+    // The I/O thread it came in on; the reply goes out the same socket.
+    int io_thread;
+    // When the kernel received it, on the steady clock, for the queueing
+    // delay. When the I/O thread read it if the kernel didn't stamp it.
+    int64_t received_ms;
+  };
+
+  struct PipelineReply {
+    std::vector<unsigned char> bytes;
+    sockaddr_in client;
+  };
+
+  struct IoThread {
+    int socket;
+    // Written when a reply is queued while the thread sleeps in poll.
+    int wake_fd;
+    std::atomic<bool> sleeping;
+    MpmcQueue<PipelineReply> replies;
+    // Resolution queue the next query is offered to first.
+    size_t next_resolver;
+
+    IoThread(int socket);
+    ~IoThread();
+  };
+
+  QueryHandler &handler;
+  std::vector<std::unique_ptr<IoThread>> io_threads;
+  std::vector<std::unique_ptr<MpmcQueue<PipelineQuery>>> resolver_queues;
+  // Bumped for every queued query; idle resolution threads wait on it.
+  std::atomic<uint32_t> work_signal;
+  std::atomic<int> idle_resolvers;
+  std::atomic<bool> stopping;
+
+  void run_io_thread(int index);
+  bool receive_queries(IoThread &io, int index);
+  bool send_replies(IoThread &io);
+  bool queue_query(IoThread &io, PipelineQuery &query);
+
+  void run_resolver_thread(int index);
+  bool take_query(int index, PipelineQuery *query);
+  void serve_query(const PipelineQuery &query);
+  void queue_reply(const PipelineQuery &query, std::vector<unsigned char> bytes);
+
+  void stop();
+
+public:
+  // One I/O thread per socket. Throws std::runtime_error if the wake-up
+  // eventfds can't be created.
+  PipelineBackend(const std::vector<int> &sockets, QueryHandler &handler, int resolver_threads);
+
+  PipelineBackend(const PipelineBackend &) = delete;
+  PipelineBackend &operator=(const PipelineBackend &) = delete;
+
+  // Serves until shutdown is requested, calling handler.tick() from the
+  // calling thread.
+  void run();
+};
@@ -0,0 +1,549 @@
+#include "query_handler.h"
+#include "name_kernels.h"
+#include "packet_validator.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// TTL on sinkhole answers. Short, so a name taken off the list recovers soon.
+const uint32_t BLOCKED_ANSWER_TTL = 60;
+
+static uint16_t read_u16(const unsigned char *bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+// Random IDs for pass-through queries, so replies can't be predicted and
+// spoofed. One generator per thread, since several may forward at once.
+static uint16_t random_upstream_id() {
+  thread_local std::mt19937 generator(std::random_device{}());
+  return generator() & 0xFFFF;
+}
+
+// Cuts a reply down to its header and question, with TC set and every other
+// section dropped, so the client retries over TCP.
+static void truncate_reply(std::vector<unsigned char> *reply) {
+  if (reply->size() < HEADER_BYTE_SIZE) {
+    return;
+  }
+  // Just the first question, if it's there whole.
+  size_t end = HEADER_BYTE_SIZE;
+  if (read_u16(reply->data() + 4) > 0) {
+    int name_end = read_wire_name(reply->data(), reply->size(), end, nullptr);
+    if (name_end != -1 && static_cast<size_t>(name_end) + 4 <= reply->size()) {
+      end = name_end + 4;
+    }
+  }
+  reply->resize(end);
+  (*reply)[2] |= TRUNCATION_FLAG;
+  (*reply)[5] = end > HEADER_BYTE_SIZE ? 1 : 0;
+  (*reply)[4] = 0;
+  std::fill(reply->begin() + 6, reply->begin() + HEADER_BYTE_SIZE, 0);
+}
+
+// Largest reply the client takes over UDP: 512 bytes, or the payload size in
+// its OPT record, up to MAX_UDP_REPLY_SIZE.
+static size_t client_reply_limit(const DNSPacket &query) {
+  for (const auto &record : query.get_additional_section()) {
+    if (record.get_type_code() == OPT_RECORD_TYPE) {
+      auto payload_size = record.get_ans_class();
+      size_t limit = (payload_size[0] << 8) | payload_size[1];
+      return std::clamp<size_t>(limit, BUFFER_SIZE, MAX_UDP_REPLY_SIZE);
+    }
+  }
+  return BUFFER_SIZE;
+}
+
+// The client's query as a PassThroughQuery, or one with no bytes if it can't
+// be forwarded as is: anything but one recursive question with an
+// uncompressed name, and no records besides an OPT.
+static PassThroughQuery make_pass_through_query(const char *buffer, int size) {
+  PassThroughQuery query;
+  query.question_end = 0;
+  query.reply_limit = BUFFER_SIZE;
+
+  auto bytes = reinterpret_cast<const unsigned char *>(buffer);
+  if ((bytes[2] & RECURSION_DESIRED_FLAG) == 0 || read_u16(bytes + 4) != 1 || read_u16(bytes + 6) != 0 ||
+      read_u16(bytes + 8) != 0 || read_u16(bytes + 10) > 1) {
+    return query;
+  }
+  size_t offset = HEADER_BYTE_SIZE;
+  while (offset < static_cast<size_t>(size) && bytes[offset] != 0) {
+    if (bytes[offset] > 63) {
+      return query;
+    }
+    offset += bytes[offset] + 1;
+  }
+  size_t question_end = offset + 5;
+  if (question_end > static_cast<size_t>(size)) {
+    return query;
+  }
+
+  // An OPT record's class is the client's UDP payload size.
+  if (read_u16(bytes + 10) == 1) {
+    if (question_end + 11 > static_cast<size_t>(size) || bytes[question_end] != 0 ||
+        read_u16(bytes + question_end + 1) != OPT_RECORD_TYPE) {
+      return query;
+    }
+    // Bigger than any datagram we'd read from upstream.
+    size_t payload_size = read_u16(bytes + question_end + 3);
+    if (payload_size > MAX_UPSTREAM_UDP_SIZE) {
+      return query;
+    }
+    if (payload_size > query.reply_limit) {
+      query.reply_limit = payload_size;
+    }
+  }
+
+  query.question_end = question_end;
+  query.bytes.assign(bytes, bytes + size);
+  return query;
+}
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+QueryHandler::QueryHandler(const ServerOptions &options)
+    : rate_limiter(options.rrl_responses_per_second, options.rrl_slip,
+                   options.max_client_qps),
+      admission(options.max_inflight, options.max_inflight_per_client,
+                static_cast<size_t>(options.inflight_memory_mb) << 20),
+      resolver(options) {
+  if (!options.blocklist.empty()) {
+    this->blocklist = Blocklist::load(options.blocklist);
+    std::cout << "Blocking " << this->blocklist.get_entry_count() << " names from " << options.blocklist
+              << " (" << this->blocklist.get_image_size() << " bytes)" << std::endl;
+  }
+  this->sinkhole = !options.blocklist_sinkhole.empty();
+  this->sinkhole_address = {};
+  if (this->sinkhole) {
+    inet_pton(AF_INET, options.blocklist_sinkhole.c_str(), this->sinkhole_address.data());
+  }
+  this->last_snapshot_ms = now_ms();
+  this->options = options;
+}
+
+const ServerOptions &QueryHandler::get_options() const {
+  return this->options;
+}
+
+Resolver &QueryHandler::get_resolver() {
+  return this->resolver;
+}
+
+TcpUpstreamPool &QueryHandler::get_tcp_pool() {
+  return this->tcp_pool;
+}
+
+void QueryHandler::tick() {
+  int interval = this->options.cache_snapshot_interval;
+  int64_t now = now_ms();
+  if (interval > 0 && now - this->last_snapshot_ms >= interval * 1000LL) {
+    this->last_snapshot_ms = now;
+    this->resolver.save_snapshot();
+  }
+  std::lock_guard lock(this->tcp_mutex);
+  this->tcp_pool.close_idle(now);
+}
+
+void QueryHandler::save_cache_snapshot() {
+  this->resolver.save_snapshot();
+}
+
+QueryResult QueryHandler::admit_query(const char *buffer, int size, const sockaddr_in &client) {
+  auto result = classify_query(buffer, size, client);
+  if (result.disposition == QueryDisposition::Respond && !limit_response(client, &result.response)) {
+    result.disposition = QueryDisposition::Drop;
+    result.response.clear();
+  }
+  return result;
+}
+
+QueryResult QueryHandler::classify_query(const char *buffer, int size, const sockaddr_in &client) {
+  QueryResult result;
+  result.disposition = QueryDisposition::Drop;
+  result.admission_cost = 0;
+  result.reply_limit = BUFFER_SIZE;
+
+  // Per-source cap first, before we spend anything on the packet.
+  if (this->rate_limiter.check_query(client) == RateLimitAction::Drop) {
+    return result;
+  }
+
+  // Validate before anything is parsed or allocated.
+  auto verdict = validate_query(reinterpret_cast<const unsigned char *>(buffer), size);
+  if (verdict == PacketVerdict::Drop) {
+    return result;
+  }
+  if (verdict == PacketVerdict::Malformed) {
+    result.disposition = QueryDisposition::Respond;
+    result.response = DNSPacket::create_error_packet(buffer, RCODE_FORMAT_ERROR);
+    return result;
+  }
+
+  auto packet_received = DNSPacket(buffer, size);
+  result.reply_limit = client_reply_limit(packet_received);
+  // std::cout << "Packet Received: " << std::endl;
+  // packet_received.print_dns_packet();
+
+  // Blocked names never reach the zone, the cache or upstream.
+  if (respond_if_blocked(packet_received, &result.response)) {
+    result.disposition = QueryDisposition::Respond;
+    return result;
+  }
+
+  // Resolve what we can from the zone and cache; only what's left goes
+  // upstream.
+  auto response_packet = DNSPacket::prepare_forward_response(packet_received);
+  bool needs_upstream = false;
+  for (const auto &question : response_packet.get_question_section()) {
+    result.resolutions.emplace_back(question);
+    if (!this->resolver.advance(result.resolutions.back())) {
+      needs_upstream = true;
+    }
+  }
+
+  if (needs_upstream) {
+    // Cache hits are cheap and always served; only upstream work is held to
+    // the in-flight limits. The cost is what the query will hold while it
+    // waits, estimated up front.
+    size_t cost = sizeof(QueryResult) + size + result.resolutions.capacity() * sizeof(Resolution);
+    auto admission = this->admission.acquire(client, cost);
+    if (admission != Admission::Admit) {
+      response_packet.set_response_code(admission == Admission::Refuse ? RCODE_REFUSED : RCODE_SERVER_FAILURE);
+      result.disposition = QueryDisposition::Respond;
+      result.response = response_packet.get_packet_vector();
+      result.resolutions.clear();
+      return result;
+    }
+    result.disposition = QueryDisposition::Forward;
+    result.packet = response_packet;
+    result.admission_cost = cost;
+    // A lone question that still needs its first link from the forwarder can
+    // be relayed instead of assembled; anything the zone or cache already
+    // answered part of can't.
+    const Resolution &resolution = result.resolutions.front();
+    if (result.resolutions.size() == 1 && !resolution.is_iterative() && resolution.get_answers().empty()) {
+      result.pass_through = make_pass_through_query(buffer, size);
+    }
+    return result;
+  }
+
+  // std::cout << "Response from this server: " << std::endl;
+  // response_packet.print_dns_packet();
+  result.disposition = QueryDisposition::Respond;
+  result.response = build_response(response_packet, result.resolutions, result.reply_limit);
+  return result;
+}
+
+bool QueryHandler::respond_if_blocked(const DNSPacket &query, std::vector<unsigned char> *response) const {
+  if (this->blocklist.empty()) {
+    return false;
+  }
+
+  std::vector<Answer> answers;
+  bool blocked = false;
+  for (const auto &question : query.get_question_section()) {
+    if (this->blocklist.match(question.get_domain_name()) == BlocklistMatch::None) {
+      continue;
+    }
+    blocked = true;
+    // Other types get an empty NOERROR answer from the sinkhole.
+    if (this->sinkhole && question.get_type_code() == static_cast<uint16_t>(RecordType::A) &&
+        question.get_class_code() == CLASS_IN) {
+      answers.push_back(Answer::make<RecordType::A>(question.get_domain_name(), CLASS_IN, BLOCKED_ANSWER_TTL,
+                                                    this->sinkhole_address));
+    }
+  }
+  if (!blocked) {
+    return false;
+  }
+
+  auto response_packet = DNSPacket::prepare_forward_response(query);
+  if (this->sinkhole) {
+    response_packet.add_answers(answers);
+  } else {
+    response_packet.set_response_code(RCODE_NAME_ERROR);
+  }
+  *response = response_packet.get_packet_vector();
+  return true;
+}
+
+std::vector<unsigned char> QueryHandler::build_response(DNSPacket &response,
+                                                        const std::vector<Resolution> &resolutions,
+                                                        size_t reply_limit) {
+  for (const auto &resolution : resolutions) {
+    if (resolution.is_truncated()) {
+      return response.get_truncated_packet_vector();
+    }
+  }
+  for (const auto &resolution : resolutions) {
+    response.add_answers(resolution.get_answers());
+    response.add_authority_records(resolution.get_authority());
+    if (resolution.get_response_code() != RCODE_NO_ERROR && response.get_response_code() == RCODE_NO_ERROR) {
+      response.set_response_code(resolution.get_response_code());
+    }
+  }
+  auto packet = response.get_packet_vector();
+  // A big answer fetched over TCP; the client can retry over TCP itself.
+  if (packet.size() > reply_limit) {
+    return response.get_truncated_packet_vector();
+  }
+  return packet;
+}
+
+std::vector<unsigned char> QueryHandler::forward_query(QueryResult &result) {
+  std::vector<unsigned char> reply;
+  bool pass_through = !result.pass_through.bytes.empty();
+
+  for (auto &resolution : result.resolutions) {
+    while (!resolution.is_done()) {
+      // Pass-through queries get a fresh ID; the rest keep the client's.
+      uint16_t upstream_id = pass_through ? random_upstream_id() : result.packet.get_transaction_id();
+      auto query = pass_through ? create_pass_through_query(result.pass_through, upstream_id)
+                                : result.packet.create_upstream_query(resolution.get_upstream_question(),
+                                                                      upstream_id, !resolution.is_iterative());
+      if (exchange_with_upstream(query, resolution.get_upstream_server(), &reply)) {
+        auto reply_bytes = reinterpret_cast<const char *>(reply.data());
+        // Relayed before anything parses it; cache_relayed_reply feeds it to
+        // the cache once it has gone out.
+        std::vector<unsigned char> relayed;
+        if (pass_through &&
+            relay_upstream_reply(result.pass_through, upstream_id, reply_bytes, reply.size(), &relayed)) {
+          result.uncached_reply = std::move(reply);
+          return relayed;
+        }
+        this->resolver.add_upstream_reply(resolution, reply_bytes, reply.size());
+      } else {
+        this->resolver.add_upstream_timeout(resolution);
+      }
+      // Only the first reply can be relayed. A rejected one, or a CNAME hop
+      // after it, is answered the usual way.
+      pass_through = false;
+      this->resolver.advance(resolution);
+    }
+  }
+
+  return build_response(result.packet, result.resolutions, result.reply_limit);
+}
+
+void QueryHandler::cache_relayed_reply(QueryResult &result) {
+  if (result.uncached_reply.empty()) {
+    return;
+  }
+  auto &reply = result.uncached_reply;
+  this->resolver.add_upstream_reply(result.resolutions.front(), reinterpret_cast<const char *>(reply.data()),
+                                    reply.size());
+  reply.clear();
+}
+
+std::vector<unsigned char> QueryHandler::create_pass_through_query(const PassThroughQuery &query,
+                                                                  uint16_t upstream_id) {
+  std::vector<unsigned char> packet = query.bytes;
+  packet[0] = upstream_id >> 8;
+  packet[1] = upstream_id & 0xFF;
+  return packet;
+}
+
+bool QueryHandler::relay_upstream_reply(const PassThroughQuery &query, uint16_t upstream_id, const char *reply,
+                                        int size, std::vector<unsigned char> *response) {
+  auto bytes = reinterpret_cast<const unsigned char *>(reply);
+  size_t question_end = query.question_end;
+  if (size < 0 || static_cast<size_t>(size) < question_end || static_cast<size_t>(size) > query.reply_limit) {
+    return false;
+  }
+  if (read_u16(bytes) != upstream_id || (bytes[2] & RESPONSE_FLAG) == 0 || read_u16(bytes + 4) != 1) {
+    return false;
+  }
+
+  // The question must be ours, its name in any case (RFC 4343) and its type
+  // and class exactly.
+  const unsigned char *question = query.bytes.data();
+  size_t name_size = question_end - 4 - HEADER_BYTE_SIZE;
+  if (!wire_names_equal(bytes + HEADER_BYTE_SIZE, question + HEADER_BYTE_SIZE, name_size) ||
+      std::memcmp(bytes + question_end - 4, question + question_end - 4, 4) != 0) {
+    return false;
+  }
+
+  response->assign(bytes, bytes + size);
+  (*response)[0] = question[0];
+  (*response)[1] = question[1];
+  return true;
+}
+
+bool QueryHandler::exchange_with_upstream(const std::vector<unsigned char> &query, const sockaddr_in &server,
+                                          std::vector<unsigned char> *reply) {
+  // A fresh socket per query, so a late reply can't be mistaken for the next.
+  int forward_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (forward_socket == -1) {
+    perror("Failed to create forward socket");
+    return false;
+  }
+
+  int timeout_ms = this->resolver.get_upstream_timeout_ms();
+  timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+  setsockopt(forward_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  ssize_t sent_bytes = sendto(forward_socket, query.data(), query.size(), 0,
+                              reinterpret_cast<const sockaddr *>(&server), sizeof(server));
+  if (sent_bytes == -1) {
+    perror("Failed to send forward query");
+    close(forward_socket);
+    return false;
+  }
+  std::cout << "Sent " << sent_bytes << " bytes upstream" << std::endl;
+
+  reply->resize(MAX_UPSTREAM_UDP_SIZE);
+  ssize_t reply_size = recv(forward_socket, reply->data(), reply->size(), 0);
+  close(forward_socket);
+  if (reply_size == -1) {
+    perror("Error receiving data from upstream");
+    return false;
+  }
+  reply->resize(reply_size);
+  std::cout << "Received " << reply_size << " bytes from upstream" << std::endl;
+
+  // Retry a truncated reply over TCP. If that fails too, the truncated reply
+  // is returned as is: the resolver keeps nothing from it, and the client is
+  // told to retry over TCP.
+  if (reply->size() >= HEADER_BYTE_SIZE && ((*reply)[2] & TRUNCATION_FLAG) != 0) {
+    std::vector<unsigned char> tcp_reply;
+    if (exchange_over_tcp(query, server, &tcp_reply)) {
+      *reply = std::move(tcp_reply);
+    }
+  }
+  return true;
+}
+
+bool QueryHandler::exchange_over_tcp(const std::vector<unsigned char> &query, const sockaddr_in &server,
+                                     std::vector<unsigned char> *reply) {
+  std::unique_lock lock(this->tcp_mutex);
+
+  // Our own ID on the connection: threads forwarding queries with the same
+  // client ID would otherwise take each other's replies.
+  uint16_t id = random_upstream_id();
+  while (this->tcp_exchanges.contains(id)) {
+    id = random_upstream_id();
+  }
+  std::vector<unsigned char> tcp_query = query;
+  tcp_query[0] = id >> 8;
+  tcp_query[1] = id & 0xFF;
+
+  int index = this->tcp_pool.send_query(server, tcp_query);
+  if (index == -1) {
+    return false;
+  }
+  TcpExchange exchange{index, this->tcp_pool.get_generation(index), {}, false};
+  this->tcp_exchanges[id] = &exchange;
+
+  int64_t deadline = now_ms() + this->resolver.get_upstream_timeout_ms();
+  for (int64_t now = now_ms(); !exchange.done && now < deadline; now = now_ms()) {
+    if (this->tcp_pool.get_generation(index) != exchange.generation) {
+      // Closed by tick() or another thread's error handling.
+      break;
+    }
+    if (this->tcp_polled.contains(index)) {
+      this->tcp_replies.wait_for(lock, std::chrono::milliseconds(deadline - now));
+    } else {
+      poll_tcp_connection(lock, index, exchange.generation, deadline);
+    }
+  }
+
+  this->tcp_exchanges.erase(id);
+  if (!exchange.done && this->tcp_pool.get_generation(index) == exchange.generation) {
+    this->tcp_pool.cancel_query(index, id);
+  }
+  if (exchange.reply.empty()) {
+    return false;
+  }
+  std::cout << "Received " << exchange.reply.size() << " bytes from upstream over TCP" << std::endl;
+  *reply = std::move(exchange.reply);
+  (*reply)[0] = query[0];
+  (*reply)[1] = query[1];
+  return true;
+}
+
+void QueryHandler::poll_tcp_connection(std::unique_lock<std::mutex> &lock, int index, uint32_t generation,
+                                       int64_t deadline) {
+  pollfd descriptor = {this->tcp_pool.get_fd(index), POLLIN, 0};
+  if (this->tcp_pool.wants_write(index)) {
+    descriptor.events |= POLLOUT;
+  }
+  this->tcp_polled.insert(index);
+  lock.unlock();
+  int ready = poll(&descriptor, 1, deadline - now_ms());
+  lock.lock();
+  this->tcp_polled.erase(index);
+
+  if (ready > 0 && this->tcp_pool.get_generation(index) == generation) {
+    std::vector<std::vector<unsigned char>> replies;
+    bool open = this->tcp_pool.handle_events(index, descriptor.revents, &replies);
+    // Replies to exchanges that timed out can still turn up; they match
+    // nothing and are dropped.
+    for (auto &candidate : replies) {
+      if (candidate.size() < HEADER_BYTE_SIZE) {
+        continue;
+      }
+      auto waiting = this->tcp_exchanges.find((candidate[0] << 8) | candidate[1]);
+      if (waiting != this->tcp_exchanges.end() && waiting->second->connection == index &&
+          waiting->second->generation == generation) {
+        waiting->second->reply = std::move(candidate);
+        waiting->second->done = true;
+      }
+    }
+    if (!open) {
+      for (auto &[id, exchange] : this->tcp_exchanges) {
+        if (exchange->connection == index && exchange->generation == generation) {
+          exchange->done = true;
+        }
+      }
+    }
+  }
+  // Wake everyone: some have replies, and someone has to take over polling.
+  this->tcp_replies.notify_all();
+}
+
+void QueryHandler::release_upstream_slot(const sockaddr_in &client, size_t cost) {
+  this->admission.release(client, cost);
+}
+
+bool QueryHandler::record_queue_delay(int64_t delay_ms) {
+  return this->admission.record_queue_delay(delay_ms);
+}
+
+bool QueryHandler::limit_response(const sockaddr_in &client, std::vector<unsigned char> *response) {
+  auto action = this->rate_limiter.check_response(client, response->data(), response->size());
+  if (action == RateLimitAction::Drop) {
+    return false;
+  }
+  if (action == RateLimitAction::Slip) {
+    truncate_reply(response);
+  }
+  return true;
+}
+
+void QueryHandler::handle_query(const char *buffer, int size, const sockaddr_in &client,
+                                const std::function<void(std::vector<unsigned char> &)> &send) {
+  auto result = admit_query(buffer, size, client);
+
+  if (result.disposition == QueryDisposition::Forward) {
+    auto response = forward_query(result);
+    if (limit_response(client, &response)) {
+      send(response);
+    }
+    cache_relayed_reply(result);
+    release_upstream_slot(client, result.admission_cost);
+  } else if (result.disposition == QueryDisposition::Respond) {
+    send(result.response);
+  }
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "admission_control.h"
+#include "blocklist.h"
+#include "dns_packet.h"
+#include "rate_limiter.h"
+#include "record_codec.h"
+#include "resolver.h"
+#include "server_options.h"
+#include "tcp_upstream_pool.h"
+#include <netinet/in.h>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum class QueryDisposition {
+  // Send nothing back.
+  Drop,
+  // `response` holds the complete reply.
+  Respond,
+  // `packet` holds the response so far and `resolutions` the questions that
+  // still need answers from upstream.
+  Forward,
+};
+
+// A single-question query forwarded as the client sent it, with only the
+// transaction ID swapped, so the upstream reply can go back byte for byte:
+// compression, authority and additional sections and EDNS intact.
+struct PassThroughQuery {
+  // The client's query. Empty when it can't be passed through.
+  std::vector<unsigned char> bytes;
+  // Where its question section ends.
+  size_t question_end;
+  // Largest reply the client takes over UDP: 512 bytes, or more if its OPT
+  // record says so.
+  size_t reply_limit;
+};
+
+struct QueryResult {
+  QueryDisposition disposition;
+  std::vector<unsigned char> response;
+  DNSPacket packet;
+  std::vector<Resolution> resolutions;
+  // Set for a Forward result whose first upstream reply may be relayed as is.
+  PassThroughQuery pass_through;
+  // Largest reply the client takes over UDP; pass it to build_response.
+  size_t reply_limit;
+  // Bytes charged against the in-flight budget for a Forward result; hand
+  // them back with release_upstream_slot once its reply is built.
+  size_t admission_cost;
+  // Upstream's reply, when forward_query relayed it before the cache saw it;
+  // see cache_relayed_reply.
+  std::vector<unsigned char> uncached_reply;
+};
+
+// Everything we do with a client datagram that doesn't depend on how the
+// bytes got here: validation, rate limiting, blocking, local answers and
+// resolution from the zone and cache. Backends call admit_query and drive the
+// upstream I/O through get_resolver() themselves, or call handle_query to
+// forward synchronously. handle_query may be called from several threads at
+// once, with tick called from one more; the rest is for single-threaded
+// backends.
+class QueryHandler {
+private:
+  ServerOptions options;
+  RateLimiter rate_limiter;
+  AdmissionControl admission;
+  Blocklist blocklist;
+  // Blocked A queries get this address when set, otherwise NXDOMAIN.
+  bool sinkhole;
+  RecordCodec<RecordType::A>::Value sinkhole_address;
+  Resolver resolver;
+  // A synchronous TCP exchange waiting for its reply.
+  struct TcpExchange {
+    int connection;
+    uint32_t generation;
+    // Empty if the connection closed first.
+    std::vector<unsigned char> reply;
+    bool done;
+  };
+
+  TcpUpstreamPool tcp_pool;
+  // Guards tcp_pool, tcp_exchanges and tcp_polled. Never held across a wait:
+  // one thread at a time polls each connection, hands every reply to its
+  // exchange by ID and wakes the others through tcp_replies.
+  std::mutex tcp_mutex;
+  std::condition_variable tcp_replies;
+  // By the ID their query went out with.
+  std::unordered_map<uint16_t, TcpExchange *> tcp_exchanges;
+  // Connections some thread is polling right now.
+  std::unordered_set<int> tcp_polled;
+  int64_t last_snapshot_ms;
+
+  // admit_query before response rate limiting.
+  QueryResult classify_query(const char *buffer, int size, const sockaddr_in &client);
+
+  // Fills in the reply and returns true if any question names a blocked
+  // domain.
+  bool respond_if_blocked(const DNSPacket &query, std::vector<unsigned char> *response) const;
+
+  // Sends one query over UDP and waits for the reply, retrying over a pooled
+  // TCP connection if it comes back truncated.
+  bool exchange_with_upstream(const std::vector<unsigned char> &query, const sockaddr_in &server,
+                              std::vector<unsigned char> *reply);
+  bool exchange_over_tcp(const std::vector<unsigned char> &query, const sockaddr_in &server,
+                         std::vector<unsigned char> *reply);
+  // One poll of a connection for whoever is waiting on it. Called and
+  // returns with the lock held; drops it while polling.
+  void poll_tcp_connection(std::unique_lock<std::mutex> &lock, int index, uint32_t generation,
+                           int64_t deadline);
+
+public:
+  QueryHandler(const ServerOptions &options);
+
+  const ServerOptions &get_options() const;
+  Resolver &get_resolver();
+  TcpUpstreamPool &get_tcp_pool();
+
+  QueryResult admit_query(const char *buffer, int size, const sockaddr_in &client);
+
+  // Finishes a Forward result synchronously, one upstream round trip per
+  // missing link or referral, and returns the reply.
+  std::vector<unsigned char> forward_query(QueryResult &result);
+  // Call once the reply forward_query returned has gone out. A pass-through
+  // reply is relayed before it's parsed, so the client isn't kept waiting on
+  // the cache; this is where the cache gets it.
+  void cache_relayed_reply(QueryResult &result);
+
+  // Ends a Forward result's claim on the in-flight limits. Every Forward
+  // result admit_query returns must be released exactly once.
+  void release_upstream_slot(const sockaddr_in &client, size_t cost);
+  // Backends report how long each query waited before they got to it (see
+  // AdmissionControl). Returns false if it waited so long it should be
+  // dropped.
+  bool record_queue_delay(int64_t delay_ms);
+  // Response rate limiting, once the reply is known (see RateLimiter).
+  // admit_query does it for Respond results; backends call it on the reply
+  // to a Forward result before it goes out. Returns false if the reply should
+  // be dropped. A slipped reply is cut down to a truncated one in place.
+  bool limit_response(const sockaddr_in &client, std::vector<unsigned char> *response);
+
+  // Periodic housekeeping; backends call this from their event loops.
+  void tick();
+  // Writes the cache snapshot, if configured. Called on shutdown.
+  void save_cache_snapshot();
+
+  // The client's query with `upstream_id` in place of its transaction ID.
+  static std::vector<unsigned char> create_pass_through_query(const PassThroughQuery &query,
+                                                              uint16_t upstream_id);
+  // Checks the upstream reply to a pass-through query: our ID, a response to
+  // the same question, small enough for the client. If it passes, copies it
+  // into `response` with the client's ID put back and returns true.
+  static bool relay_upstream_reply(const PassThroughQuery &query, uint16_t upstream_id, const char *reply,
+                                   int size, std::vector<unsigned char> *response);
+
+  // The reply for `response` once every resolution is done. Cut down to the
+  // header and questions with TC set if it's bigger than `reply_limit` or a
+  // resolution ended on a truncated reply.
+  static std::vector<unsigned char> build_response(DNSPacket &response,
+                                                   const std::vector<Resolution> &resolutions,
+                                                   size_t reply_limit);
+
+  // Answers one datagram synchronously and hands the reply, if there is one,
+  // to `send`, which may keep the bytes. Work that can wait for the reply,
+  // like caching it, happens after `send` returns.
+  void handle_query(const char *buffer, int size, const sockaddr_in &client,
+                    const std::function<void(std::vector<unsigned char> &)> &send);
+};
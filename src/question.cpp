@@ -2,7 +2,7 @@
 #include <vector>
 // #include <iostream>
 
-Question::Question(std::vector<unsigned char> domain_name,
+Question::Question(WireName domain_name,
                std::array<unsigned char, 2> type,
                std::array<unsigned char, 2> ques_class) {
   this->domain_name = domain_name;
@@ -10,11 +10,9 @@ Question::Question(std::vector<unsigned char> domain_name,
   this->ques_class = ques_class;
 }
 
-void Question::add_question_into_return_packet(std::vector<unsigned char>* return_packet) {
+void Question::add_question_into_return_packet(std::vector<unsigned char>* return_packet) const {
   // Copy in the domain name first
-  for (auto domain_char : this->domain_name) {
-    return_packet->push_back(domain_char);
-  }
+  this->domain_name.add_name_into_return_packet(return_packet);
 
   // Copy in the type
   return_packet->push_back(this->type[0]);
@@ -25,6 +23,22 @@ void Question::add_question_into_return_packet(std::vector<unsigned char>* retur
   return_packet->push_back(this->ques_class[1]);
 }
 
-std::vector<unsigned char> Question::get_domain_name() {
+const WireName& Question::get_domain_name() const {
   return this->domain_name;
+}
+
+std::array<unsigned char, 2> Question::get_type() const {
+  return this->type;
+}
+
+std::array<unsigned char, 2> Question::get_ques_class() const {
+  return this->ques_class;
+}
+
+uint16_t Question::get_type_code() const {
+  return (this->type[0] << 8) | this->type[1];
+}
+
+uint16_t Question::get_class_code() const {
+  return (this->ques_class[0] << 8) | this->ques_class[1];
 }
\ No newline at end of file
@@ -1,18 +1,25 @@
+#pragma once
+
+#include "wire_name.h"
 #include <array>
 #include <vector>
 
 class Question {
 private:
-  std::vector<unsigned char> domain_name;
+  WireName domain_name;
   std::array<unsigned char, 2> type;
   std::array<unsigned char, 2> ques_class;
 
 public:
-  Question(std::vector<unsigned char> domain_name,
+  Question(WireName domain_name,
          std::array<unsigned char, 2> type,
          std::array<unsigned char, 2> ques_class);
 
-  void add_question_into_return_packet(std::vector<unsigned char>* return_packet);
+  void add_question_into_return_packet(std::vector<unsigned char>* return_packet) const;
 
-  std::vector<unsigned char> get_domain_name();
+  const WireName& get_domain_name() const;
+  std::array<unsigned char, 2> get_type() const;
+  std::array<unsigned char, 2> get_ques_class() const;
+  uint16_t get_type_code() const;
+  uint16_t get_class_code() const;
 };
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "rate_limiter.h"
+#include "dns_constants.h"
+#include "name_kernels.h"
+#include "packet_validator.h"
+#include "record_codec.h"
+#include <arpa/inet.h>
+
+// Set apart the buckets for each kind of response, so a name's answers and
+// the denials for its zone don't draw on the same tokens.
+const uint64_t NEGATIVE_RESPONSE_SALT = 0x9e3779b97f4a7c15ULL;
+const uint64_t ERROR_RESPONSE_SALT = 0xc2b2ae3d27d4eb4fULL;
+
+// Keys are forced odd so they never match a zeroed, unused bucket.
+static uint64_t mix_key(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key | 1;
+}
+
+RateLimiter::RateLimiter(int responses_per_second, int slip, int client_qps) {
+  this->responses_per_second = responses_per_second;
+  this->slip = slip;
+  this->client_qps = client_qps;
+  this->response_buckets = std::make_unique<std::array<TokenBucket, RATE_LIMIT_TABLE_SIZE>>();
+  this->client_buckets = std::make_unique<std::array<TokenBucket, RATE_LIMIT_TABLE_SIZE>>();
+}
+
+int64_t RateLimiter::now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool RateLimiter::take_token(TokenBucket &bucket, uint64_t key, int rate, int64_t now) {
+  // A new owner (or a collision) starts with a full second's worth of burst.
+  if (bucket.key != key) {
+    bucket.key = key;
+    bucket.last_refill_ms = now;
+    bucket.millitokens = static_cast<int64_t>(rate) * 1000;
+    bucket.limited_count = 0;
+  }
+
+  // Refill at `rate` tokens per second, capped at one second of burst.
+  int64_t elapsed = now - bucket.last_refill_ms;
+  if (elapsed > 0) {
+    bucket.millitokens += elapsed * rate;
+    if (bucket.millitokens > static_cast<int64_t>(rate) * 1000) {
+      bucket.millitokens = static_cast<int64_t>(rate) * 1000;
+    }
+    bucket.last_refill_ms = now;
+  }
+
+  if (bucket.millitokens >= 1000) {
+    bucket.millitokens -= 1000;
+    return true;
+  }
+  return false;
+}
+
+// The name-and-kind part of a response's bucket key; see check_response.
+static uint64_t response_key(const unsigned char *response, size_t size) {
+  if (size < HEADER_BYTE_SIZE || record_codec::read_u16(response + 4) == 0) {
+    return ERROR_RESPONSE_SALT;
+  }
+  unsigned char response_code = response[3] & 0x0F;
+  if (response_code != RCODE_NO_ERROR && response_code != RCODE_NAME_ERROR) {
+    return ERROR_RESPONSE_SALT;
+  }
+
+  InlineBuffer<MAX_WIRE_NAME_SIZE> name_bytes;
+  int offset = read_wire_name(response, size, HEADER_BYTE_SIZE, &name_bytes);
+  if (offset == -1) {
+    return ERROR_RESPONSE_SALT;
+  }
+  uint64_t query_name = hash_wire_name(name_bytes.data(), name_bytes.size());
+  size_t answers = record_codec::read_u16(response + 6);
+  size_t authority = record_codec::read_u16(response + 8);
+  // A truncated reply says nothing about the name yet; count it as an answer.
+  bool truncated = (response[2] & TRUNCATION_FLAG) != 0;
+  if (truncated || (response_code == RCODE_NO_ERROR && answers > 0)) {
+    return query_name;
+  }
+
+  // Past any CNAMEs that led to the denial, to the SOA that made it.
+  size_t cursor = offset + 4;
+  for (size_t i = 0; i < answers + authority; i++) {
+    name_bytes.clear();
+    int record = read_wire_name(response, size, cursor, &name_bytes);
+    if (record == -1 || static_cast<size_t>(record) + 10 > size) {
+      break;
+    }
+    if (i >= answers && record_codec::read_u16(response + record) == static_cast<uint16_t>(RecordType::SOA)) {
+      return hash_wire_name(name_bytes.data(), name_bytes.size()) ^ NEGATIVE_RESPONSE_SALT;
+    }
+    cursor = record + 10 + record_codec::read_u16(response + record + 8);
+  }
+  // No SOA to say which zone; the query name is all there is.
+  return query_name ^ NEGATIVE_RESPONSE_SALT;
+}
+
+RateLimitAction RateLimiter::check_query(const sockaddr_in &client) {
+  if (this->client_qps == 0) {
+    return RateLimitAction::Allow;
+  }
+
+  uint64_t key = mix_key(ntohl(client.sin_addr.s_addr));
+  auto &bucket = (*this->client_buckets)[key % RATE_LIMIT_TABLE_SIZE];
+  std::lock_guard lock(this->locks[key % RATE_LIMIT_TABLE_SIZE % RATE_LIMIT_LOCK_STRIPES]);
+  return take_token(bucket, key, this->client_qps, now_ms())
+             ? RateLimitAction::Allow
+             : RateLimitAction::Drop;
+}
+
+RateLimitAction RateLimiter::check_response(const sockaddr_in &client, const unsigned char *response,
+                                            size_t size) {
+  if (this->responses_per_second == 0) {
+    return RateLimitAction::Allow;
+  }
+
+  // Limit per /24 so an attacker can't dodge the limit by spoofing
+  // neighbouring addresses of the same victim.
+  uint64_t prefix = ntohl(client.sin_addr.s_addr) & 0xFFFFFF00;
+  uint64_t key = mix_key(response_key(response, size) ^ (prefix << 32 | prefix));
+  auto &bucket = (*this->response_buckets)[key % RATE_LIMIT_TABLE_SIZE];
+  std::lock_guard lock(this->locks[key % RATE_LIMIT_TABLE_SIZE % RATE_LIMIT_LOCK_STRIPES]);
+
+  if (take_token(bucket, key, this->responses_per_second, now_ms())) {
+    return RateLimitAction::Allow;
+  }
+
+  bucket.limited_count++;
+  if (this->slip > 0 && bucket.limited_count % this->slip == 0) {
+    return RateLimitAction::Slip;
+  }
+  return RateLimitAction::Drop;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "wire_name.h"
+#include <netinet/in.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Number of buckets in each token table. Tables are allocated once, so memory
+// stays fixed however many clients show up. Keys that collide on a slot
+// simply take it over from the previous owner.
+const int RATE_LIMIT_TABLE_SIZE = 1 << 16;
+
+// Buckets are guarded by this many locks, picked by slot, so threads only
+// contend when their keys land on the same stripe.
+const int RATE_LIMIT_LOCK_STRIPES = 64;
+
+enum class RateLimitAction {
+  Allow,
+  Drop,
+  // Send a truncated (TC=1) reply so a real client retries over TCP.
+  Slip,
+};
+
+class RateLimiter {
+private:
+  struct TokenBucket {
+    uint64_t key;
+    int64_t last_refill_ms;
+    // Tokens are scaled by 1000 so partial refills aren't lost.
+    int64_t millitokens;
+    uint32_t limited_count;
+  };
+
+  int responses_per_second;
+  int slip;
+  int client_qps;
+
+  std::unique_ptr<std::array<TokenBucket, RATE_LIMIT_TABLE_SIZE>> response_buckets;
+  std::unique_ptr<std::array<TokenBucket, RATE_LIMIT_TABLE_SIZE>> client_buckets;
+  std::array<std::mutex, RATE_LIMIT_LOCK_STRIPES> locks;
+
+  static int64_t now_ms();
+  static bool take_token(TokenBucket &bucket, uint64_t key, int rate, int64_t now);
+
+public:
+  RateLimiter(int responses_per_second, int slip, int client_qps);
+
+  // Per-source QPS cap. Cheap enough to run before the packet is parsed.
+  RateLimitAction check_query(const sockaddr_in &client);
+
+  // Response rate limit keyed on the client's /24 and what the response says.
+  // Answers are keyed on the query name. NXDOMAIN and NODATA are keyed on the
+  // zone that denied them, the owner of the SOA in the authority section, so
+  // a flood of random names under one zone shares a bucket. Other errors
+  // share one bucket per /24. Call with the finished response.
+  RateLimitAction check_response(const sockaddr_in &client, const unsigned char *response, size_t size);
+};
@@ -0,0 +1,31 @@
+#include "receive_timestamp.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+bool enable_receive_timestamps(int socket) {
+  int enable = 1;
+  if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) != 0) {
+    std::cerr << "SO_TIMESTAMPNS failed: " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int64_t receive_delay_ms(const msghdr &message) {
+  for (auto *control = CMSG_FIRSTHDR(&message); control != nullptr;
+       control = CMSG_NXTHDR(const_cast<msghdr *>(&message), control)) {
+    if (control->cmsg_level != SOL_SOCKET || control->cmsg_type != SCM_TIMESTAMPNS) {
+      continue;
+    }
+    timespec received;
+    std::memcpy(&received, CMSG_DATA(control), sizeof(received));
+    // The kernel stamps with the wall clock. A step in it can put the stamp
+    // in the future; count that as no wait.
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t delay_ms = (now.tv_sec - received.tv_sec) * 1000 + (now.tv_nsec - received.tv_nsec) / 1000000;
+    return delay_ms > 0 ? delay_ms : 0;
+  }
+  return -1;
+}
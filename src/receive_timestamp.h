@@ -0,0 +1,23 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Kernel receive timestamps (SO_TIMESTAMPNS), so a backend can tell how long
+// each datagram waited, in the socket buffer and in its own queues, before it
+// got to it. That's the queueing delay admission control sheds on.
+
+// Room a recvmsg needs for the timestamp control message.
+const size_t RECEIVE_TIMESTAMP_CONTROL_SIZE = CMSG_SPACE(sizeof(timespec));
+
+// Asks the kernel to stamp every datagram `socket` receives. Returns false,
+// after logging why, if it won't. The first socket to ask turns stamping on a
+// moment later; datagrams before that are stamped as they're read, so they
+// look as if they never waited.
+bool enable_receive_timestamps(int socket);
+
+// How many milliseconds ago the datagram arrived, from the control messages
+// recvmsg filled in, or -1 if it carries no timestamp.
+int64_t receive_delay_ms(const msghdr &message);
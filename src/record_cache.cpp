@@ -0,0 +1,296 @@
+#include "record_cache.h"
+#include "dns_constants.h"
+#include "record_codec.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Snapshot layout, all integers big-endian:
+//
+//   "DNSC" | version u32 | entry count u32
+//   per entry: key name (wire format) | key type u16 | negative u8 |
+//              rcode u8 | expires_at u64 | record count u16 | records
+//
+// Records are in the same wire format as a DNS message, uncompressed.
+const char SNAPSHOT_MAGIC[4] = {'D', 'N', 'S', 'C'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const size_t SNAPSHOT_HEADER_SIZE = 12;
+
+RecordCache::RecordCache(size_t max_entries) {
+  this->max_entries = max_entries;
+}
+
+int64_t RecordCache::now_seconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void RecordCache::store(const std::vector<Answer> &records) {
+  if (this->max_entries == 0) {
+    return;
+  }
+
+  // Group the records into RRsets first.
+  std::unordered_map<RecordKey, Entry> rrsets;
+  for (const auto &record : records) {
+    RecordKey key{record.get_domain_name(), record.get_type_code()};
+    auto &entry = rrsets.try_emplace(key, Entry{{}, INT64_MAX, false, RCODE_NO_ERROR}).first->second;
+    entry.records.push_back(record);
+    entry.expires_at = std::min<int64_t>(entry.expires_at, record.get_ttl_seconds());
+  }
+
+  int64_t now = now_seconds();
+  std::unique_lock lock(this->mutex);
+  for (auto &[key, rrset] : rrsets) {
+    if (rrset.expires_at == 0) {
+      continue;
+    }
+    rrset.expires_at += now;
+    // The name exists after all.
+    this->entries.erase(RecordKey{key.name, NXDOMAIN_KEY_TYPE});
+    insert(key, std::move(rrset));
+  }
+}
+
+void RecordCache::store_negative(const WireName &name, uint16_t type, unsigned char response_code,
+                                 const std::vector<Answer> &authority) {
+  if (this->max_entries == 0) {
+    return;
+  }
+
+  for (const auto &record : authority) {
+    RecordCodec<RecordType::SOA>::Value soa;
+    if (!record.as<RecordType::SOA>(&soa)) {
+      continue;
+    }
+    int64_t ttl = std::min(record.get_ttl_seconds(), soa.minimum);
+    if (ttl == 0) {
+      return;
+    }
+
+    uint16_t key_type = response_code == RCODE_NAME_ERROR ? NXDOMAIN_KEY_TYPE : type;
+    std::unique_lock lock(this->mutex);
+    insert(RecordKey{name, key_type}, Entry{{record}, now_seconds() + ttl, true, response_code});
+    return;
+  }
+}
+
+void RecordCache::insert(const RecordKey &key, Entry entry) {
+  int64_t expires_at = entry.expires_at;
+  auto existing = this->entries.find(key);
+  if (existing != this->entries.end()) {
+    existing->second = std::move(entry);
+  } else {
+    make_room();
+    this->entries.emplace(key, std::move(entry));
+  }
+  this->expiry.push(this->entries, key, expires_at);
+}
+
+void RecordCache::make_room() {
+  // An RRset about to expire anyway is the cheapest one to lose, and the
+  // heap hands us the expired ones first.
+  while (this->entries.size() >= this->max_entries && this->expiry.evict_first(this->entries)) {
+  }
+}
+
+bool RecordCache::lookup(const WireName &name, uint16_t type, std::vector<Answer> *records) const {
+  std::shared_lock lock(this->mutex);
+  auto entry = this->entries.find(RecordKey{name, type});
+  if (entry == this->entries.end() || entry->second.negative) {
+    return false;
+  }
+
+  int64_t remaining = entry->second.expires_at - now_seconds();
+  if (remaining <= 0) {
+    return false;
+  }
+
+  for (auto record : entry->second.records) {
+    record.set_ttl_seconds(remaining);
+    records->push_back(record);
+  }
+  return true;
+}
+
+bool RecordCache::lookup_negative(const WireName &name, uint16_t type, NegativeAnswer *answer) const {
+  int64_t now = now_seconds();
+  std::shared_lock lock(this->mutex);
+  for (uint16_t key_type : {NXDOMAIN_KEY_TYPE, type}) {
+    auto entry = this->entries.find(RecordKey{name, key_type});
+    if (entry == this->entries.end() || !entry->second.negative || entry->second.expires_at <= now) {
+      continue;
+    }
+
+    answer->response_code = entry->second.response_code;
+    answer->authority.clear();
+    for (auto record : entry->second.records) {
+      record.set_ttl_seconds(entry->second.expires_at - now);
+      answer->authority.push_back(record);
+    }
+    return true;
+  }
+  return false;
+}
+
+static void write_u16(std::vector<unsigned char> *out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value & 0xFF);
+}
+
+static void write_u32(std::vector<unsigned char> *out, uint32_t value) {
+  write_u16(out, value >> 16);
+  write_u16(out, value & 0xFFFF);
+}
+
+size_t RecordCache::save_snapshot(const std::string &path) const {
+  std::vector<unsigned char> snapshot(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC));
+  write_u32(&snapshot, SNAPSHOT_VERSION);
+  write_u32(&snapshot, 0);
+
+  int64_t now = now_seconds();
+  uint32_t count = 0;
+  std::shared_lock lock(this->mutex);
+  for (const auto &[key, entry] : this->entries) {
+    if (entry.expires_at <= now) {
+      continue;
+    }
+    key.name.add_name_into_return_packet(&snapshot);
+    write_u16(&snapshot, key.type);
+    snapshot.push_back(entry.negative ? 1 : 0);
+    snapshot.push_back(entry.response_code);
+    write_u32(&snapshot, static_cast<uint64_t>(entry.expires_at) >> 32);
+    write_u32(&snapshot, static_cast<uint64_t>(entry.expires_at) & 0xFFFFFFFF);
+    write_u16(&snapshot, entry.records.size());
+    for (const auto &record : entry.records) {
+      record.add_answer_into_return_packet(&snapshot);
+    }
+    count++;
+  }
+  lock.unlock();
+  snapshot[8] = count >> 24;
+  snapshot[9] = (count >> 16) & 0xFF;
+  snapshot[10] = (count >> 8) & 0xFF;
+  snapshot[11] = count & 0xFF;
+
+  std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(snapshot.data()), snapshot.size());
+    if (!file) {
+      throw std::runtime_error("Failed to write cache snapshot " + temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Failed to replace cache snapshot " + path + ": " + strerror(errno));
+  }
+  return count;
+}
+
+// Reads one uncompressed record at offset. Returns the offset past it, or -1.
+static int read_snapshot_record(const unsigned char *data, size_t size, size_t offset,
+                                std::vector<Answer> *records) {
+  InlineBuffer<MAX_WIRE_NAME_SIZE> name_bytes;
+  int cursor = read_wire_name(data, size, offset, &name_bytes);
+  if (cursor == -1 || cursor + 10 > static_cast<int>(size)) {
+    return -1;
+  }
+
+  const unsigned char *fields = data + cursor;
+  size_t data_length = record_codec::read_u16(fields + 8);
+  if (data_length > MAX_RDATA_SIZE || cursor + 10 + data_length > size) {
+    return -1;
+  }
+  records->push_back(Answer(WireName(name_bytes.data(), name_bytes.size()), {fields[0], fields[1]},
+                            {fields[2], fields[3]}, {fields[4], fields[5], fields[6], fields[7]},
+                            {fields[8], fields[9]}, RData(fields + 10, data_length)));
+  return cursor + 10 + data_length;
+}
+
+size_t RecordCache::load_snapshot(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    throw std::runtime_error("Failed to open cache snapshot " + path + ": " + strerror(errno));
+  }
+
+  struct stat file_status;
+  if (fstat(fd, &file_status) != 0 || file_status.st_size < static_cast<off_t>(SNAPSHOT_HEADER_SIZE)) {
+    close(fd);
+    throw std::runtime_error("Cache snapshot " + path + " is truncated");
+  }
+  size_t size = file_status.st_size;
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("Failed to map cache snapshot " + path + ": " + strerror(errno));
+  }
+  auto data = static_cast<const unsigned char *>(mapping);
+
+  auto fail = [&](const std::string &reason) {
+    munmap(mapping, size);
+    throw std::runtime_error("Cache snapshot " + path + " " + reason);
+  };
+
+  if (std::memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+      record_codec::read_u32(data + 4) != SNAPSHOT_VERSION) {
+    fail("has an unknown format");
+  }
+  uint32_t count = record_codec::read_u32(data + 8);
+  std::unique_lock lock(this->mutex);
+  this->entries.reserve(std::min<size_t>(this->entries.size() + count, this->max_entries));
+
+  int64_t now = now_seconds();
+  size_t offset = SNAPSHOT_HEADER_SIZE;
+  size_t loaded = 0;
+  // Loading into a full cache would only evict what we just loaded.
+  for (uint32_t i = 0; i < count && this->entries.size() < this->max_entries; i++) {
+    InlineBuffer<MAX_WIRE_NAME_SIZE> name_bytes;
+    int cursor = read_wire_name(data, size, offset, &name_bytes);
+    if (cursor == -1 || cursor + 14 > static_cast<int>(size)) {
+      fail("is malformed");
+    }
+    const unsigned char *fields = data + cursor;
+    RecordKey key{WireName(name_bytes.data(), name_bytes.size()), record_codec::read_u16(fields)};
+    Entry entry;
+    entry.negative = fields[2] != 0;
+    entry.response_code = fields[3];
+    entry.expires_at = (static_cast<int64_t>(record_codec::read_u32(fields + 4)) << 32) |
+                       record_codec::read_u32(fields + 8);
+    int record_count = record_codec::read_u16(fields + 12);
+
+    offset = cursor + 14;
+    for (int j = 0; j < record_count; j++) {
+      int next = read_snapshot_record(data, size, offset, &entry.records);
+      if (next == -1) {
+        fail("is malformed");
+      }
+      offset = next;
+    }
+
+    if (entry.expires_at > now) {
+      insert(key, std::move(entry));
+      loaded++;
+    }
+  }
+
+  munmap(mapping, size);
+  return loaded;
+}
+
+size_t RecordCache::size() const {
+  std::shared_lock lock(this->mutex);
+  return this->entries.size();
+}
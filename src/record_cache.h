@@ -0,0 +1,100 @@
+#pragma once
+
+#include "answer.h"
+#include "expiry_queue.h"
+#include "wire_name.h"
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Identifies an RRset: owner name (compared case-insensitively) and type.
+struct RecordKey {
+  WireName name;
+  uint16_t type;
+
+  bool operator==(const RecordKey &other) const {
+    return this->type == other.type && this->name == other.name;
+  }
+};
+
+template <>
+struct std::hash<RecordKey> {
+  size_t operator()(const RecordKey &key) const {
+    return key.name.get_hash() ^ (static_cast<uint64_t>(key.type) * 0x9E3779B97F4A7C15ULL);
+  }
+};
+
+// Type used in the key of an NXDOMAIN entry, which covers every type.
+const uint16_t NXDOMAIN_KEY_TYPE = 0;
+
+// A cached NXDOMAIN or NODATA answer (RFC 2308).
+struct NegativeAnswer {
+  unsigned char response_code;
+  // The SOA from the authority section, TTL counted down.
+  std::vector<Answer> authority;
+};
+
+// RRsets learned from upstream, keyed by name and type and kept until their
+// TTL runs out, plus negative answers for names or types that don't exist.
+// Expiry times are wall-clock seconds so entries stay meaningful across
+// restarts. Safe to share between threads: lookups take a shared lock and
+// stores an exclusive one.
+class RecordCache {
+private:
+  struct Entry {
+    // For negative entries, the SOA that came with the answer.
+    std::vector<Answer> records;
+    int64_t expires_at;
+    bool negative;
+    unsigned char response_code;
+  };
+
+  std::unordered_map<RecordKey, Entry> entries;
+  // Picks the victim when the cache is full: expired entries first, then the
+  // one closest to expiring.
+  ExpiryQueue<RecordKey> expiry;
+  size_t max_entries;
+  mutable std::shared_mutex mutex;
+
+  void make_room();
+  void insert(const RecordKey &key, Entry entry);
+
+public:
+  RecordCache(size_t max_entries);
+
+  static int64_t now_seconds();
+
+  // Groups the records into RRsets and stores each one, replacing what we
+  // had. An RRset lives as long as its smallest TTL; zero TTLs aren't stored.
+  void store(const std::vector<Answer> &records);
+
+  // Appends the cached RRset with TTLs counted down to what's left. Returns
+  // false if there's nothing live for the key.
+  bool lookup(const WireName &name, uint16_t type, std::vector<Answer> *records) const;
+
+  // Caches an NXDOMAIN (for every type of the name) or NODATA (for this type)
+  // answer. Per RFC 2308 it lives for the lesser of the SOA's TTL and its
+  // MINIMUM field; answers without an SOA aren't cached.
+  void store_negative(const WireName &name, uint16_t type, unsigned char response_code,
+                      const std::vector<Answer> &authority);
+
+  // Fills `answer` if the name or type is cached as not existing.
+  bool lookup_negative(const WireName &name, uint16_t type, NegativeAnswer *answer) const;
+
+  // Writes every live entry to a binary snapshot at `path`: each entry has
+  // its key, absolute expiry time and records in wire format. It goes through
+  // a temporary file and a rename so readers never see a torn file. Returns
+  // the number of entries written.
+  size_t save_snapshot(const std::string &path) const;
+
+  // Maps a snapshot written by save_snapshot and inserts the entries that
+  // haven't expired yet, stopping once the cache is full. A missing file
+  // loads nothing; a malformed one throws std::runtime_error. Returns the
+  // number of entries loaded.
+  size_t load_snapshot(const std::string &path);
+
+  size_t size() const;
+};
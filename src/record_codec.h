@@ -0,0 +1,375 @@
+#pragma once
+
+#include "packet_validator.h"
+#include "wire_name.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Record types we know how to encode and decode (RFC 1035 3.2.2, RFC 3596).
+enum class RecordType : uint16_t {
+  A = 1,
+  NS = 2,
+  CNAME = 5,
+  SOA = 6,
+  MX = 15,
+  TXT = 16,
+  AAAA = 28,
+};
+
+// Classes (RFC 1035 3.2.4).
+const uint16_t CLASS_IN = 1;
+
+// Per-type RDATA codecs. Each specialisation describes its wire layout with
+// constexpr sizes and offsets and provides:
+//
+//   Value        the typed form of the RDATA
+//   read()       decode RDATA of `length` bytes at `offset` in a datagram,
+//                following compression pointers in embedded names
+//   write()      encode a Value as uncompressed RDATA
+//   to_string()  presentation form, for logging
+//
+// The type is a template parameter, so encoding and decoding compile down to
+// straight-line code for that layout. Only visit_record_type, at the edge
+// where a type code comes off the wire, switches at runtime.
+template <RecordType Type>
+struct RecordCodec;
+
+// Shared helpers for the codecs.
+namespace record_codec {
+
+inline uint16_t read_u16(const unsigned char* bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+inline uint32_t read_u32(const unsigned char* bytes) {
+  return (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+inline void write_u16(RData* data, uint16_t value) {
+  data->push_back(value >> 8);
+  data->push_back(value & 0xFF);
+}
+
+inline void write_u32(RData* data, uint32_t value) {
+  write_u16(data, value >> 16);
+  write_u16(data, value & 0xFFFF);
+}
+
+// Reads a name inside RDATA ending at `end`. Returns the offset past the name
+// in place, or -1 if it's malformed or runs past the record.
+inline int read_name(const unsigned char* packet, size_t size, size_t offset, size_t end,
+                     WireName* name) {
+  InlineBuffer<MAX_WIRE_NAME_SIZE> name_bytes;
+  int name_end = read_wire_name(packet, size, offset, &name_bytes);
+  if (name_end == -1 || static_cast<size_t>(name_end) > end) {
+    return -1;
+  }
+  *name = WireName(name_bytes.data(), name_bytes.size());
+  return name_end;
+}
+
+inline std::string name_to_string(const WireName& name) {
+  std::string text;
+  size_t i = 0;
+  while (i < name.size() && name[i] != 0x00 && i + 1 + name[i] <= name.size()) {
+    if (!text.empty()) {
+      text += ".";
+    }
+    text.append(reinterpret_cast<const char*>(name.data()) + i + 1, name[i]);
+    i += 1 + name[i];
+  }
+  return text.empty() ? "." : text;
+}
+
+// Parses presentation form ("www.example.com", trailing dot optional) into a
+// wire name. Throws std::runtime_error on empty or oversized labels.
+inline WireName name_from_string(const std::string& text) {
+  InlineBuffer<MAX_WIRE_NAME_SIZE> name_bytes;
+  size_t start = 0;
+  while (start < text.size() && text != ".") {
+    size_t end = text.find('.', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    size_t label_size = end - start;
+    if (label_size == 0 || label_size > 63 || name_bytes.size() + 1 + label_size >= MAX_WIRE_NAME_SIZE) {
+      throw std::runtime_error("Invalid domain name " + text);
+    }
+    name_bytes.push_back(label_size);
+    name_bytes.append(reinterpret_cast<const unsigned char*>(text.data()) + start, label_size);
+    start = end + 1;
+  }
+  name_bytes.push_back(0x00);
+  return WireName(name_bytes.data(), name_bytes.size());
+}
+
+}  // namespace record_codec
+
+template <>
+struct RecordCodec<RecordType::A> {
+  using Value = std::array<unsigned char, 4>;
+  static constexpr const char* NAME = "A (IPv4 address)";
+  static constexpr size_t ADDRESS_SIZE = 4;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    if (length != ADDRESS_SIZE || offset + length > size) {
+      return false;
+    }
+    std::memcpy(value->data(), packet + offset, ADDRESS_SIZE);
+    return true;
+  }
+
+  static void write(const Value& value, RData* data) {
+    data->append(value.data(), ADDRESS_SIZE);
+  }
+
+  static std::string to_string(const Value& value) {
+    char text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, value.data(), text, sizeof(text));
+    return text;
+  }
+};
+
+template <>
+struct RecordCodec<RecordType::AAAA> {
+  using Value = std::array<unsigned char, 16>;
+  static constexpr const char* NAME = "AAAA (IPv6 address)";
+  static constexpr size_t ADDRESS_SIZE = 16;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    if (length != ADDRESS_SIZE || offset + length > size) {
+      return false;
+    }
+    std::memcpy(value->data(), packet + offset, ADDRESS_SIZE);
+    return true;
+  }
+
+  static void write(const Value& value, RData* data) {
+    data->append(value.data(), ADDRESS_SIZE);
+  }
+
+  static std::string to_string(const Value& value) {
+    char text[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, value.data(), text, sizeof(text));
+    return text;
+  }
+};
+
+// NS and CNAME carry a single name and nothing else.
+template <RecordType Type>
+struct SingleNameCodec {
+  using Value = WireName;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    return record_codec::read_name(packet, size, offset, offset + length, value) ==
+           static_cast<int>(offset + length);
+  }
+
+  static void write(const Value& value, RData* data) {
+    data->append(value.data(), value.size());
+  }
+
+  static std::string to_string(const Value& value) {
+    return record_codec::name_to_string(value);
+  }
+};
+
+template <>
+struct RecordCodec<RecordType::NS> : SingleNameCodec<RecordType::NS> {
+  static constexpr const char* NAME = "NS (Name Server)";
+};
+
+template <>
+struct RecordCodec<RecordType::CNAME> : SingleNameCodec<RecordType::CNAME> {
+  static constexpr const char* NAME = "CNAME (Canonical Name)";
+};
+
+struct MxData {
+  uint16_t preference;
+  WireName exchange;
+};
+
+template <>
+struct RecordCodec<RecordType::MX> {
+  using Value = MxData;
+  static constexpr const char* NAME = "MX (Mail Exchange)";
+  // PREFERENCE (16 bits), then EXCHANGE.
+  static constexpr size_t PREFERENCE_OFFSET = 0;
+  static constexpr size_t EXCHANGE_OFFSET = 2;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    if (length < EXCHANGE_OFFSET + 1) {
+      return false;
+    }
+    value->preference = record_codec::read_u16(packet + offset + PREFERENCE_OFFSET);
+    return record_codec::read_name(packet, size, offset + EXCHANGE_OFFSET, offset + length,
+                                   &value->exchange) == static_cast<int>(offset + length);
+  }
+
+  static void write(const Value& value, RData* data) {
+    record_codec::write_u16(data, value.preference);
+    data->append(value.exchange.data(), value.exchange.size());
+  }
+
+  static std::string to_string(const Value& value) {
+    return std::to_string(value.preference) + " " + record_codec::name_to_string(value.exchange);
+  }
+};
+
+// TXT is one or more <character-string>s. The value is the RDATA as sent,
+// length prefixes and all, so the boundaries between strings (which SPF, DKIM
+// and others depend on) survive a round trip through the cache.
+template <>
+struct RecordCodec<RecordType::TXT> {
+  using Value = RData;
+  static constexpr const char* NAME = "TXT (Text)";
+  static constexpr size_t MAX_STRING_SIZE = 255;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    size_t end = offset + length;
+    if (length == 0 || end > size) {
+      return false;
+    }
+    for (size_t cursor = offset; cursor < end; cursor += 1 + packet[cursor]) {
+      if (cursor + 1 + packet[cursor] > end) {
+        return false;
+      }
+    }
+    value->clear();
+    value->append(packet + offset, length);
+    return true;
+  }
+
+  static void write(const Value& value, RData* data) {
+    data->append(value.data(), value.size());
+  }
+
+  // Encodes text from a zone file, split into 255-byte strings.
+  static Value from_string(const std::string& text) {
+    Value value;
+    size_t offset = 0;
+    do {
+      size_t string_size = std::min(MAX_STRING_SIZE, text.size() - offset);
+      value.push_back(string_size);
+      value.append(reinterpret_cast<const unsigned char*>(text.data()) + offset, string_size);
+      offset += string_size;
+    } while (offset < text.size());
+    return value;
+  }
+
+  static std::string to_string(const Value& value) {
+    std::string text;
+    for (size_t cursor = 0; cursor < value.size(); cursor += 1 + value[cursor]) {
+      if (!text.empty()) {
+        text += " ";
+      }
+      text += "\"" + std::string(value.begin() + cursor + 1, value.begin() + cursor + 1 + value[cursor]) + "\"";
+    }
+    return text;
+  }
+};
+
+struct SoaData {
+  WireName primary_name_server;
+  WireName responsible_mailbox;
+  uint32_t serial;
+  uint32_t refresh;
+  uint32_t retry;
+  uint32_t expire;
+  uint32_t minimum;
+};
+
+template <>
+struct RecordCodec<RecordType::SOA> {
+  using Value = SoaData;
+  static constexpr const char* NAME = "SOA (Start of Authority)";
+  // MNAME and RNAME, then five 32-bit fields at these offsets past RNAME.
+  static constexpr size_t SERIAL_OFFSET = 0;
+  static constexpr size_t REFRESH_OFFSET = 4;
+  static constexpr size_t RETRY_OFFSET = 8;
+  static constexpr size_t EXPIRE_OFFSET = 12;
+  static constexpr size_t MINIMUM_OFFSET = 16;
+  static constexpr size_t TIMERS_SIZE = 20;
+
+  static bool read(const unsigned char* packet, size_t size, size_t offset, size_t length,
+                   Value* value) {
+    size_t end = offset + length;
+    int cursor = record_codec::read_name(packet, size, offset, end, &value->primary_name_server);
+    if (cursor == -1) {
+      return false;
+    }
+    cursor = record_codec::read_name(packet, size, cursor, end, &value->responsible_mailbox);
+    if (cursor == -1 || cursor + TIMERS_SIZE != end) {
+      return false;
+    }
+    // Both names uncompressed must still fit our RDATA limit.
+    if (value->primary_name_server.size() + value->responsible_mailbox.size() + TIMERS_SIZE >
+        MAX_RDATA_SIZE) {
+      return false;
+    }
+    const unsigned char* timers = packet + cursor;
+    value->serial = record_codec::read_u32(timers + SERIAL_OFFSET);
+    value->refresh = record_codec::read_u32(timers + REFRESH_OFFSET);
+    value->retry = record_codec::read_u32(timers + RETRY_OFFSET);
+    value->expire = record_codec::read_u32(timers + EXPIRE_OFFSET);
+    value->minimum = record_codec::read_u32(timers + MINIMUM_OFFSET);
+    return true;
+  }
+
+  static void write(const Value& value, RData* data) {
+    data->append(value.primary_name_server.data(), value.primary_name_server.size());
+    data->append(value.responsible_mailbox.data(), value.responsible_mailbox.size());
+    record_codec::write_u32(data, value.serial);
+    record_codec::write_u32(data, value.refresh);
+    record_codec::write_u32(data, value.retry);
+    record_codec::write_u32(data, value.expire);
+    record_codec::write_u32(data, value.minimum);
+  }
+
+  static std::string to_string(const Value& value) {
+    return record_codec::name_to_string(value.primary_name_server) + " " +
+           record_codec::name_to_string(value.responsible_mailbox) + " " +
+           std::to_string(value.serial) + " " + std::to_string(value.refresh) + " " +
+           std::to_string(value.retry) + " " + std::to_string(value.expire) + " " +
+           std::to_string(value.minimum);
+  }
+};
+
+template <RecordType Type>
+RData encode_rdata(const typename RecordCodec<Type>::Value& value) {
+  RData data;
+  RecordCodec<Type>::write(value, &data);
+  return data;
+}
+
+template <RecordType Type>
+bool decode_rdata(const RData& data, typename RecordCodec<Type>::Value* value) {
+  return RecordCodec<Type>::read(data.data(), data.size(), 0, data.size(), value);
+}
+
+// Calls visitor.template operator()<Type>() for a known type code and returns
+// true, or returns false for types we have no codec for.
+template <typename Visitor>
+bool visit_record_type(uint16_t type_code, Visitor&& visitor) {
+  switch (static_cast<RecordType>(type_code)) {
+    case RecordType::A: visitor.template operator()<RecordType::A>(); return true;
+    case RecordType::NS: visitor.template operator()<RecordType::NS>(); return true;
+    case RecordType::CNAME: visitor.template operator()<RecordType::CNAME>(); return true;
+    case RecordType::SOA: visitor.template operator()<RecordType::SOA>(); return true;
+    case RecordType::MX: visitor.template operator()<RecordType::MX>(); return true;
+    case RecordType::TXT: visitor.template operator()<RecordType::TXT>(); return true;
+    case RecordType::AAAA: visitor.template operator()<RecordType::AAAA>(); return true;
+  }
+  return false;
+}
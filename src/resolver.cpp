@@ -0,0 +1,575 @@
+#include "resolver.h"
+#include "dns_packet.h"
+#include "packet_validator.h"
+#include "record_codec.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+static std::array<unsigned char, 2> to_wire_code(uint16_t code) {
+  return {static_cast<unsigned char>(code >> 8), static_cast<unsigned char>(code & 0xFF)};
+}
+
+// Appends the addresses of the A records owned by `name`, in network byte
+// order, and returns the smallest TTL among them.
+static uint32_t collect_ipv4_addresses(const std::vector<Answer> &records, const WireName &name,
+                                       std::vector<uint32_t> *addresses) {
+  uint32_t ttl = UINT32_MAX;
+  for (const auto &record : records) {
+    RecordCodec<RecordType::A>::Value address;
+    if (record.get_domain_name() == name && record.as<RecordType::A>(&address)) {
+      uint32_t network_address;
+      std::memcpy(&network_address, address.data(), sizeof(network_address));
+      addresses->push_back(network_address);
+      ttl = std::min(ttl, record.get_ttl_seconds());
+    }
+  }
+  return ttl;
+}
+
+// ============================================================================
+// Resolution
+// ============================================================================
+
+Resolution::Resolution(const Question &question) : question(question) {
+  this->current_name = question.get_domain_name();
+  this->visited_names.push_back(this->current_name);
+  this->asked_upstream = false;
+  this->done = false;
+  this->truncated = false;
+  this->response_code = RCODE_NO_ERROR;
+  this->has_upstream_negative = false;
+  this->upstream_response_code = RCODE_NO_ERROR;
+  this->upstream_server = {};
+  this->iterative = false;
+  this->query_sent_ms = 0;
+  this->upstream_query_count = 0;
+}
+
+bool Resolution::is_done() const {
+  return this->done;
+}
+
+void Resolution::finish() {
+  this->done = true;
+}
+
+const Question &Resolution::get_question() const {
+  return this->question;
+}
+
+Question Resolution::get_upstream_question() const {
+  if (!this->nameserver_lookups.empty()) {
+    return Question(this->nameserver_lookups.back(), to_wire_code(static_cast<uint16_t>(RecordType::A)),
+                    to_wire_code(CLASS_IN));
+  }
+  return Question(this->current_name, this->question.get_type(), this->question.get_ques_class());
+}
+
+const sockaddr_in &Resolution::get_upstream_server() const {
+  return this->upstream_server;
+}
+
+bool Resolution::is_iterative() const {
+  return this->iterative;
+}
+
+const std::vector<Answer> &Resolution::get_answers() const {
+  return this->answers;
+}
+
+unsigned char Resolution::get_response_code() const {
+  return this->response_code;
+}
+
+const std::vector<Answer> &Resolution::get_authority() const {
+  return this->authority;
+}
+
+bool Resolution::is_truncated() const {
+  return this->truncated;
+}
+
+// ============================================================================
+// Resolver
+// ============================================================================
+
+Resolver::Resolver(const ServerOptions &options)
+    : cache(options.cache_size), infra(options.infra_cache_size) {
+  if (!options.zone_file.empty()) {
+    this->zone = LocalZone::load(options.zone_file);
+  }
+  this->forwarding = options.is_forwarding();
+  this->iterative = options.is_iterative();
+  this->forwarding_address = {};
+  if (this->forwarding) {
+    this->forwarding_address = options.get_resolver_address();
+  }
+  this->nameserver_port = options.nameserver_port;
+  if (this->iterative) {
+    load_root_hints(options.root_hints);
+  }
+
+  // Start warm from the last snapshot.
+  this->snapshot_path = options.cache_snapshot;
+  if (!this->snapshot_path.empty()) {
+    try {
+      auto loaded = this->cache.load_snapshot(this->snapshot_path);
+      std::cout << "Loaded " << loaded << " cache entries from " << this->snapshot_path << std::endl;
+    } catch (const std::runtime_error &error) {
+      // A bad snapshot only costs us a cold start.
+      std::cerr << error.what() << ". Starting with an empty cache." << std::endl;
+    }
+  }
+}
+
+void Resolver::load_root_hints(const std::string &path) {
+  auto hints = LocalZone::load(path);
+
+  std::vector<Answer> root_records;
+  hints.lookup(WireName(), static_cast<uint16_t>(RecordType::NS), &root_records);
+  std::vector<WireName> nameservers;
+  std::unordered_map<WireName, std::vector<uint32_t>> addresses;
+  for (const auto &record : root_records) {
+    WireName nameserver;
+    if (!record.as<RecordType::NS>(&nameserver)) {
+      continue;
+    }
+    nameservers.push_back(nameserver);
+
+    std::vector<Answer> address_records;
+    hints.lookup(nameserver, static_cast<uint16_t>(RecordType::A), &address_records);
+    collect_ipv4_addresses(address_records, nameserver, &addresses[nameserver]);
+  }
+
+  bool has_address = false;
+  for (const auto &[nameserver, nameserver_addresses] : addresses) {
+    has_address = has_address || !nameserver_addresses.empty();
+  }
+  if (!has_address) {
+    throw std::runtime_error("Root hints " + path + " have no root nameserver with an A record");
+  }
+
+  this->infra.set_root_hints(nameservers, addresses);
+  std::cout << "Loaded " << nameservers.size() << " root nameservers from " << path << std::endl;
+}
+
+int Resolver::get_upstream_timeout_ms() const {
+  return this->iterative ? NAMESERVER_TIMEOUT_MS : FORWARD_TIMEOUT_MS;
+}
+
+void Resolver::save_snapshot() {
+  if (this->snapshot_path.empty()) {
+    return;
+  }
+  try {
+    auto saved = this->cache.save_snapshot(this->snapshot_path);
+    std::cout << "Saved " << saved << " cache entries to " << this->snapshot_path << std::endl;
+  } catch (const std::runtime_error &error) {
+    std::cerr << error.what() << std::endl;
+  }
+}
+
+bool Resolver::find_records(const Resolution &resolution, const WireName &name, uint16_t type,
+                            std::vector<Answer> *records) const {
+  if (this->zone.lookup(name, type, records)) {
+    return true;
+  }
+
+  bool found = false;
+  for (const auto &record : resolution.upstream_records) {
+    if (record.get_type_code() == type && record.get_domain_name() == name) {
+      records->push_back(record);
+      found = true;
+    }
+  }
+  if (found) {
+    return true;
+  }
+
+  return this->cache.lookup(name, type, records);
+}
+
+bool Resolver::find_negative(const Resolution &resolution, const WireName &name, uint16_t type,
+                             NegativeAnswer *answer) const {
+  if (resolution.has_upstream_negative && resolution.upstream_negative_name == name) {
+    *answer = resolution.upstream_negative;
+    return true;
+  }
+  return this->cache.lookup_negative(name, type, answer);
+}
+
+bool Resolver::advance(Resolution &resolution) {
+  uint16_t type = resolution.question.get_type_code();
+  resolution.iterative = this->iterative;
+
+  while (!resolution.done) {
+    std::vector<Answer> records;
+    if (find_records(resolution, resolution.current_name, type, &records)) {
+      resolution.answers.insert(resolution.answers.end(), records.begin(), records.end());
+      resolution.done = true;
+      break;
+    }
+
+    // Follow a CNAME to its target, unless the CNAME is what was asked for.
+    WireName target;
+    if (type != static_cast<uint16_t>(RecordType::CNAME) &&
+        find_records(resolution, resolution.current_name, static_cast<uint16_t>(RecordType::CNAME), &records) &&
+        records[0].as<RecordType::CNAME>(&target)) {
+      resolution.answers.push_back(records[0]);
+
+      bool is_loop = false;
+      for (const auto &visited_name : resolution.visited_names) {
+        is_loop = is_loop || visited_name == target;
+      }
+      if (is_loop || static_cast<int>(resolution.visited_names.size()) > MAX_CNAME_CHAIN_LENGTH) {
+        resolution.done = true;
+        break;
+      }
+
+      resolution.visited_names.push_back(target);
+      resolution.current_name = target;
+      resolution.asked_upstream = false;
+      continue;
+    }
+
+    NegativeAnswer negative;
+    if (find_negative(resolution, resolution.current_name, type, &negative)) {
+      resolution.response_code = negative.response_code;
+      resolution.authority = negative.authority;
+      resolution.done = true;
+      break;
+    }
+
+    if (!this->forwarding && !this->iterative) {
+      // Names we don't hold get the server's default local answers.
+      auto local_answers = DNSPacket::create_local_answers(resolution.get_upstream_question());
+      resolution.answers.insert(resolution.answers.end(), local_answers.begin(), local_answers.end());
+      resolution.done = true;
+      break;
+    }
+
+    // Upstream already had its say about this name.
+    if (resolution.asked_upstream) {
+      resolution.response_code = resolution.upstream_response_code;
+      resolution.done = true;
+      break;
+    }
+
+    if (this->iterative && !choose_server(resolution)) {
+      resolution.response_code = RCODE_SERVER_FAILURE;
+      resolution.done = true;
+      break;
+    }
+    if (this->forwarding) {
+      resolution.upstream_server = this->forwarding_address;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+void Resolver::add_upstream_reply(Resolution &resolution, const char *reply, int size) {
+  bool nameserver_lookup = !resolution.nameserver_lookups.empty();
+  if (!nameserver_lookup) {
+    resolution.asked_upstream = true;
+  }
+
+  // Never parse an upstream reply we haven't validated.
+  if (validate_packet(reinterpret_cast<const unsigned char *>(reply), size) != PacketVerdict::Valid) {
+    std::cerr << "Dropping malformed reply from upstream" << std::endl;
+    if (this->iterative) {
+      mark_server_failed(resolution);
+    }
+    return;
+  }
+
+  // What's left of a truncated reply may be missing records of an RRset, or
+  // all of them; caching it would serve a partial answer or a false NODATA.
+  if ((reply[2] & TRUNCATION_FLAG) != 0) {
+    std::cerr << "Not caching a truncated reply from upstream" << std::endl;
+    if (this->iterative) {
+      mark_server_failed(resolution);
+    } else {
+      resolution.truncated = true;
+      resolution.done = true;
+    }
+    return;
+  }
+
+  auto reply_packet = DNSPacket(reply, size);
+  auto upstream_question = resolution.get_upstream_question();
+  const auto &questions = reply_packet.get_question_section();
+  if (questions.size() != 1 || !(questions[0].get_domain_name() == upstream_question.get_domain_name()) ||
+      questions[0].get_type_code() != upstream_question.get_type_code()) {
+    std::cerr << "Dropping reply from upstream for another question" << std::endl;
+    if (this->iterative) {
+      mark_server_failed(resolution);
+    }
+    return;
+  }
+
+  std::vector<Answer> records = reply_packet.get_answer_section();
+  if (this->iterative) {
+    this->infra.record_rtt(resolution.upstream_server.sin_addr.s_addr,
+                           InfraCache::now_ms() - resolution.query_sent_ms);
+    if (follow_referral(resolution, reply_packet)) {
+      return;
+    }
+    auto response_code = reply_packet.get_response_code();
+    if (response_code != RCODE_NO_ERROR && response_code != RCODE_NAME_ERROR) {
+      // SERVFAIL, REFUSED and the like: another server of the zone may do better.
+      mark_server_failed(resolution);
+      return;
+    }
+    if (nameserver_lookup) {
+      add_nameserver_addresses(resolution, reply_packet);
+      return;
+    }
+    // A server only speaks for the zone we asked it about.
+    std::erase_if(records, [&](const Answer &record) {
+      return !record.get_domain_name().is_subdomain_of(resolution.zone_cut);
+    });
+  }
+
+  this->cache.store(records);
+  resolution.upstream_records.insert(resolution.upstream_records.end(), records.begin(), records.end());
+  resolution.upstream_response_code = reply_packet.get_response_code();
+
+  // A negative answer is about the name at the end of the reply's CNAME
+  // chain (RFC 2308 section 2.1).
+  uint16_t type = resolution.question.get_type_code();
+  WireName final_name = resolution.current_name;
+  bool has_answer = false;
+  for (int hops = 0; hops <= MAX_CNAME_CHAIN_LENGTH && !has_answer; hops++) {
+    WireName target;
+    bool followed = false;
+    for (const auto &record : records) {
+      if (!(record.get_domain_name() == final_name)) {
+        continue;
+      }
+      has_answer = has_answer || record.get_type_code() == type;
+      if (!followed && type != static_cast<uint16_t>(RecordType::CNAME) && record.as<RecordType::CNAME>(&target)) {
+        followed = true;
+      }
+    }
+    if (has_answer || !followed) {
+      break;
+    }
+    final_name = target;
+  }
+
+  auto response_code = reply_packet.get_response_code();
+  if (response_code != RCODE_NAME_ERROR && (response_code != RCODE_NO_ERROR || has_answer)) {
+    return;
+  }
+  // An authoritative server can only deny names in its own zone. A chain
+  // that leaves it is picked up from the target's zone instead.
+  if (this->iterative && !final_name.is_subdomain_of(resolution.zone_cut)) {
+    return;
+  }
+
+  // Pass the SOA on with the negative TTL, min(TTL, MINIMUM).
+  std::vector<Answer> soa_records;
+  for (auto record : reply_packet.get_authority_section()) {
+    RecordCodec<RecordType::SOA>::Value soa;
+    if (record.as<RecordType::SOA>(&soa)) {
+      record.set_ttl_seconds(std::min(record.get_ttl_seconds(), soa.minimum));
+      soa_records.push_back(record);
+    }
+  }
+  resolution.has_upstream_negative = true;
+  resolution.upstream_negative_name = final_name;
+  resolution.upstream_negative = NegativeAnswer{response_code, soa_records};
+  this->cache.store_negative(final_name, type, response_code, soa_records);
+}
+
+void Resolver::add_upstream_timeout(Resolution &resolution) {
+  if (!this->iterative) {
+    resolution.finish();
+    return;
+  }
+  mark_server_failed(resolution);
+}
+
+// ============================================================================
+// Resolver Iterative Mode
+// ============================================================================
+
+bool Resolver::find_nameserver_addresses(const WireName &nameserver, std::vector<uint32_t> *addresses) const {
+  if (this->infra.lookup_addresses(nameserver, addresses)) {
+    return true;
+  }
+
+  std::vector<Answer> records;
+  uint16_t type = static_cast<uint16_t>(RecordType::A);
+  if (this->zone.lookup(nameserver, type, &records) || this->cache.lookup(nameserver, type, &records)) {
+    collect_ipv4_addresses(records, nameserver, addresses);
+  }
+  return !addresses->empty();
+}
+
+// Picks the server for the next query: the fastest one we haven't given up on
+// among the nameservers of the closest zone cut we know for the upstream
+// question. When none of them has an address, resolving one of them comes
+// first. Returns false when there's nobody left to ask.
+bool Resolver::choose_server(Resolution &resolution) {
+  while (resolution.upstream_query_count < MAX_ITERATIVE_QUERIES) {
+    auto target = resolution.get_upstream_question().get_domain_name();
+    auto delegation = this->infra.find_delegation(target);
+
+    std::vector<uint32_t> candidates;
+    WireName glueless_nameserver;
+    bool has_glueless_nameserver = false;
+    for (const auto &nameserver : delegation.nameservers) {
+      if (std::find(resolution.unresolvable_nameservers.begin(), resolution.unresolvable_nameservers.end(),
+                    nameserver) != resolution.unresolvable_nameservers.end()) {
+        continue;
+      }
+
+      std::vector<uint32_t> addresses;
+      if (!find_nameserver_addresses(nameserver, &addresses)) {
+        bool in_progress = std::find(resolution.nameserver_lookups.begin(), resolution.nameserver_lookups.end(),
+                                     nameserver) != resolution.nameserver_lookups.end();
+        if (!has_glueless_nameserver && !in_progress) {
+          glueless_nameserver = nameserver;
+          has_glueless_nameserver = true;
+        }
+        continue;
+      }
+      for (auto address : addresses) {
+        if (std::find(resolution.failed_servers.begin(), resolution.failed_servers.end(), address) ==
+            resolution.failed_servers.end()) {
+          candidates.push_back(address);
+        }
+      }
+    }
+
+    if (!candidates.empty()) {
+      resolution.zone_cut = delegation.zone;
+      resolution.upstream_server = {};
+      resolution.upstream_server.sin_family = AF_INET;
+      resolution.upstream_server.sin_port = htons(this->nameserver_port);
+      resolution.upstream_server.sin_addr.s_addr = this->infra.select_server(candidates);
+      resolution.query_sent_ms = InfraCache::now_ms();
+      resolution.upstream_query_count++;
+      return true;
+    }
+
+    if (has_glueless_nameserver &&
+        static_cast<int>(resolution.nameserver_lookups.size()) < MAX_NAMESERVER_LOOKUP_DEPTH) {
+      resolution.nameserver_lookups.push_back(glueless_nameserver);
+      continue;
+    }
+
+    // Nobody to ask for this target. If it was a nameserver we were looking
+    // up, give up on that one and let the level above try another.
+    if (resolution.nameserver_lookups.empty()) {
+      return false;
+    }
+    resolution.unresolvable_nameservers.push_back(resolution.nameserver_lookups.back());
+    resolution.nameserver_lookups.pop_back();
+  }
+  return false;
+}
+
+void Resolver::mark_server_failed(Resolution &resolution) {
+  auto address = resolution.upstream_server.sin_addr.s_addr;
+  this->infra.record_failure(address, NAMESERVER_TIMEOUT_MS);
+  resolution.failed_servers.push_back(address);
+  if (resolution.nameserver_lookups.empty()) {
+    resolution.asked_upstream = false;
+  }
+}
+
+// A referral has no answers and NS records (but no SOA) in its authority
+// section. It moves the resolution forward if the delegated zone sits below
+// the zone we asked about and above the name we're after; anything else is a
+// lame server. Returns true if the reply was a referral of either kind.
+bool Resolver::follow_referral(Resolution &resolution, const DNSPacket &reply) {
+  if (reply.get_response_code() != RCODE_NO_ERROR || !reply.get_answer_section().empty()) {
+    return false;
+  }
+
+  auto target = resolution.get_upstream_question().get_domain_name();
+  const auto &authority = reply.get_authority_section();
+  bool has_soa = false;
+  bool has_nameservers = false;
+  bool found_zone = false;
+  WireName zone;
+  for (const auto &record : authority) {
+    has_soa = has_soa || record.get_type_code() == static_cast<uint16_t>(RecordType::SOA);
+    if (record.get_type_code() != static_cast<uint16_t>(RecordType::NS)) {
+      continue;
+    }
+    has_nameservers = true;
+    const auto &owner = record.get_domain_name();
+    if (!found_zone && target.is_subdomain_of(owner) && owner.is_subdomain_of(resolution.zone_cut) &&
+        !(owner == resolution.zone_cut)) {
+      zone = owner;
+      found_zone = true;
+    }
+  }
+  if (has_soa || !has_nameservers) {
+    return false;
+  }
+  if (!found_zone) {
+    std::cerr << "Dropping lame referral from upstream" << std::endl;
+    mark_server_failed(resolution);
+    return true;
+  }
+
+  std::vector<WireName> nameservers;
+  uint32_t ttl = UINT32_MAX;
+  for (const auto &record : authority) {
+    WireName nameserver;
+    if (record.get_domain_name() == zone && record.as<RecordType::NS>(&nameserver)) {
+      nameservers.push_back(nameserver);
+      ttl = std::min(ttl, record.get_ttl_seconds());
+    }
+  }
+
+  // Glue is only trusted for nameservers inside the zone the server was
+  // asked about; anything else could be someone else's name. TTLs are at
+  // least a second so this resolution can use what it just learned.
+  for (const auto &nameserver : nameservers) {
+    if (!nameserver.is_subdomain_of(resolution.zone_cut)) {
+      continue;
+    }
+    std::vector<uint32_t> addresses;
+    uint32_t glue_ttl = collect_ipv4_addresses(reply.get_additional_section(), nameserver, &addresses);
+    this->infra.store_addresses(nameserver, addresses, std::max<uint32_t>(glue_ttl, 1));
+  }
+  this->infra.store_delegation(zone, nameservers, std::max<uint32_t>(ttl, 1));
+
+  if (resolution.nameserver_lookups.empty()) {
+    resolution.asked_upstream = false;
+  }
+  return true;
+}
+
+// Ends the innermost nameserver lookup with the addresses the reply gave, or
+// marks the nameserver unresolvable if it gave none.
+void Resolver::add_nameserver_addresses(Resolution &resolution, const DNSPacket &reply) {
+  auto nameserver = resolution.nameserver_lookups.back();
+  resolution.nameserver_lookups.pop_back();
+
+  std::vector<Answer> records;
+  for (const auto &record : reply.get_answer_section()) {
+    if (record.get_domain_name().is_subdomain_of(resolution.zone_cut)) {
+      records.push_back(record);
+    }
+  }
+
+  std::vector<uint32_t> addresses;
+  uint32_t ttl = collect_ipv4_addresses(records, nameserver, &addresses);
+  if (addresses.empty()) {
+    resolution.unresolvable_nameservers.push_back(nameserver);
+    return;
+  }
+  this->cache.store(records);
+  this->infra.store_addresses(nameserver, addresses, std::max<uint32_t>(ttl, 1));
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "answer.h"
+#include "dns_packet.h"
+#include "infra_cache.h"
+#include "local_zone.h"
+#include "question.h"
+#include "record_cache.h"
+#include "server_options.h"
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+// Longest CNAME chain we follow for one question before giving up and
+// returning what we have.
+const int MAX_CNAME_CHAIN_LENGTH = 8;
+
+// How long a forwarded query waits for the forwarder's reply.
+const int FORWARD_TIMEOUT_MS = 2000;
+// How long an iterative query waits before trying another nameserver.
+const int NAMESERVER_TIMEOUT_MS = 800;
+// Upstream queries one iterative resolution may send, across referrals,
+// CNAME hops, retries and nameserver lookups, before it gives up SERVFAIL.
+const int MAX_ITERATIVE_QUERIES = 24;
+// How deep nameserver lookups may nest: resolving the address of a glueless
+// nameserver, whose zone's nameserver is glueless too, and so on.
+const int MAX_NAMESERVER_LOOKUP_DEPTH = 3;
+
+// Where one question stands. A resolution follows CNAMEs through the local
+// zone, the cache and whatever upstream has told it so far, and only needs
+// upstream for the link it can't find. It's plain data so a backend can park
+// it while the upstream query is in flight.
+class Resolution {
+private:
+  friend class Resolver;
+
+  Question question;
+  // The name we're looking up now: the qname, or the last CNAME target.
+  WireName current_name;
+  std::vector<Answer> answers;
+  // Records from upstream replies for this resolution, cached or not.
+  std::vector<Answer> upstream_records;
+  // Names we've already been through, to catch CNAME loops.
+  std::vector<WireName> visited_names;
+  bool asked_upstream;
+  bool done;
+  // Upstream's reply came back truncated and couldn't be had over TCP.
+  bool truncated;
+
+  // How the resolution ended: NOERROR, or a negative or failed answer with
+  // the SOA that explains it.
+  unsigned char response_code;
+  std::vector<Answer> authority;
+
+  // What the last upstream reply said, when it said the name or type doesn't
+  // exist, and its rcode for failures we pass through.
+  bool has_upstream_negative;
+  WireName upstream_negative_name;
+  NegativeAnswer upstream_negative;
+  unsigned char upstream_response_code;
+
+  // Where the upstream query goes: the forwarder, or in iterative mode the
+  // nameserver picked for the closest known zone cut.
+  sockaddr_in upstream_server;
+  bool iterative;
+  WireName zone_cut;
+  int64_t query_sent_ms;
+  int upstream_query_count;
+  // Nameserver names we're resolving in order to ask them, innermost last.
+  // While there are any, the upstream question is the last one's address.
+  std::vector<WireName> nameserver_lookups;
+  // Servers that timed out or answered uselessly, and nameserver names we
+  // couldn't resolve. Both are skipped for the rest of the resolution.
+  std::vector<uint32_t> failed_servers;
+  std::vector<WireName> unresolvable_nameservers;
+
+public:
+  Resolution(const Question &question);
+
+  bool is_done() const;
+  // Stops where we are, e.g. when upstream never answers.
+  void finish();
+
+  const Question &get_question() const;
+  // What to ask upstream while the resolution isn't done, and where to send
+  // it. Iterative queries go out with RD clear.
+  Question get_upstream_question() const;
+  const sockaddr_in &get_upstream_server() const;
+  bool is_iterative() const;
+  // The chain so far: CNAMEs in order, then the records for the final name.
+  const std::vector<Answer> &get_answers() const;
+  unsigned char get_response_code() const;
+  const std::vector<Answer> &get_authority() const;
+  // Set when the resolution ended on a truncated reply. Nothing from it was
+  // kept; the client should be told to retry over TCP.
+  bool is_truncated() const;
+};
+
+// Resolves questions from local data first: the zone file, then the cache,
+// then upstream. Upstream is either one forwarder, or in iterative mode the
+// authoritative servers themselves, starting at the root hints and following
+// referrals down. Backends drive the upstream I/O and feed replies back in, so
+// the synchronous and io_uring paths share this logic.
+class Resolver {
+private:
+  LocalZone zone;
+  RecordCache cache;
+  InfraCache infra;
+  bool forwarding;
+  bool iterative;
+  sockaddr_in forwarding_address;
+  uint16_t nameserver_port;
+  std::string snapshot_path;
+
+  void load_root_hints(const std::string &path);
+
+  bool find_records(const Resolution &resolution, const WireName &name, uint16_t type,
+                    std::vector<Answer> *records) const;
+  bool find_negative(const Resolution &resolution, const WireName &name, uint16_t type,
+                     NegativeAnswer *answer) const;
+
+  // Iterative mode helpers.
+  bool choose_server(Resolution &resolution);
+  bool find_nameserver_addresses(const WireName &nameserver, std::vector<uint32_t> *addresses) const;
+  void mark_server_failed(Resolution &resolution);
+  bool follow_referral(Resolution &resolution, const DNSPacket &reply);
+  void add_nameserver_addresses(Resolution &resolution, const DNSPacket &reply);
+
+public:
+  Resolver(const ServerOptions &options);
+
+  // Advances as far as local data allows. Returns true once the resolution
+  // is done, false if it's waiting on upstream for get_upstream_question().
+  bool advance(Resolution &resolution);
+
+  // Feeds in the upstream reply to get_upstream_question() and caches its
+  // records, or its NXDOMAIN/NODATA answer. In iterative mode a referral
+  // instead moves the resolution down to the delegated zone. Replies that are
+  // malformed or answer another question are ignored, which ends a forwarded
+  // resolution on the next advance and makes an iterative one try another
+  // server. A truncated reply is never cached: it ends a forwarded resolution
+  // as truncated and makes an iterative one try another server.
+  void add_upstream_reply(Resolution &resolution, const char *reply, int size);
+
+  // The upstream query to get_upstream_server() went unanswered. A forwarded
+  // resolution stops there; an iterative one backs the server off and tries
+  // another on the next advance.
+  void add_upstream_timeout(Resolution &resolution);
+
+  // How long to wait for each upstream reply.
+  int get_upstream_timeout_ms() const;
+
+  // Writes the cache snapshot, if one is configured. Errors are logged, not
+  // thrown, so a bad disk never takes the server down.
+  void save_snapshot();
+};
@@ -0,0 +1,181 @@
+#include "server_options.h"
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <string>
+
+std::string RESOLVER_FLAG = "--resolver";
+std::string ROOT_HINTS_FLAG = "--root-hints";
+std::string NAMESERVER_PORT_FLAG = "--nameserver-port";
+std::string INFRA_CACHE_SIZE_FLAG = "--infra-cache-size";
+std::string RRL_RESPONSES_PER_SECOND_FLAG = "--rrl-responses-per-second";
+std::string RRL_SLIP_FLAG = "--rrl-slip";
+std::string MAX_CLIENT_QPS_FLAG = "--max-client-qps";
+std::string MAX_INFLIGHT_FLAG = "--max-inflight";
+std::string MAX_INFLIGHT_PER_CLIENT_FLAG = "--max-inflight-per-client";
+std::string INFLIGHT_MEMORY_MB_FLAG = "--inflight-memory-mb";
+std::string IO_BACKEND_FLAG = "--io-backend";
+std::string IO_THREADS_FLAG = "--io-threads";
+std::string RESOLVER_THREADS_FLAG = "--resolver-threads";
+std::string XDP_INTERFACE_FLAG = "--xdp-interface";
+std::string XDP_QUEUE_FLAG = "--xdp-queue";
+std::string XDP_MODE_FLAG = "--xdp-mode";
+std::string ZONE_FILE_FLAG = "--zone-file";
+std::string CACHE_SIZE_FLAG = "--cache-size";
+std::string CACHE_SNAPSHOT_FLAG = "--cache-snapshot";
+std::string CACHE_SNAPSHOT_INTERVAL_FLAG = "--cache-snapshot-interval";
+std::string BLOCKLIST_FLAG = "--blocklist";
+std::string BLOCKLIST_SINKHOLE_FLAG = "--blocklist-sinkhole";
+std::string COMPILE_BLOCKLIST_FLAG = "--compile-blocklist";
+std::string ADDRESS_DELIMETER = ":";
+std::string VALUE_DELIMETER = "=";
+
+bool ServerOptions::is_forwarding() const {
+  return !this->resolver_ip.empty() && !this->resolver_port.empty();
+}
+
+bool ServerOptions::is_iterative() const {
+  return !this->root_hints.empty();
+}
+
+sockaddr_in ServerOptions::get_resolver_address() const {
+  auto port_address = std::stoi(this->resolver_port);
+  auto unasigned_int_port_address = static_cast<uint16_t>(port_address);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(unasigned_int_port_address);
+
+  if (inet_pton(AF_INET, this->resolver_ip.c_str(), &addr.sin_addr) != 1) {
+    throw std::runtime_error("Invalid IPv4 address");
+  }
+
+  return addr;
+}
+
+static int parse_non_negative_int(const std::string &flag, const std::string &value) {
+  try {
+    size_t parsed_length = 0;
+    int parsed = std::stoi(value, &parsed_length);
+    if (parsed_length == value.size() && parsed >= 0) {
+      return parsed;
+    }
+  } catch (const std::exception &) {
+  }
+  throw std::runtime_error("Expected a non-negative integer for " + flag + ".");
+}
+
+static void parse_resolver_address(ServerOptions &options, const std::string &forward_address) {
+  auto delimeter_location = forward_address.find(ADDRESS_DELIMETER);
+
+  if (delimeter_location == std::string::npos) {
+    // The delimeter location was not found.
+    throw std::runtime_error(
+        "There was an error parsing the forwarding address.");
+  }
+
+  options.resolver_ip = forward_address.substr(0, delimeter_location);
+  options.resolver_port =
+      forward_address.substr(delimeter_location + 1, forward_address.size());
+}
+
+ServerOptions parse_server_options(int argc, char *argv[]) {
+  ServerOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string flag = argv[i];
+    std::string value;
+
+    auto value_location = flag.find(VALUE_DELIMETER);
+    if (value_location != std::string::npos) {
+      value = flag.substr(value_location + 1);
+      flag = flag.substr(0, value_location);
+    } else {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Expected a value after " + flag + ".");
+      }
+      i++;
+      value = argv[i];
+    }
+
+    if (flag == RESOLVER_FLAG) {
+      parse_resolver_address(options, value);
+    } else if (flag == ROOT_HINTS_FLAG) {
+      options.root_hints = value;
+    } else if (flag == NAMESERVER_PORT_FLAG) {
+      options.nameserver_port = parse_non_negative_int(flag, value);
+      if (options.nameserver_port == 0 || options.nameserver_port > 0xFFFF) {
+        throw std::runtime_error("Expected a port number for " + flag + ".");
+      }
+    } else if (flag == INFRA_CACHE_SIZE_FLAG) {
+      options.infra_cache_size = parse_non_negative_int(flag, value);
+      if (options.infra_cache_size == 0) {
+        throw std::runtime_error("Expected a positive integer for " + flag + ".");
+      }
+    } else if (flag == RRL_RESPONSES_PER_SECOND_FLAG) {
+      options.rrl_responses_per_second = parse_non_negative_int(flag, value);
+    } else if (flag == RRL_SLIP_FLAG) {
+      options.rrl_slip = parse_non_negative_int(flag, value);
+    } else if (flag == MAX_CLIENT_QPS_FLAG) {
+      options.max_client_qps = parse_non_negative_int(flag, value);
+    } else if (flag == MAX_INFLIGHT_FLAG) {
+      options.max_inflight = parse_non_negative_int(flag, value);
+    } else if (flag == MAX_INFLIGHT_PER_CLIENT_FLAG) {
+      options.max_inflight_per_client = parse_non_negative_int(flag, value);
+    } else if (flag == INFLIGHT_MEMORY_MB_FLAG) {
+      options.inflight_memory_mb = parse_non_negative_int(flag, value);
+    } else if (flag == IO_BACKEND_FLAG) {
+      if (value != "socket" && value != "uring" && value != "pipeline") {
+        throw std::runtime_error("Expected socket, uring or pipeline for " + flag + ".");
+      }
+      options.io_backend = value;
+    } else if (flag == IO_THREADS_FLAG) {
+      options.io_threads = parse_non_negative_int(flag, value);
+      if (options.io_threads == 0) {
+        throw std::runtime_error("Expected a positive integer for " + flag + ".");
+      }
+    } else if (flag == RESOLVER_THREADS_FLAG) {
+      options.resolver_threads = parse_non_negative_int(flag, value);
+      if (options.resolver_threads == 0) {
+        throw std::runtime_error("Expected a positive integer for " + flag + ".");
+      }
+    } else if (flag == XDP_INTERFACE_FLAG) {
+      options.xdp_interface = value;
+    } else if (flag == XDP_QUEUE_FLAG) {
+      options.xdp_queue = parse_non_negative_int(flag, value);
+    } else if (flag == XDP_MODE_FLAG) {
+      if (value != "skb" && value != "native") {
+        throw std::runtime_error("Expected skb or native for " + flag + ".");
+      }
+      options.xdp_mode = value;
+    } else if (flag == ZONE_FILE_FLAG) {
+      options.zone_file = value;
+    } else if (flag == CACHE_SIZE_FLAG) {
+      options.cache_size = parse_non_negative_int(flag, value);
+    } else if (flag == CACHE_SNAPSHOT_FLAG) {
+      options.cache_snapshot = value;
+    } else if (flag == CACHE_SNAPSHOT_INTERVAL_FLAG) {
+      options.cache_snapshot_interval = parse_non_negative_int(flag, value);
+    } else if (flag == BLOCKLIST_FLAG) {
+      options.blocklist = value;
+    } else if (flag == BLOCKLIST_SINKHOLE_FLAG) {
+      in_addr sinkhole;
+      if (inet_pton(AF_INET, value.c_str(), &sinkhole) != 1) {
+        throw std::runtime_error("Expected an IPv4 address for " + flag + ".");
+      }
+      options.blocklist_sinkhole = value;
+    } else if (flag == COMPILE_BLOCKLIST_FLAG) {
+      options.compile_blocklist = value;
+    } else {
+      throw std::runtime_error("Unknown flag " + flag + ".");
+    }
+  }
+
+  if (options.is_forwarding() && options.is_iterative()) {
+    throw std::runtime_error("Use either " + RESOLVER_FLAG + " or " + ROOT_HINTS_FLAG + ", not both.");
+  }
+
+  if (!options.compile_blocklist.empty() && options.blocklist.empty()) {
+    throw std::runtime_error(COMPILE_BLOCKLIST_FLAG + " needs a list passed with " + BLOCKLIST_FLAG + ".");
+  }
+
+  return options;
+}
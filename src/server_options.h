@@ -0,0 +1,86 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <string>
+
+// Everything configurable from the command line.
+struct ServerOptions {
+  // Forwarding resolver. Empty when we answer locally.
+  std::string resolver_ip = "";
+  std::string resolver_port = "";
+
+  // Iterative resolution from the root down. Root hints are a zone file (see
+  // LocalZone) with NS records for "." and A records for those nameservers.
+  // Empty unless we resolve iteratively.
+  std::string root_hints = "";
+  // Port every authoritative server is queried on. Only stand-in servers in
+  // tests listen anywhere but 53.
+  int nameserver_port = 53;
+  // Delegations, nameserver addresses and server RTTs kept for iterative
+  // resolution, each.
+  int infra_cache_size = 10000;
+
+  // Response rate limiting, keyed on client /24 and the name the response is
+  // about: the query name for answers, the zone for NXDOMAIN and NODATA. Zero
+  // responses per second disables it.
+  int rrl_responses_per_second = 0;
+  // Every Nth rate-limited response is sent truncated instead of dropped so
+  // real clients can retry over TCP. Zero never slips.
+  int rrl_slip = 2;
+  // Queries per second accepted from a single client address. Zero disables.
+  int max_client_qps = 0;
+
+  // Queries waiting on upstream at once, in total and from one client
+  // address, and the memory they may hold between them. Past a limit new
+  // misses get SERVFAIL, or REFUSED for the client over its share. Zero
+  // disables each.
+  int max_inflight = 4096;
+  int max_inflight_per_client = 64;
+  int inflight_memory_mb = 64;
+
+  // "socket" for blocking recvfrom/sendto, "uring" for io_uring, "pipeline"
+  // for separate I/O and resolution thread pools.
+  std::string io_backend = "socket";
+  // Pipeline backend only: I/O threads, each with its own SO_REUSEPORT
+  // socket.
+  int io_threads = 1;
+  // Threads the pipeline hands queries to, and the XDP backend its upstream
+  // work.
+  int resolver_threads = 4;
+
+  // AF_XDP fast path. When an interface is set, UDP/2053 on that interface
+  // and queue is redirected to an AF_XDP socket and answered from UMEM.
+  std::string xdp_interface = "";
+  int xdp_queue = 0;
+  // "skb" (generic, works on any driver including veth) or "native".
+  std::string xdp_mode = "skb";
+
+  // Records served locally (see LocalZone for the format). Empty for none.
+  std::string zone_file = "";
+  // Number of RRsets kept in the answer cache. Zero disables caching.
+  int cache_size = 10000;
+  // Binary cache snapshot, loaded at startup and written on shutdown. Empty
+  // for none.
+  std::string cache_snapshot = "";
+  // Also write the snapshot every this many seconds. Zero only writes it on
+  // shutdown.
+  int cache_snapshot_interval = 0;
+
+  // Names we refuse to resolve: a text list or a compiled image (see
+  // Blocklist). Empty for none.
+  std::string blocklist = "";
+  // IPv4 address blocked A queries are answered with. Empty answers every
+  // blocked query with NXDOMAIN instead.
+  std::string blocklist_sinkhole = "";
+  // Compile the blocklist into an image at this path and exit instead of
+  // serving.
+  std::string compile_blocklist = "";
+
+  bool is_forwarding() const;
+  bool is_iterative() const;
+  sockaddr_in get_resolver_address() const;
+};
+
+// Accepts both "--flag value" and "--flag=value". Throws std::runtime_error
+// on anything it doesn't recognise.
+ServerOptions parse_server_options(int argc, char *argv[]);
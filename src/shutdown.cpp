@@ -0,0 +1,19 @@
+#include "shutdown.h"
+#include <csignal>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+  stop_requested = 1;
+}
+
+void install_shutdown_handlers() {
+  struct sigaction action = {};
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+}
+
+bool shutdown_requested() {
+  return stop_requested != 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// SIGINT and SIGTERM ask the serving loops to stop so main() can clean up
+// (detach XDP, write the cache snapshot) before exiting. The handlers don't
+// use SA_RESTART, so a blocking call returns EINTR and the loop gets to check
+// shutdown_requested().
+void install_shutdown_handlers();
+bool shutdown_requested();
@@ -0,0 +1,285 @@
+#include "tcp_upstream_pool.h"
+#include <cerrno>
+#include <chrono>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Bytes read from a connection per recv call.
+const size_t TCP_READ_CHUNK_SIZE = 16 * 1024;
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static bool same_server(const sockaddr_in &first, const sockaddr_in &second) {
+  return first.sin_addr.s_addr == second.sin_addr.s_addr && first.sin_port == second.sin_port;
+}
+
+// Drops the query from the connection's in-flight list, if it's there.
+void TcpUpstreamPool::forget_query(Connection &connection, uint16_t id) {
+  for (auto it = connection.in_flight.begin(); it != connection.in_flight.end(); it++) {
+    if (it->id == id) {
+      connection.in_flight.erase(it);
+      return;
+    }
+  }
+}
+
+TcpUpstreamPool::TcpUpstreamPool() {}
+
+TcpUpstreamPool::~TcpUpstreamPool() {
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    close_connection(i);
+  }
+}
+
+// ============================================================================
+// TcpUpstreamPool Connections
+// ============================================================================
+
+int TcpUpstreamPool::open_connection(const sockaddr_in &server) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("Failed to create upstream TCP socket");
+    return -1;
+  }
+  // Queries are small and latency bound; don't let Nagle hold them back.
+  int no_delay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+  bool connecting = false;
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&server), sizeof(server)) != 0) {
+    if (errno != EINPROGRESS) {
+      perror("Failed to connect to upstream over TCP");
+      close(fd);
+      return -1;
+    }
+    connecting = true;
+  }
+
+  int index = -1;
+  for (size_t i = 0; i < this->connections.size() && index == -1; i++) {
+    if (this->connections[i].fd == -1) {
+      index = i;
+    }
+  }
+  if (index == -1) {
+    index = this->connections.size();
+    this->connections.push_back(Connection{-1, 0, {}, false, {}, {}, {}, 0});
+  }
+
+  Connection &connection = this->connections[index];
+  connection.fd = fd;
+  connection.generation++;
+  connection.server = server;
+  connection.connecting = connecting;
+  connection.write_buffer.clear();
+  connection.read_buffer.clear();
+  connection.in_flight.clear();
+  connection.last_used_ms = now_ms();
+  return index;
+}
+
+void TcpUpstreamPool::close_connection(int index) {
+  Connection &connection = this->connections[index];
+  if (connection.fd == -1) {
+    return;
+  }
+  // Shut down before closing so anything still polling the socket (an
+  // io_uring poll holds its own reference) wakes up instead of hanging on.
+  shutdown(connection.fd, SHUT_RDWR);
+  close(connection.fd);
+  connection.fd = -1;
+  connection.generation++;
+  connection.write_buffer.clear();
+  connection.read_buffer.clear();
+  connection.in_flight.clear();
+}
+
+void TcpUpstreamPool::close_idle(int64_t now) {
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    const Connection &connection = this->connections[i];
+    if (connection.fd == -1) {
+      continue;
+    }
+    bool idle = connection.in_flight.empty() && now - connection.last_used_ms >= TCP_IDLE_TIMEOUT_MS;
+    bool stuck =
+        !connection.in_flight.empty() && now - connection.in_flight.front().sent_ms >= TCP_REPLY_TIMEOUT_MS;
+    if (idle || stuck) {
+      close_connection(i);
+    }
+  }
+}
+
+void TcpUpstreamPool::retry_writes() {
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    const Connection &connection = this->connections[i];
+    if (connection.fd != -1 && !connection.connecting && !connection.write_buffer.empty() && !flush(i)) {
+      close_connection(i);
+    }
+  }
+}
+
+// ============================================================================
+// TcpUpstreamPool Queries
+// ============================================================================
+
+int TcpUpstreamPool::send_query(const sockaddr_in &server, const std::vector<unsigned char> &query) {
+  if (query.size() < 2 || query.size() > 0xFFFF) {
+    return -1;
+  }
+
+  // Least busy connection to this server. Open another while every existing
+  // one already has queries in flight and the server's pool has room.
+  int best = -1;
+  int server_connections = 0;
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    const Connection &connection = this->connections[i];
+    if (connection.fd == -1 || !same_server(connection.server, server)) {
+      continue;
+    }
+    server_connections++;
+    size_t load = connection.in_flight.size();
+    if (load < MAX_TCP_QUERIES_PER_CONNECTION &&
+        (best == -1 || load < this->connections[best].in_flight.size())) {
+      best = i;
+    }
+  }
+  if (server_connections < MAX_TCP_CONNECTIONS_PER_SERVER &&
+      (best == -1 || !this->connections[best].in_flight.empty())) {
+    int opened = open_connection(server);
+    best = opened == -1 ? best : opened;
+  }
+  if (best == -1) {
+    return -1;
+  }
+
+  Connection &connection = this->connections[best];
+  connection.write_buffer.push_back(query.size() >> 8);
+  connection.write_buffer.push_back(query.size() & 0xFF);
+  connection.write_buffer.insert(connection.write_buffer.end(), query.begin(), query.end());
+  connection.in_flight.push_back(PendingQuery{static_cast<uint16_t>((query[0] << 8) | query[1]), now_ms()});
+
+  if (!connection.connecting && !flush(best)) {
+    close_connection(best);
+    return -1;
+  }
+  return best;
+}
+
+void TcpUpstreamPool::cancel_query(int index, uint16_t id) {
+  forget_query(this->connections[index], id);
+}
+
+bool TcpUpstreamPool::flush(int index) {
+  Connection &connection = this->connections[index];
+  size_t written = 0;
+  while (written < connection.write_buffer.size()) {
+    ssize_t sent = send(connection.fd, connection.write_buffer.data() + written,
+                        connection.write_buffer.size() - written, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    written += sent;
+  }
+  connection.write_buffer.erase(connection.write_buffer.begin(), connection.write_buffer.begin() + written);
+  return true;
+}
+
+bool TcpUpstreamPool::read_replies(int index, std::vector<std::vector<unsigned char>> *replies) {
+  Connection &connection = this->connections[index];
+  unsigned char chunk[TCP_READ_CHUNK_SIZE];
+  bool open = true;
+  while (true) {
+    ssize_t received = recv(connection.fd, chunk, sizeof(chunk), 0);
+    if (received > 0) {
+      connection.read_buffer.insert(connection.read_buffer.end(), chunk, chunk + received);
+      continue;
+    }
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    // Zero is the server closing its end; anything but EAGAIN is an error.
+    open = received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    break;
+  }
+
+  // Cut out every complete frame.
+  size_t offset = 0;
+  while (connection.read_buffer.size() - offset >= 2) {
+    size_t length = (connection.read_buffer[offset] << 8) | connection.read_buffer[offset + 1];
+    if (connection.read_buffer.size() - offset - 2 < length) {
+      break;
+    }
+    auto frame = connection.read_buffer.begin() + offset + 2;
+    replies->emplace_back(frame, frame + length);
+    offset += 2 + length;
+    if (length >= 2) {
+      forget_query(connection, (frame[0] << 8) | frame[1]);
+    }
+    connection.last_used_ms = now_ms();
+  }
+  connection.read_buffer.erase(connection.read_buffer.begin(), connection.read_buffer.begin() + offset);
+  return open;
+}
+
+bool TcpUpstreamPool::handle_events(int index, short events,
+                                    std::vector<std::vector<unsigned char>> *replies) {
+  Connection &connection = this->connections[index];
+  if (connection.fd == -1) {
+    return false;
+  }
+
+  if (connection.connecting && (events & (POLLOUT | POLLERR | POLLHUP)) != 0) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+    if (error != 0) {
+      close_connection(index);
+      return false;
+    }
+    connection.connecting = false;
+  }
+
+  if ((events & (POLLIN | POLLERR | POLLHUP)) != 0 && !read_replies(index, replies)) {
+    close_connection(index);
+    return false;
+  }
+
+  if (!connection.connecting && !flush(index)) {
+    close_connection(index);
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// TcpUpstreamPool Getters
+// ============================================================================
+
+int TcpUpstreamPool::get_fd(int index) const {
+  return this->connections[index].fd;
+}
+
+uint32_t TcpUpstreamPool::get_generation(int index) const {
+  return this->connections[index].generation;
+}
+
+const sockaddr_in &TcpUpstreamPool::get_server(int index) const {
+  return this->connections[index].server;
+}
+
+bool TcpUpstreamPool::wants_write(int index) const {
+  const Connection &connection = this->connections[index];
+  return connection.connecting || !connection.write_buffer.empty();
+}
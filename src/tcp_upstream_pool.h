@@ -0,0 +1,89 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <vector>
+
+// Connections kept open to one upstream server.
+const int MAX_TCP_CONNECTIONS_PER_SERVER = 2;
+// Queries pipelined on one connection before the pool stops adding more.
+const int MAX_TCP_QUERIES_PER_CONNECTION = 64;
+// Connections with nothing in flight and no traffic for this long are closed.
+const int64_t TCP_IDLE_TIMEOUT_MS = 10000;
+// A connection whose oldest query has gone unanswered this long is closed:
+// the server has most likely dropped it, and it would hold a slot forever.
+const int64_t TCP_REPLY_TIMEOUT_MS = 5000;
+
+// Persistent TCP connections to upstream servers, for retrying queries whose
+// UDP reply came back truncated. Each server gets a small pool of
+// connections and each connection carries many queries at once: every message
+// is framed with a two-byte length (RFC 1035 4.2.2) and replies come back in
+// whatever order the server likes, so callers match them to queries by ID.
+//
+// Sockets are non-blocking and the pool never waits. Callers poll get_fd()
+// for POLLIN (and POLLOUT when wants_write()) however they like and hand the
+// events to handle_events(). Connections are identified by index; an index is
+// reused after its connection closes, with a new generation.
+class TcpUpstreamPool {
+private:
+  struct PendingQuery {
+    uint16_t id;
+    int64_t sent_ms;
+  };
+
+  struct Connection {
+    // -1 when the slot is free.
+    int fd;
+    uint32_t generation;
+    sockaddr_in server;
+    bool connecting;
+    // Framed queries the socket hasn't taken yet.
+    std::vector<unsigned char> write_buffer;
+    // Bytes of replies whose frame hasn't fully arrived.
+    std::vector<unsigned char> read_buffer;
+    // Queries sent and neither answered nor cancelled, oldest first.
+    std::vector<PendingQuery> in_flight;
+    // Last time the connection opened or a reply arrived.
+    int64_t last_used_ms;
+  };
+
+  std::vector<Connection> connections;
+
+  static void forget_query(Connection &connection, uint16_t id);
+  int open_connection(const sockaddr_in &server);
+  void close_connection(int index);
+  bool flush(int index);
+  bool read_replies(int index, std::vector<std::vector<unsigned char>> *replies);
+
+public:
+  TcpUpstreamPool();
+  ~TcpUpstreamPool();
+
+  TcpUpstreamPool(const TcpUpstreamPool &) = delete;
+  TcpUpstreamPool &operator=(const TcpUpstreamPool &) = delete;
+
+  // Frames the query and queues it on the least busy connection to the
+  // server, opening one if the pool has room. Writes as much as the socket
+  // takes right away. Returns the connection's index, or -1 on failure.
+  int send_query(const sockaddr_in &server, const std::vector<unsigned char> &query);
+  // Stops counting a query the caller has given up on. A late reply is still
+  // returned by handle_events, for the caller to ignore.
+  void cancel_query(int index, uint16_t id);
+
+  // Handles poll events for a connection: finishes connecting, writes queued
+  // queries and appends every complete reply. Returns false once the
+  // connection has closed; replies appended before that are still good.
+  bool handle_events(int index, short events, std::vector<std::vector<unsigned char>> *replies);
+
+  // Closes connections that have been idle for TCP_IDLE_TIMEOUT_MS, and ones
+  // with a reply overdue by TCP_REPLY_TIMEOUT_MS.
+  void close_idle(int64_t now_ms);
+  // Writes queued queries on every connected socket, for callers that only
+  // poll for POLLIN once a connection is up.
+  void retry_writes();
+
+  int get_fd(int index) const;
+  uint32_t get_generation(int index) const;
+  const sockaddr_in &get_server(int index) const;
+  bool wants_write(int index) const;
+};
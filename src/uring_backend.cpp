@@ -0,0 +1,802 @@
+#include "uring_backend.h"
+#include "receive_timestamp.h"
+#include "shutdown.h"
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Submission queue depth.
+const unsigned RING_ENTRIES = 256;
+// Completion queue depth. Large, because one burst of client packets fans out
+// into receives, sends and upstream replies before we get to reap, and a
+// multishot receive is cancelled if its completion overflows.
+const unsigned COMPLETION_ENTRIES = 8192;
+// Receive buffer for the upstream socket, so a burst of replies isn't dropped.
+const int UPSTREAM_RECEIVE_BUFFER_BYTES = 4 * 1024 * 1024;
+// Provided receive buffers, shared by the client and upstream receives. Must
+// be a power of two.
+const unsigned PROVIDED_BUFFER_COUNT = 256;
+const unsigned short PROVIDED_BUFFER_GROUP = 1;
+// Each buffer holds the recvmsg header, the source address, the receive
+// timestamp and the payload, sized for the largest upstream reply.
+const size_t PROVIDED_BUFFER_SIZE =
+    sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + RECEIVE_TIMESTAMP_CONTROL_SIZE +
+    MAX_UPSTREAM_UDP_SIZE;
+
+// How often pending upstream queries are checked for timeouts.
+const long TICK_NANOSECONDS = 100 * 1000 * 1000;
+// Client queries still waiting on upstream after this long are answered with
+// what has arrived. Each upstream query has its own, shorter timeout (see
+// Resolver::get_upstream_timeout_ms).
+const int64_t TRANSACTION_TIMEOUT_MS = 5000;
+
+// user_data layout: completion kind in the high 32 bits, index in the low.
+const uint64_t TAG_CLIENT_RECEIVE = 1ULL << 32;
+const uint64_t TAG_UPSTREAM_RECEIVE = 2ULL << 32;
+const uint64_t TAG_SEND = 3ULL << 32;
+const uint64_t TAG_TICK = 4ULL << 32;
+// Low 32 bits: connection generation (16 bits) and index (16 bits).
+const uint64_t TAG_TCP_POLL = 5ULL << 32;
+const uint64_t TAG_KIND_MASK = 0xFFFFFFFFULL << 32;
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::string errno_message(const std::string &what) {
+  return what + ": " + strerror(errno);
+}
+
+// ============================================================================
+// UringBackend Construction
+// ============================================================================
+
+UringBackend::UringBackend(int listen_socket, QueryHandler &handler)
+    : handler(handler), id_generator(std::random_device{}()) {
+  this->listen_socket = listen_socket;
+  this->upstream_socket = -1;
+  this->ring_fd = -1;
+  this->rings = MAP_FAILED;
+  this->sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+  this->buffer_ring = static_cast<io_uring_buf_ring *>(MAP_FAILED);
+  this->buffer_memory = static_cast<unsigned char *>(MAP_FAILED);
+  this->unsubmitted = 0;
+
+  try {
+    setup_ring();
+    setup_buffer_ring();
+
+    if (handler.get_options().is_forwarding() || handler.get_options().is_iterative()) {
+      // One shared socket carries every upstream query; replies are matched
+      // back to their client by transaction ID.
+      this->upstream_socket = socket(AF_INET, SOCK_DGRAM, 0);
+      if (this->upstream_socket == -1) {
+        throw std::runtime_error(errno_message("Failed to create forward socket"));
+      }
+      sockaddr_in any_address = {};
+      any_address.sin_family = AF_INET;
+      any_address.sin_addr.s_addr = htonl(INADDR_ANY);
+      if (bind(this->upstream_socket, reinterpret_cast<sockaddr *>(&any_address),
+               sizeof(any_address)) != 0) {
+        throw std::runtime_error(errno_message("Failed to bind forward socket"));
+      }
+      int receive_buffer_bytes = UPSTREAM_RECEIVE_BUFFER_BYTES;
+      setsockopt(this->upstream_socket, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes,
+                 sizeof(receive_buffer_bytes));
+    }
+  } catch (...) {
+    release_resources();
+    throw;
+  }
+
+  // The multishot receives lay each buffer out as recvmsg_out, the source
+  // address, the control messages, then the payload. Client queries carry
+  // their receive timestamp there.
+  this->receive_header = {};
+  this->receive_header.msg_namelen = sizeof(sockaddr_in);
+  this->receive_header.msg_controllen = RECEIVE_TIMESTAMP_CONTROL_SIZE;
+  enable_receive_timestamps(this->listen_socket);
+
+  this->tick = {};
+  this->tick.tv_nsec = TICK_NANOSECONDS;
+}
+
+UringBackend::~UringBackend() {
+  release_resources();
+}
+
+void UringBackend::release_resources() {
+  if (this->buffer_memory != MAP_FAILED) {
+    munmap(this->buffer_memory, this->buffer_memory_size);
+    this->buffer_memory = static_cast<unsigned char *>(MAP_FAILED);
+  }
+  if (this->buffer_ring != MAP_FAILED) {
+    munmap(this->buffer_ring, this->buffer_ring_size);
+    this->buffer_ring = static_cast<io_uring_buf_ring *>(MAP_FAILED);
+  }
+  if (this->sqes != MAP_FAILED) {
+    munmap(this->sqes, this->sqes_size);
+    this->sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+  }
+  if (this->rings != MAP_FAILED) {
+    munmap(this->rings, this->rings_size);
+    this->rings = MAP_FAILED;
+  }
+  if (this->ring_fd != -1) {
+    close(this->ring_fd);
+    this->ring_fd = -1;
+  }
+  if (this->upstream_socket != -1) {
+    close(this->upstream_socket);
+    this->upstream_socket = -1;
+  }
+}
+
+void UringBackend::setup_ring() {
+  io_uring_params params = {};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = COMPLETION_ENTRIES;
+  this->ring_fd = io_uring_setup(RING_ENTRIES, &params);
+  if (this->ring_fd < 0) {
+    throw std::runtime_error(errno_message("io_uring_setup failed"));
+  }
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+    throw std::runtime_error("io_uring needs IORING_FEAT_SINGLE_MMAP (Linux 5.4+)");
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  this->rings_size = sq_size > cq_size ? sq_size : cq_size;
+  this->rings = mmap(nullptr, this->rings_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+  if (this->rings == MAP_FAILED) {
+    throw std::runtime_error(errno_message("Failed to map io_uring rings"));
+  }
+
+  this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    throw std::runtime_error(errno_message("Failed to map io_uring SQEs"));
+  }
+  this->sqes = static_cast<io_uring_sqe *>(sqes);
+
+  auto *base = static_cast<unsigned char *>(this->rings);
+  this->sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+  this->sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+  this->sq_mask = reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+  this->sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+  this->sq_entries = params.sq_entries;
+  this->cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+  this->cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+  this->cq_mask = reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+  this->cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+}
+
+void UringBackend::setup_buffer_ring() {
+  // The buffer ring must be page aligned, which mmap gives us.
+  this->buffer_ring_size = PROVIDED_BUFFER_COUNT * sizeof(io_uring_buf);
+  void *ring = mmap(nullptr, this->buffer_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    throw std::runtime_error(errno_message("Failed to map buffer ring"));
+  }
+  this->buffer_ring = static_cast<io_uring_buf_ring *>(ring);
+
+  io_uring_buf_reg registration = {};
+  registration.ring_addr = reinterpret_cast<uint64_t>(this->buffer_ring);
+  registration.ring_entries = PROVIDED_BUFFER_COUNT;
+  registration.bgid = PROVIDED_BUFFER_GROUP;
+  if (io_uring_register(this->ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+    throw std::runtime_error(errno_message("Failed to register buffer ring (Linux 5.19+)"));
+  }
+
+  this->buffer_memory_size = PROVIDED_BUFFER_COUNT * PROVIDED_BUFFER_SIZE;
+  void *memory = mmap(nullptr, this->buffer_memory_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw std::runtime_error(errno_message("Failed to map receive buffers"));
+  }
+  this->buffer_memory = static_cast<unsigned char *>(memory);
+
+  this->buffer_ring_tail = 0;
+  for (unsigned i = 0; i < PROVIDED_BUFFER_COUNT; i++) {
+    recycle_buffer(i);
+  }
+}
+
+// ============================================================================
+// UringBackend Ring Helpers
+// ============================================================================
+
+io_uring_sqe *UringBackend::get_sqe() {
+  unsigned head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *this->sq_tail;
+  while (tail - head >= this->sq_entries) {
+    // Full: hand what we have to the kernel to make room. It refuses while
+    // the completion queue is backed up, so set completions aside for the
+    // event loop until it takes them.
+    if (!submit_and_wait(0)) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw std::runtime_error(errno_message("io_uring_enter failed"));
+      }
+      defer_completions();
+    }
+    head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  unsigned index = tail & *this->sq_mask;
+  io_uring_sqe *sqe = &this->sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  this->sq_array[index] = index;
+  // Without SQPOLL the kernel only reads the queue in io_uring_enter, so
+  // publishing the slot before the caller fills it in is safe.
+  __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  this->unsubmitted++;
+  return sqe;
+}
+
+bool UringBackend::submit_and_wait(unsigned wait_count) {
+  unsigned flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int submitted = io_uring_enter(this->ring_fd, this->unsubmitted, wait_count, flags);
+  if (submitted < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      perror("io_uring_enter failed");
+    }
+    return false;
+  }
+  this->unsubmitted -= submitted;
+  return true;
+}
+
+// Moves the ready completions out of the ring without handling them, for
+// when we need room in it from somewhere we can't handle them.
+void UringBackend::defer_completions() {
+  unsigned head = *this->cq_head;
+  unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    this->deferred_completions.push_back(this->cqes[head & *this->cq_mask]);
+    head++;
+  }
+  __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void UringBackend::arm_receive(int socket_fd, uint64_t tag) {
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = socket_fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&this->receive_header);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = PROVIDED_BUFFER_GROUP;
+  sqe->user_data = tag;
+}
+
+void UringBackend::arm_tick() {
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(&this->tick);
+  sqe->len = 1;
+  sqe->user_data = TAG_TICK;
+}
+
+void UringBackend::arm_tcp_poll(int index) {
+  TcpUpstreamPool &pool = this->handler.get_tcp_pool();
+  if (pool.get_fd(index) == -1) {
+    return;
+  }
+  if (static_cast<size_t>(index) >= this->tcp_poll_armed.size()) {
+    this->tcp_poll_armed.resize(index + 1, false);
+    this->tcp_poll_generations.resize(index + 1, 0);
+  }
+  uint32_t generation = pool.get_generation(index);
+  if (this->tcp_poll_armed[index] && this->tcp_poll_generations[index] == generation) {
+    return;
+  }
+
+  // One-shot, re-armed after each completion. POLLOUT only while connecting
+  // or behind on writes; a connected socket is nearly always writable.
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = pool.get_fd(index);
+  sqe->poll32_events = POLLIN | (pool.wants_write(index) ? POLLOUT : 0);
+  sqe->user_data = TAG_TCP_POLL | (static_cast<uint64_t>(generation & 0xFFFF) << 16) | index;
+  this->tcp_poll_armed[index] = true;
+  this->tcp_poll_generations[index] = generation;
+}
+
+void UringBackend::queue_send(int socket_fd, const sockaddr_in &address,
+                              std::vector<unsigned char> bytes) {
+  int index;
+  if (this->free_send_contexts.empty()) {
+    index = this->send_contexts.size();
+    this->send_contexts.push_back(std::make_unique<SendContext>());
+  } else {
+    index = this->free_send_contexts.back();
+    this->free_send_contexts.pop_back();
+  }
+
+  SendContext &context = *this->send_contexts[index];
+  context.bytes = std::move(bytes);
+  context.address = address;
+  context.io.iov_base = context.bytes.data();
+  context.io.iov_len = context.bytes.size();
+  context.header = {};
+  context.header.msg_name = &context.address;
+  context.header.msg_namelen = sizeof(context.address);
+  context.header.msg_iov = &context.io;
+  context.header.msg_iovlen = 1;
+
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = socket_fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&context.header);
+  sqe->len = 1;
+  sqe->user_data = TAG_SEND | index;
+}
+
+void UringBackend::recycle_buffer(unsigned short buffer_id) {
+  // Index the entries by hand: in C++ the header's flexible-array member
+  // picks up padding and no longer starts at offset 0.
+  io_uring_buf *entries = reinterpret_cast<io_uring_buf *>(this->buffer_ring);
+  io_uring_buf *buffer = &entries[this->buffer_ring_tail & (PROVIDED_BUFFER_COUNT - 1)];
+  buffer->addr = reinterpret_cast<uint64_t>(this->buffer_memory + buffer_id * PROVIDED_BUFFER_SIZE);
+  buffer->len = PROVIDED_BUFFER_SIZE;
+  buffer->bid = buffer_id;
+  this->buffer_ring_tail++;
+  __atomic_store_n(&this->buffer_ring->tail, this->buffer_ring_tail, __ATOMIC_RELEASE);
+}
+
+// ============================================================================
+// UringBackend Event Loop
+// ============================================================================
+
+void UringBackend::run() {
+  arm_receive(this->listen_socket, TAG_CLIENT_RECEIVE);
+  if (this->upstream_socket != -1) {
+    arm_receive(this->upstream_socket, TAG_UPSTREAM_RECEIVE);
+  }
+  arm_tick();
+
+  while (!shutdown_requested()) {
+    submit_and_wait(this->deferred_completions.empty() ? 1 : 0);
+
+    // Completions get_sqe set aside came first.
+    std::vector<io_uring_cqe> deferred;
+    deferred.swap(this->deferred_completions);
+    for (const auto &cqe : deferred) {
+      handle_completion(cqe);
+    }
+
+    // Reap everything that's ready in one go. Each completion leaves the
+    // ring before it's handled, since handling it may set the rest aside.
+    unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+    while (static_cast<int>(tail - *this->cq_head) > 0) {
+      unsigned head = *this->cq_head;
+      io_uring_cqe cqe = this->cqes[head & *this->cq_mask];
+      __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+      handle_completion(cqe);
+    }
+
+    // Replies relayed in this batch go out before the cache parses them.
+    if (!this->uncached_replies.empty()) {
+      submit_and_wait(0);
+      cache_relayed_replies();
+    }
+  }
+}
+
+void UringBackend::handle_completion(const io_uring_cqe &cqe) {
+  uint64_t kind = cqe.user_data & TAG_KIND_MASK;
+
+  if (kind == TAG_CLIENT_RECEIVE) {
+    handle_receive(cqe, this->listen_socket, TAG_CLIENT_RECEIVE);
+  } else if (kind == TAG_UPSTREAM_RECEIVE) {
+    handle_receive(cqe, this->upstream_socket, TAG_UPSTREAM_RECEIVE);
+  } else if (kind == TAG_SEND) {
+    int index = cqe.user_data & ~TAG_KIND_MASK;
+    if (cqe.res < 0) {
+      std::cerr << "Failed to send response: " << strerror(-cqe.res) << std::endl;
+    }
+    this->send_contexts[index]->bytes.clear();
+    this->free_send_contexts.push_back(index);
+  } else if (kind == TAG_TCP_POLL) {
+    handle_tcp_poll(cqe);
+  } else if (kind == TAG_TICK) {
+    expire_transactions();
+    this->handler.tick();
+    // Polls only watch for POLLOUT while connecting; catch up on any writes
+    // the socket didn't take at once.
+    this->handler.get_tcp_pool().retry_writes();
+    arm_tick();
+  }
+}
+
+void UringBackend::handle_receive(const io_uring_cqe &cqe, int socket_fd, uint64_t tag) {
+  if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER) != 0) {
+    unsigned short buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char *buffer = this->buffer_memory + buffer_id * PROVIDED_BUFFER_SIZE;
+    auto *message = reinterpret_cast<io_uring_recvmsg_out *>(buffer);
+
+    sockaddr_in source = {};
+    size_t name_length = message->namelen < sizeof(source) ? message->namelen : sizeof(source);
+    std::memcpy(&source, buffer + sizeof(io_uring_recvmsg_out), name_length);
+
+    // Longer datagrams are cut to BUFFER_SIZE from clients and
+    // MAX_UPSTREAM_UDP_SIZE from upstream, the same as recvfrom would.
+    char *payload = reinterpret_cast<char *>(buffer + sizeof(io_uring_recvmsg_out) +
+                                             this->receive_header.msg_namelen +
+                                             this->receive_header.msg_controllen);
+    int limit = tag == TAG_CLIENT_RECEIVE ? BUFFER_SIZE : MAX_UPSTREAM_UDP_SIZE;
+    int size = message->payloadlen < static_cast<unsigned>(limit) ? message->payloadlen : limit;
+
+    if (tag == TAG_CLIENT_RECEIVE) {
+      // How long it sat in the socket buffer and the completion queue. Too
+      // stale to be worth answering past the drop threshold.
+      msghdr control = {};
+      control.msg_control = buffer + sizeof(io_uring_recvmsg_out) + this->receive_header.msg_namelen;
+      control.msg_controllen = message->controllen;
+      int64_t delay_ms = receive_delay_ms(control);
+      if (delay_ms < 0 || this->handler.record_queue_delay(delay_ms)) {
+        handle_client_packet(payload, size, source);
+      }
+    } else {
+      handle_upstream_packet(payload, size, source, false);
+    }
+    recycle_buffer(buffer_id);
+  } else if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+    std::cerr << "Error receiving data: " << strerror(-cqe.res) << std::endl;
+  }
+
+  // The kernel drops a multishot receive on errors or when it runs out of
+  // buffers; post it again.
+  if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+    arm_receive(socket_fd, tag);
+  }
+}
+
+// ============================================================================
+// UringBackend Query Handling
+// ============================================================================
+
+void UringBackend::handle_client_packet(const char *packet, int size, const sockaddr_in &client) {
+  auto result = this->handler.admit_query(packet, size, client);
+
+  if (result.disposition == QueryDisposition::Respond) {
+    queue_send(this->listen_socket, client, std::move(result.response));
+    return;
+  }
+  if (result.disposition != QueryDisposition::Forward) {
+    return;
+  }
+
+  int transaction_index;
+  if (this->free_transactions.empty()) {
+    transaction_index = this->transactions.size();
+    this->transactions.push_back(std::make_unique<ClientTransaction>());
+  } else {
+    transaction_index = this->free_transactions.back();
+    this->free_transactions.pop_back();
+  }
+
+  ClientTransaction &transaction = *this->transactions[transaction_index];
+  transaction.in_use = true;
+  transaction.client = client;
+  transaction.response = std::move(result.packet);
+  transaction.resolutions = std::move(result.resolutions);
+  transaction.outstanding = 0;
+  transaction.upstream_ids.clear();
+  transaction.started_ms = now_ms();
+  transaction.admission_cost = result.admission_cost;
+  transaction.pass_through = std::move(result.pass_through);
+  transaction.reply_limit = result.reply_limit;
+
+  for (size_t i = 0; i < transaction.resolutions.size(); i++) {
+    if (transaction.resolutions[i].is_done()) {
+      continue;
+    }
+    if (!send_upstream_query(transaction_index, i)) {
+      transaction.resolutions[i].finish();
+      continue;
+    }
+    transaction.outstanding++;
+  }
+
+  if (transaction.outstanding == 0) {
+    finish_transaction(transaction_index);
+  }
+}
+
+bool UringBackend::send_upstream_query(int transaction_index, int question_index) {
+  int upstream_id = allocate_upstream_id();
+  if (upstream_id == -1) {
+    return false;
+  }
+
+  ClientTransaction &transaction = *this->transactions[transaction_index];
+  const Resolution &resolution = transaction.resolutions[question_index];
+  const sockaddr_in &server = resolution.get_upstream_server();
+  this->upstream_queries[upstream_id] =
+      UpstreamQuery{transaction_index, question_index, server, now_ms(), false, -1, 0, {}};
+  transaction.upstream_ids.push_back(upstream_id);
+  queue_send(this->upstream_socket, server, create_upstream_query(transaction, question_index, upstream_id));
+  return true;
+}
+
+// The client's own bytes while the transaction can still be passed through,
+// otherwise a query built for the resolution's next link.
+std::vector<unsigned char> UringBackend::create_upstream_query(ClientTransaction &transaction,
+                                                               int question_index, uint16_t upstream_id) {
+  if (!transaction.pass_through.bytes.empty()) {
+    return QueryHandler::create_pass_through_query(transaction.pass_through, upstream_id);
+  }
+  const Resolution &resolution = transaction.resolutions[question_index];
+  return transaction.response.create_upstream_query(resolution.get_upstream_question(), upstream_id,
+                                                    !resolution.is_iterative());
+}
+
+int UringBackend::allocate_upstream_id() {
+  if (this->upstream_queries.size() >= 0xFFFF) {
+    return -1;
+  }
+  // Random IDs so replies can't be predicted and spoofed.
+  while (true) {
+    uint16_t upstream_id = this->id_generator() & 0xFFFF;
+    if (this->upstream_queries.find(upstream_id) == this->upstream_queries.end()) {
+      return upstream_id;
+    }
+  }
+}
+
+void UringBackend::handle_upstream_packet(const char *packet, int size, const sockaddr_in &source,
+                                          bool over_tcp) {
+  if (size < HEADER_BYTE_SIZE) {
+    return;
+  }
+
+  uint16_t upstream_id = DNSPacket::convert_unsigned_char_tuple_into_int(packet[0], packet[1]);
+  auto upstream_query = this->upstream_queries.find(upstream_id);
+  if (upstream_query == this->upstream_queries.end()) {
+    return;
+  }
+  const sockaddr_in &server = upstream_query->second.server;
+  if (source.sin_addr.s_addr != server.sin_addr.s_addr || source.sin_port != server.sin_port ||
+      upstream_query->second.over_tcp != over_tcp) {
+    return;
+  }
+  if (!over_tcp && (packet[2] & TRUNCATION_FLAG) != 0 && retry_over_tcp(upstream_id, upstream_query->second)) {
+    upstream_query->second.truncated_reply.assign(packet, packet + size);
+    return;
+  }
+  accept_upstream_reply(upstream_id, packet, size);
+}
+
+// Hands the reply to an upstream query we were waiting on to its resolution,
+// relaying it if the transaction can still pass it through.
+void UringBackend::accept_upstream_reply(uint16_t upstream_id, const char *packet, int size) {
+  auto upstream_query = this->upstream_queries.find(upstream_id);
+  int transaction_index = upstream_query->second.transaction_index;
+  int question_index = upstream_query->second.question_index;
+  forget_upstream_query(upstream_id, upstream_query->second);
+  this->upstream_queries.erase(upstream_query);
+
+  ClientTransaction &transaction = *this->transactions[transaction_index];
+  Resolution &resolution = transaction.resolutions[question_index];
+  if (!transaction.pass_through.bytes.empty()) {
+    bool relayed = QueryHandler::relay_upstream_reply(transaction.pass_through, upstream_id, packet, size,
+                                                      &transaction.relayed_reply);
+    transaction.pass_through.bytes.clear();
+    if (relayed) {
+      // The cache sees it after the send goes out; see run().
+      std::vector<unsigned char> bytes(packet, packet + size);
+      this->uncached_replies.push_back(UncachedReply{resolution, std::move(bytes)});
+      resolution.finish();
+      transaction.outstanding--;
+      finish_transaction(transaction_index);
+      return;
+    }
+  }
+  this->handler.get_resolver().add_upstream_reply(resolution, packet, size);
+  continue_resolution(transaction_index, question_index);
+}
+
+// Sends the same query again on a pooled TCP connection, keeping its ID so the
+// reply is matched the same way. Returns false if no connection could take
+// it, in which case the truncated reply is used as is.
+bool UringBackend::retry_over_tcp(uint16_t upstream_id, UpstreamQuery &upstream_query) {
+  ClientTransaction &transaction = *this->transactions[upstream_query.transaction_index];
+  auto query = create_upstream_query(transaction, upstream_query.question_index, upstream_id);
+
+  int index = this->handler.get_tcp_pool().send_query(upstream_query.server, query);
+  if (index == -1) {
+    return false;
+  }
+  upstream_query.over_tcp = true;
+  upstream_query.tcp_connection = index;
+  upstream_query.tcp_generation = this->handler.get_tcp_pool().get_generation(index);
+  upstream_query.sent_ms = now_ms();
+  arm_tcp_poll(index);
+  return true;
+}
+
+// The TCP retry of a truncated reply failed: go on with the truncated reply,
+// which the resolver won't cache and the client gets with TC set.
+void UringBackend::fall_back_to_truncated_reply(uint16_t upstream_id) {
+  auto upstream_query = this->upstream_queries.find(upstream_id);
+  if (upstream_query == this->upstream_queries.end()) {
+    return;
+  }
+  auto reply = std::move(upstream_query->second.truncated_reply);
+  accept_upstream_reply(upstream_id, reinterpret_cast<const char *>(reply.data()), reply.size());
+}
+
+void UringBackend::cache_relayed_replies() {
+  for (auto &reply : this->uncached_replies) {
+    auto bytes = reinterpret_cast<const char *>(reply.bytes.data());
+    this->handler.get_resolver().add_upstream_reply(reply.resolution, bytes, reply.bytes.size());
+  }
+  this->uncached_replies.clear();
+}
+
+// Tells the pool we've stopped waiting for a TCP query's reply, so it no
+// longer counts against the connection.
+void UringBackend::cancel_tcp_query(uint16_t upstream_id, const UpstreamQuery &upstream_query) {
+  TcpUpstreamPool &pool = this->handler.get_tcp_pool();
+  if (upstream_query.over_tcp &&
+      pool.get_generation(upstream_query.tcp_connection) == upstream_query.tcp_generation) {
+    pool.cancel_query(upstream_query.tcp_connection, upstream_id);
+  }
+}
+
+// Drops the query from its transaction's list; the caller erases it from
+// upstream_queries.
+void UringBackend::forget_upstream_query(uint16_t upstream_id, const UpstreamQuery &upstream_query) {
+  std::erase(this->transactions[upstream_query.transaction_index]->upstream_ids, upstream_id);
+}
+
+void UringBackend::handle_tcp_poll(const io_uring_cqe &cqe) {
+  int index = cqe.user_data & 0xFFFF;
+  uint32_t generation = (cqe.user_data >> 16) & 0xFFFF;
+  if ((this->tcp_poll_generations[index] & 0xFFFF) != generation) {
+    // A poll on a connection that has since closed and been replaced.
+    return;
+  }
+  this->tcp_poll_armed[index] = false;
+
+  TcpUpstreamPool &pool = this->handler.get_tcp_pool();
+  if (pool.get_fd(index) == -1 || (pool.get_generation(index) & 0xFFFF) != generation) {
+    return;
+  }
+
+  short events = cqe.res < 0 ? POLLERR : cqe.res;
+  std::vector<std::vector<unsigned char>> replies;
+  bool open = pool.handle_events(index, events, &replies);
+  sockaddr_in server = pool.get_server(index);
+  for (const auto &reply : replies) {
+    handle_upstream_packet(reinterpret_cast<const char *>(reply.data()), reply.size(), server, true);
+  }
+  if (open) {
+    arm_tcp_poll(index);
+    return;
+  }
+
+  // Whatever was still waiting on the connection won't get a reply.
+  std::vector<uint16_t> stranded;
+  for (const auto &[upstream_id, upstream_query] : this->upstream_queries) {
+    if (upstream_query.over_tcp && upstream_query.tcp_connection == index &&
+        (upstream_query.tcp_generation & 0xFFFF) == generation) {
+      stranded.push_back(upstream_id);
+    }
+  }
+  for (uint16_t upstream_id : stranded) {
+    fall_back_to_truncated_reply(upstream_id);
+  }
+}
+
+// Sends the next upstream query the resolution needs, or finishes it and
+// then the transaction once nothing else is outstanding.
+void UringBackend::continue_resolution(int transaction_index, int question_index) {
+  ClientTransaction &transaction = *this->transactions[transaction_index];
+  Resolution &resolution = transaction.resolutions[question_index];
+  Resolver &resolver = this->handler.get_resolver();
+
+  // Chase the next missing link or referral, if the reply left one.
+  if (!resolver.advance(resolution) && send_upstream_query(transaction_index, question_index)) {
+    return;
+  }
+  resolution.finish();
+  transaction.outstanding--;
+  if (transaction.outstanding == 0) {
+    finish_transaction(transaction_index);
+  }
+}
+
+void UringBackend::finish_transaction(int transaction_index) {
+  ClientTransaction &transaction = *this->transactions[transaction_index];
+  std::vector<unsigned char> reply;
+  if (!transaction.relayed_reply.empty()) {
+    reply = std::move(transaction.relayed_reply);
+  } else {
+    reply = QueryHandler::build_response(transaction.response, transaction.resolutions, transaction.reply_limit);
+  }
+  if (this->handler.limit_response(transaction.client, &reply)) {
+    queue_send(this->listen_socket, transaction.client, std::move(reply));
+  }
+  transaction.relayed_reply.clear();
+  this->handler.release_upstream_slot(transaction.client, transaction.admission_cost);
+  transaction.in_use = false;
+  transaction.response = DNSPacket();
+  transaction.resolutions.clear();
+  this->free_transactions.push_back(transaction_index);
+}
+
+void UringBackend::expire_transactions() {
+  int64_t now = now_ms();
+
+  // Upstream queries that timed out: the resolver decides whether to try
+  // another server. Collected first, since retries add new queries.
+  int64_t timeout_ms = this->handler.get_resolver().get_upstream_timeout_ms();
+  std::vector<UpstreamQuery> timed_out;
+  std::vector<uint16_t> tcp_timed_out;
+  for (auto it = this->upstream_queries.begin(); it != this->upstream_queries.end();) {
+    if (now - it->second.sent_ms >= timeout_ms && it->second.over_tcp) {
+      cancel_tcp_query(it->first, it->second);
+      tcp_timed_out.push_back(it->first);
+      it++;
+    } else if (now - it->second.sent_ms >= timeout_ms) {
+      cancel_tcp_query(it->first, it->second);
+      forget_upstream_query(it->first, it->second);
+      timed_out.push_back(it->second);
+      it = this->upstream_queries.erase(it);
+    } else {
+      it++;
+    }
+  }
+  for (uint16_t upstream_id : tcp_timed_out) {
+    fall_back_to_truncated_reply(upstream_id);
+  }
+  for (const auto &upstream_query : timed_out) {
+    ClientTransaction &transaction = *this->transactions[upstream_query.transaction_index];
+    this->handler.get_resolver().add_upstream_timeout(transaction.resolutions[upstream_query.question_index]);
+    continue_resolution(upstream_query.transaction_index, upstream_query.question_index);
+  }
+
+  for (size_t i = 0; i < this->transactions.size(); i++) {
+    ClientTransaction &transaction = *this->transactions[i];
+    if (!transaction.in_use || now - transaction.started_ms < TRANSACTION_TIMEOUT_MS) {
+      continue;
+    }
+
+    // Forget the lost upstream queries and answer with what arrived.
+    for (uint16_t upstream_id : transaction.upstream_ids) {
+      auto upstream_query = this->upstream_queries.find(upstream_id);
+      cancel_tcp_query(upstream_id, upstream_query->second);
+      this->upstream_queries.erase(upstream_query);
+    }
+    transaction.upstream_ids.clear();
+    finish_transaction(i);
+  }
+}
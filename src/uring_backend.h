@@ -0,0 +1,170 @@
+#pragma once
+
+#include "dns_packet.h"
+#include "query_handler.h"
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// io_uring network backend. A multishot recvmsg stays posted on the listening
+// socket (and on one shared upstream socket) and draws from a ring of
+// provided buffers, so receiving a packet costs no syscall of its own. Replies
+// and upstream queries go out as SENDMSG submissions, and completions are
+// reaped in batches with a single io_uring_enter per loop. Truncated upstream
+// replies are retried on the handler's pooled TCP connections, which are
+// watched with POLL_ADD.
+//
+// Talks to the kernel directly through the io_uring syscalls. Needs Linux 6.0
+// or newer for multishot recvmsg; the constructor throws if the ring can't be
+// set up so main() can fall back to the socket backend.
+class UringBackend {
+private:
+  // A reply or upstream query whose SENDMSG hasn't completed yet. The kernel
+  // reads the header, address and bytes until then, so they live here.
+  struct SendContext {
+    msghdr header;
+    iovec io;
+    sockaddr_in address;
+    std::vector<unsigned char> bytes;
+  };
+
+  // A client query waiting on upstream replies. Each unfinished question has
+  // one upstream query in flight at a time, for the next missing link.
+  struct ClientTransaction {
+    bool in_use;
+    sockaddr_in client;
+    DNSPacket response;
+    std::vector<Resolution> resolutions;
+    int outstanding;
+    // Keys of its entries in upstream_queries.
+    std::vector<uint16_t> upstream_ids;
+    int64_t started_ms;
+    // Handed back to the in-flight limits when the transaction finishes.
+    size_t admission_cost;
+    // Cleared once the first upstream reply is in; set in `relayed_reply` if
+    // that reply goes back to the client as is.
+    PassThroughQuery pass_through;
+    std::vector<unsigned char> relayed_reply;
+    size_t reply_limit;
+  };
+
+  struct UpstreamQuery {
+    int transaction_index;
+    int question_index;
+    // Only a reply from where the query went counts.
+    sockaddr_in server;
+    int64_t sent_ms;
+    // Retried over TCP after a truncated reply; UDP replies no longer count.
+    bool over_tcp;
+    // The pooled connection it went out on, once over TCP.
+    int tcp_connection;
+    uint32_t tcp_generation;
+    // The truncated UDP reply, used after all if TCP fails.
+    std::vector<unsigned char> truncated_reply;
+  };
+
+  // An upstream reply relayed to the client as is, waiting for the cache.
+  struct UncachedReply {
+    Resolution resolution;
+    std::vector<unsigned char> bytes;
+  };
+
+  QueryHandler &handler;
+  int listen_socket;
+  int upstream_socket;
+
+  // Ring state, mapped from the kernel. The SQ and CQ rings share a mapping.
+  int ring_fd;
+  void *rings;
+  size_t rings_size;
+  io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned sq_entries;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  io_uring_cqe *cqes;
+  unsigned unsubmitted;
+  // Completions get_sqe took off the ring to make room; handled first.
+  std::vector<io_uring_cqe> deferred_completions;
+
+  // Provided buffers for multishot receives.
+  io_uring_buf_ring *buffer_ring;
+  size_t buffer_ring_size;
+  unsigned char *buffer_memory;
+  size_t buffer_memory_size;
+  unsigned short buffer_ring_tail;
+
+  // Template the multishot receives use to lay out each buffer.
+  msghdr receive_header;
+  __kernel_timespec tick;
+
+  std::vector<std::unique_ptr<SendContext>> send_contexts;
+  std::vector<int> free_send_contexts;
+  std::vector<std::unique_ptr<ClientTransaction>> transactions;
+  std::vector<int> free_transactions;
+  std::unordered_map<uint16_t, UpstreamQuery> upstream_queries;
+  // Cached once the batch's sends are submitted, so relaying never waits on
+  // the parse.
+  std::vector<UncachedReply> uncached_replies;
+  // Per pooled TCP connection: whether a poll is armed, and for which
+  // generation of the connection in that slot.
+  std::vector<bool> tcp_poll_armed;
+  std::vector<uint32_t> tcp_poll_generations;
+  std::mt19937 id_generator;
+
+  void setup_ring();
+  void release_resources();
+  void setup_buffer_ring();
+  // Never fails to return a slot: waits for the kernel to free one if the
+  // submission queue is full.
+  io_uring_sqe *get_sqe();
+  // Returns false, with errno set, if io_uring_enter failed.
+  bool submit_and_wait(unsigned wait_count);
+  void defer_completions();
+
+  void arm_receive(int socket_fd, uint64_t tag);
+  void arm_tick();
+  void arm_tcp_poll(int index);
+  void queue_send(int socket_fd, const sockaddr_in &address, std::vector<unsigned char> bytes);
+  void recycle_buffer(unsigned short buffer_id);
+
+  void handle_completion(const io_uring_cqe &cqe);
+  void handle_receive(const io_uring_cqe &cqe, int socket_fd, uint64_t tag);
+  void handle_client_packet(const char *packet, int size, const sockaddr_in &client);
+  void handle_upstream_packet(const char *packet, int size, const sockaddr_in &source, bool over_tcp);
+  void accept_upstream_reply(uint16_t upstream_id, const char *packet, int size);
+  void fall_back_to_truncated_reply(uint16_t upstream_id);
+  void cache_relayed_replies();
+  void handle_tcp_poll(const io_uring_cqe &cqe);
+  bool retry_over_tcp(uint16_t upstream_id, UpstreamQuery &upstream_query);
+  void cancel_tcp_query(uint16_t upstream_id, const UpstreamQuery &upstream_query);
+  void forget_upstream_query(uint16_t upstream_id, const UpstreamQuery &upstream_query);
+  int allocate_upstream_id();
+  std::vector<unsigned char> create_upstream_query(ClientTransaction &transaction, int question_index,
+                                                   uint16_t upstream_id);
+  bool send_upstream_query(int transaction_index, int question_index);
+  void continue_resolution(int transaction_index, int question_index);
+  void finish_transaction(int transaction_index);
+  void expire_transactions();
+
+public:
+  UringBackend(int listen_socket, QueryHandler &handler);
+  ~UringBackend();
+
+  UringBackend(const UringBackend &) = delete;
+  UringBackend &operator=(const UringBackend &) = delete;
+
+  // Runs until shutdown is requested.
+  void run();
+};
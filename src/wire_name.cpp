@@ -0,0 +1,82 @@
+#include "wire_name.h"
+#include "name_kernels.h"
+
+WireName::WireName() {
+  this->bytes.push_back(0x00);
+  compute_metadata();
+}
+
+WireName::WireName(const unsigned char* data, size_t size) {
+  if (size > MAX_WIRE_NAME_SIZE) {
+    throw std::length_error("Domain name exceeds 255 bytes");
+  }
+  this->bytes.append(data, size);
+  compute_metadata();
+}
+
+void WireName::compute_metadata() {
+  // -1 marks a malformed label sequence.
+  this->label_count = scan_wire_labels(this->bytes.data(), this->bytes.size());
+  this->hash = hash_wire_name(this->bytes.data(), this->bytes.size());
+}
+
+WireName WireName::to_canonical() const {
+  unsigned char lowered[MAX_WIRE_NAME_SIZE];
+  lowercase_wire_name(lowered, this->bytes.data(), this->bytes.size());
+  return WireName(lowered, this->bytes.size());
+}
+
+WireName WireName::get_parent() const {
+  if (this->label_count <= 0) {
+    return WireName();
+  }
+  size_t first_label_size = this->bytes[0] + 1;
+  return WireName(this->bytes.data() + first_label_size, this->bytes.size() - first_label_size);
+}
+
+bool WireName::is_subdomain_of(const WireName& zone) const {
+  if (this->label_count < 0 || zone.label_count < 0 || this->label_count < zone.label_count) {
+    return false;
+  }
+
+  // Skip the labels this name has in front of the zone, then compare the rest.
+  size_t offset = 0;
+  for (int i = 0; i < this->label_count - zone.label_count; i++) {
+    offset += this->bytes[offset] + 1;
+  }
+  if (this->bytes.size() - offset != zone.bytes.size()) {
+    return false;
+  }
+  return wire_names_equal(this->bytes.data() + offset, zone.bytes.data(), zone.bytes.size());
+}
+
+const unsigned char* WireName::data() const {
+  return this->bytes.data();
+}
+
+size_t WireName::size() const {
+  return this->bytes.size();
+}
+
+int WireName::get_label_count() const {
+  return this->label_count;
+}
+
+uint64_t WireName::get_hash() const {
+  return this->hash;
+}
+
+unsigned char WireName::operator[](size_t index) const {
+  return this->bytes[index];
+}
+
+void WireName::add_name_into_return_packet(std::vector<unsigned char>* return_packet) const {
+  this->bytes.add_into_return_packet(return_packet);
+}
+
+bool WireName::operator==(const WireName& other) const {
+  if (this->hash != other.hash || this->bytes.size() != other.bytes.size()) {
+    return false;
+  }
+  return wire_names_equal(this->bytes.data(), other.bytes.data(), this->bytes.size());
+}
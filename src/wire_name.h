@@ -0,0 +1,59 @@
+#pragma once
+
+#include "inline_buffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Longest uncompressed domain name allowed on the wire (RFC 1035 2.3.4).
+const int MAX_WIRE_NAME_SIZE = 255;
+
+// Largest RDATA a record can carry: RDLENGTH is 16 bits. Only answers
+// fetched over TCP come close.
+const int MAX_RDATA_SIZE = 65535;
+// RDATA up to this size is stored inline; bigger RDATA goes on the heap.
+const int INLINE_RDATA_SIZE = 512;
+
+using RData = SpillBuffer<INLINE_RDATA_SIZE, MAX_RDATA_SIZE>;
+
+// An uncompressed domain name in wire format (length-prefixed labels ending
+// with the zero-length root label). Names are the key for every lookup, so the
+// label count and a case-insensitive hash are computed once on construction.
+class WireName {
+private:
+  InlineBuffer<MAX_WIRE_NAME_SIZE> bytes;
+  int label_count;
+  uint64_t hash;
+
+  void compute_metadata();
+
+public:
+  // The root name (a single 0x00 byte).
+  WireName();
+  WireName(const unsigned char* data, size_t size);
+
+  const unsigned char* data() const;
+  size_t size() const;
+  // Number of labels before the root, or -1 if the label sequence is malformed.
+  int get_label_count() const;
+  uint64_t get_hash() const;
+  unsigned char operator[](size_t index) const;
+
+  // Copy of this name with ASCII letters lowercased.
+  WireName to_canonical() const;
+  // This name without its first label. The root is its own parent.
+  WireName get_parent() const;
+  // True if this name is `zone` or sits anywhere below it.
+  bool is_subdomain_of(const WireName& zone) const;
+
+  void add_name_into_return_packet(std::vector<unsigned char>* return_packet) const;
+
+  // Names compare case-insensitively, as DNS requires (RFC 4343).
+  bool operator==(const WireName& other) const;
+};
+
+template <>
+struct std::hash<WireName> {
+  size_t operator()(const WireName& name) const { return name.get_hash(); }
+};
@@ -0,0 +1,691 @@
+#include "xdp_backend.h"
+#include "dns_packet.h"
+#include "shutdown.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// UMEM layout: FRAME_COUNT chunks of FRAME_SIZE bytes.
+const uint32_t FRAME_SIZE = 2048;
+const uint32_t FRAME_COUNT = 4096;
+// Entries in each of the four rings. Must be a power of two.
+const uint32_t XSK_RING_SIZE = 2048;
+// Entries in the queue-to-socket map the XDP program redirects through.
+const uint32_t XSK_MAP_ENTRIES = 64;
+
+// Offsets into an Ethernet + IPv4 (no options) + UDP frame.
+const size_t ETHERNET_HEADER_SIZE = 14;
+const size_t IPV4_OFFSET = ETHERNET_HEADER_SIZE;
+const size_t IPV4_HEADER_SIZE = 20;
+const size_t UDP_OFFSET = IPV4_OFFSET + IPV4_HEADER_SIZE;
+const size_t UDP_HEADER_SIZE = 8;
+const size_t PAYLOAD_OFFSET = UDP_OFFSET + UDP_HEADER_SIZE;
+const uint16_t DNS_PORT = 2053;
+// Forward results waiting for a forwarding thread. Past this, queries are
+// dropped as an overflowing socket buffer would.
+const size_t XDP_FORWARD_QUEUE_SIZE = 4096;
+
+static std::string errno_message(const std::string &what) {
+  return what + ": " + strerror(errno);
+}
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int bpf(int command, bpf_attr *attributes) {
+  return syscall(__NR_bpf, command, attributes, sizeof(*attributes));
+}
+
+// ============================================================================
+// XDP Program
+// ============================================================================
+
+static bpf_insn make_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+  bpf_insn insn = {};
+  insn.code = code;
+  insn.dst_reg = dst;
+  insn.src_reg = src;
+  insn.off = off;
+  insn.imm = imm;
+  return insn;
+}
+
+// The redirect program, written out as BPF instructions so we don't need a
+// BPF toolchain at build time. In C it reads:
+//
+//   if (data + 42 > data_end) return XDP_PASS;
+//   if (eth->h_proto != htons(ETH_P_IP)) return XDP_PASS;
+//   if (ip->version_ihl != 0x45) return XDP_PASS;  // no options
+//   if (ip->protocol != IPPROTO_UDP) return XDP_PASS;
+//   if (ip->frag_off & htons(0x3fff)) return XDP_PASS;  // no fragments
+//   if (udp->dest != htons(2053)) return XDP_PASS;
+//   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+//
+// Loads are little-endian, so the network-order constants are byte-swapped.
+static std::vector<bpf_insn> build_redirect_program(int map_fd) {
+  const uint8_t LDX_W = BPF_LDX | BPF_MEM | BPF_W;
+  const uint8_t LDX_H = BPF_LDX | BPF_MEM | BPF_H;
+  const uint8_t LDX_B = BPF_LDX | BPF_MEM | BPF_B;
+  const uint8_t JNE_K = BPF_JMP | BPF_JNE | BPF_K;
+  // Jumps to the trailing "return XDP_PASS" get their offset patched below.
+  const int16_t TO_PASS = 0x7fff;
+
+  std::vector<bpf_insn> program = {
+      make_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+      make_insn(LDX_W, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, data), 0),
+      make_insn(LDX_W, BPF_REG_3, BPF_REG_6, offsetof(xdp_md, data_end), 0),
+      make_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+      make_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, PAYLOAD_OFFSET),
+      make_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, TO_PASS, 0),
+      make_insn(LDX_H, BPF_REG_5, BPF_REG_2, 12, 0),
+      make_insn(JNE_K, BPF_REG_5, 0, TO_PASS, 0x0008),
+      make_insn(LDX_B, BPF_REG_5, BPF_REG_2, IPV4_OFFSET, 0),
+      make_insn(JNE_K, BPF_REG_5, 0, TO_PASS, 0x45),
+      make_insn(LDX_B, BPF_REG_5, BPF_REG_2, IPV4_OFFSET + 9, 0),
+      make_insn(JNE_K, BPF_REG_5, 0, TO_PASS, IPPROTO_UDP),
+      make_insn(LDX_H, BPF_REG_5, BPF_REG_2, IPV4_OFFSET + 6, 0),
+      make_insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0xff3f),
+      make_insn(JNE_K, BPF_REG_5, 0, TO_PASS, 0),
+      make_insn(LDX_H, BPF_REG_5, BPF_REG_2, UDP_OFFSET + 2, 0),
+      make_insn(JNE_K, BPF_REG_5, 0, TO_PASS, htons(DNS_PORT)),
+      make_insn(LDX_W, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, rx_queue_index), 0),
+      make_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+      make_insn(0, 0, 0, 0, 0),
+      make_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+      make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+      make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+      // pass:
+      make_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+      make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  };
+
+  int pass_index = program.size() - 2;
+  for (int i = 0; i < static_cast<int>(program.size()); i++) {
+    if (BPF_CLASS(program[i].code) == BPF_JMP && program[i].off == TO_PASS) {
+      program[i].off = pass_index - (i + 1);
+    }
+  }
+  return program;
+}
+
+// ============================================================================
+// XdpBackend Construction
+// ============================================================================
+
+XdpBackend::XdpBackend(int fallback_socket, QueryHandler &handler, const ServerOptions &options)
+    : handler(handler), forward_queue(XDP_FORWARD_QUEUE_SIZE) {
+  this->fallback_socket = fallback_socket;
+  this->interface_name = options.xdp_interface;
+  this->queue_id = options.xdp_queue;
+  this->native_mode = options.xdp_mode == "native";
+  this->map_fd = -1;
+  this->program_fd = -1;
+  this->attached = false;
+  this->xsk_fd = -1;
+  this->umem = static_cast<unsigned char *>(MAP_FAILED);
+  this->umem_size = FRAME_COUNT * FRAME_SIZE;
+  this->rx = {};
+  this->tx = {};
+  this->fill = {};
+  this->completion = {};
+  this->tx_pending = false;
+  this->forward_threads = options.resolver_threads;
+  this->work_signal.store(0);
+  this->idle_forwarders.store(0);
+  this->stopping.store(false);
+
+  try {
+    this->interface_index = if_nametoindex(this->interface_name.c_str());
+    if (this->interface_index == 0) {
+      throw std::runtime_error(errno_message("Unknown interface " + this->interface_name));
+    }
+    if (this->queue_id >= static_cast<int>(XSK_MAP_ENTRIES)) {
+      throw std::runtime_error("XDP queue must be below " + std::to_string(XSK_MAP_ENTRIES));
+    }
+
+    load_program();
+    setup_socket();
+    set_interface_program(this->program_fd);
+    this->attached = true;
+  } catch (...) {
+    release_resources();
+    throw;
+  }
+}
+
+XdpBackend::~XdpBackend() {
+  release_resources();
+}
+
+void XdpBackend::release_resources() {
+  if (this->attached) {
+    try {
+      set_interface_program(-1);
+    } catch (const std::runtime_error &error) {
+      std::cerr << error.what() << std::endl;
+    }
+    this->attached = false;
+  }
+  XskRing *rings[] = {&this->rx, &this->tx, &this->fill, &this->completion};
+  for (auto *ring : rings) {
+    if (ring->map != nullptr && ring->map != MAP_FAILED) {
+      munmap(ring->map, ring->map_size);
+    }
+    *ring = {};
+  }
+  if (this->xsk_fd != -1) {
+    close(this->xsk_fd);
+    this->xsk_fd = -1;
+  }
+  if (this->umem != MAP_FAILED) {
+    munmap(this->umem, this->umem_size);
+    this->umem = static_cast<unsigned char *>(MAP_FAILED);
+  }
+  if (this->program_fd != -1) {
+    close(this->program_fd);
+    this->program_fd = -1;
+  }
+  if (this->map_fd != -1) {
+    close(this->map_fd);
+    this->map_fd = -1;
+  }
+}
+
+void XdpBackend::load_program() {
+  bpf_attr map_attributes = {};
+  map_attributes.map_type = BPF_MAP_TYPE_XSKMAP;
+  map_attributes.key_size = sizeof(uint32_t);
+  map_attributes.value_size = sizeof(uint32_t);
+  map_attributes.max_entries = XSK_MAP_ENTRIES;
+  this->map_fd = bpf(BPF_MAP_CREATE, &map_attributes);
+  if (this->map_fd < 0) {
+    throw std::runtime_error(errno_message("Failed to create XSKMAP"));
+  }
+
+  auto program = build_redirect_program(this->map_fd);
+  char log[4096] = {};
+  const char license[] = "GPL";
+
+  bpf_attr program_attributes = {};
+  program_attributes.prog_type = BPF_PROG_TYPE_XDP;
+  program_attributes.insns = reinterpret_cast<uint64_t>(program.data());
+  program_attributes.insn_cnt = program.size();
+  program_attributes.license = reinterpret_cast<uint64_t>(license);
+  program_attributes.log_buf = reinterpret_cast<uint64_t>(log);
+  program_attributes.log_size = sizeof(log);
+  program_attributes.log_level = 1;
+  this->program_fd = bpf(BPF_PROG_LOAD, &program_attributes);
+  if (this->program_fd < 0) {
+    throw std::runtime_error(errno_message("Failed to load XDP program") + "\n" + log);
+  }
+}
+
+void XdpBackend::set_interface_program(int program_fd) {
+  int netlink_socket = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (netlink_socket < 0) {
+    throw std::runtime_error(errno_message("Failed to open netlink socket"));
+  }
+
+  struct {
+    nlmsghdr header;
+    ifinfomsg interface_info;
+    char attributes[64];
+  } request = {};
+
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+  request.header.nlmsg_type = RTM_SETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  request.header.nlmsg_seq = 1;
+  request.interface_info.ifi_family = AF_UNSPEC;
+  request.interface_info.ifi_index = this->interface_index;
+
+  // IFLA_XDP { IFLA_XDP_FD, IFLA_XDP_FLAGS }
+  auto *nest = reinterpret_cast<rtattr *>(reinterpret_cast<char *>(&request) +
+                                          NLMSG_ALIGN(request.header.nlmsg_len));
+  nest->rta_type = IFLA_XDP | NLA_F_NESTED;
+  nest->rta_len = RTA_LENGTH(0);
+
+  uint32_t flags = this->native_mode ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+  if (program_fd != -1) {
+    flags |= XDP_FLAGS_UPDATE_IF_NOEXIST;
+  }
+
+  auto add_attribute = [&](unsigned short type, const void *data, size_t size) {
+    auto *attribute = reinterpret_cast<rtattr *>(reinterpret_cast<char *>(nest) +
+                                                 RTA_ALIGN(nest->rta_len));
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(size);
+    std::memcpy(RTA_DATA(attribute), data, size);
+    nest->rta_len = RTA_ALIGN(nest->rta_len) + RTA_ALIGN(attribute->rta_len);
+  };
+  add_attribute(IFLA_XDP_FD, &program_fd, sizeof(program_fd));
+  add_attribute(IFLA_XDP_FLAGS, &flags, sizeof(flags));
+  request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + nest->rta_len;
+
+  if (send(netlink_socket, &request, request.header.nlmsg_len, 0) < 0) {
+    close(netlink_socket);
+    throw std::runtime_error(errno_message("Failed to send netlink request"));
+  }
+
+  char reply[4096];
+  ssize_t reply_size = recv(netlink_socket, reply, sizeof(reply), 0);
+  close(netlink_socket);
+  if (reply_size < 0) {
+    throw std::runtime_error(errno_message("Failed to read netlink reply"));
+  }
+
+  auto *reply_header = reinterpret_cast<nlmsghdr *>(reply);
+  if (NLMSG_OK(reply_header, reply_size) && reply_header->nlmsg_type == NLMSG_ERROR) {
+    auto *error = static_cast<nlmsgerr *>(NLMSG_DATA(reply_header));
+    if (error->error != 0) {
+      errno = -error->error;
+      throw std::runtime_error(errno_message(program_fd == -1 ? "Failed to detach XDP program"
+                                                              : "Failed to attach XDP program"));
+    }
+  }
+}
+
+void XdpBackend::map_ring(XskRing &ring, int ring_size, uint64_t page_offset,
+                          size_t descriptor_size, uint64_t producer, uint64_t consumer,
+                          uint64_t descriptors, uint64_t flags) {
+  ring.map_size = descriptors + ring_size * descriptor_size;
+  ring.map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  this->xsk_fd, page_offset);
+  if (ring.map == MAP_FAILED) {
+    ring.map = nullptr;
+    throw std::runtime_error(errno_message("Failed to map AF_XDP ring"));
+  }
+  auto *base = static_cast<unsigned char *>(ring.map);
+  ring.producer = reinterpret_cast<uint32_t *>(base + producer);
+  ring.consumer = reinterpret_cast<uint32_t *>(base + consumer);
+  ring.flags = reinterpret_cast<uint32_t *>(base + flags);
+  ring.descriptors = base + descriptors;
+  ring.mask = ring_size - 1;
+}
+
+void XdpBackend::setup_socket() {
+  this->xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (this->xsk_fd < 0) {
+    throw std::runtime_error(errno_message("Failed to create AF_XDP socket"));
+  }
+
+  void *umem = mmap(nullptr, this->umem_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (umem == MAP_FAILED) {
+    throw std::runtime_error(errno_message("Failed to map UMEM"));
+  }
+  this->umem = static_cast<unsigned char *>(umem);
+
+  xdp_umem_reg umem_registration = {};
+  umem_registration.addr = reinterpret_cast<uint64_t>(this->umem);
+  umem_registration.len = this->umem_size;
+  umem_registration.chunk_size = FRAME_SIZE;
+  if (setsockopt(this->xsk_fd, SOL_XDP, XDP_UMEM_REG, &umem_registration,
+                 sizeof(umem_registration)) != 0) {
+    throw std::runtime_error(errno_message("Failed to register UMEM"));
+  }
+
+  int ring_size = XSK_RING_SIZE;
+  int ring_options[] = {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING};
+  for (int ring_option : ring_options) {
+    if (setsockopt(this->xsk_fd, SOL_XDP, ring_option, &ring_size, sizeof(ring_size)) != 0) {
+      throw std::runtime_error(errno_message("Failed to size AF_XDP ring"));
+    }
+  }
+
+  xdp_mmap_offsets offsets = {};
+  socklen_t offsets_size = sizeof(offsets);
+  if (getsockopt(this->xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_size) != 0) {
+    throw std::runtime_error(errno_message("Failed to read AF_XDP ring offsets"));
+  }
+
+  map_ring(this->rx, XSK_RING_SIZE, XDP_PGOFF_RX_RING, sizeof(xdp_desc), offsets.rx.producer,
+           offsets.rx.consumer, offsets.rx.desc, offsets.rx.flags);
+  map_ring(this->tx, XSK_RING_SIZE, XDP_PGOFF_TX_RING, sizeof(xdp_desc), offsets.tx.producer,
+           offsets.tx.consumer, offsets.tx.desc, offsets.tx.flags);
+  map_ring(this->fill, XSK_RING_SIZE, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t),
+           offsets.fr.producer, offsets.fr.consumer, offsets.fr.desc, offsets.fr.flags);
+  map_ring(this->completion, XSK_RING_SIZE, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t),
+           offsets.cr.producer, offsets.cr.consumer, offsets.cr.desc, offsets.cr.flags);
+
+  sockaddr_xdp address = {};
+  address.sxdp_family = AF_XDP;
+  address.sxdp_ifindex = this->interface_index;
+  address.sxdp_queue_id = this->queue_id;
+  // Copy mode works everywhere, including generic XDP.
+  address.sxdp_flags = XDP_USE_NEED_WAKEUP | (this->native_mode ? 0 : XDP_COPY);
+  if (bind(this->xsk_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    throw std::runtime_error(errno_message("Failed to bind AF_XDP socket"));
+  }
+
+  uint32_t key = this->queue_id;
+  uint32_t value = this->xsk_fd;
+  bpf_attr update = {};
+  update.map_fd = this->map_fd;
+  update.key = reinterpret_cast<uint64_t>(&key);
+  update.value = reinterpret_cast<uint64_t>(&value);
+  if (bpf(BPF_MAP_UPDATE_ELEM, &update) != 0) {
+    throw std::runtime_error(errno_message("Failed to add AF_XDP socket to XSKMAP"));
+  }
+
+  for (uint32_t i = 0; i < FRAME_COUNT; i++) {
+    this->free_frames.push_back(static_cast<uint64_t>(i) * FRAME_SIZE);
+  }
+}
+
+// ============================================================================
+// XdpBackend Rings
+// ============================================================================
+
+void XdpBackend::refill() {
+  uint32_t producer = *this->fill.producer;
+  uint32_t consumer = __atomic_load_n(this->fill.consumer, __ATOMIC_ACQUIRE);
+  uint32_t space = XSK_RING_SIZE - (producer - consumer);
+
+  auto *addresses = static_cast<uint64_t *>(this->fill.descriptors);
+  while (space > 0 && !this->free_frames.empty()) {
+    addresses[producer & this->fill.mask] = this->free_frames.back();
+    this->free_frames.pop_back();
+    producer++;
+    space--;
+  }
+  __atomic_store_n(this->fill.producer, producer, __ATOMIC_RELEASE);
+}
+
+void XdpBackend::reclaim_completions() {
+  uint32_t consumer = *this->completion.consumer;
+  uint32_t producer = __atomic_load_n(this->completion.producer, __ATOMIC_ACQUIRE);
+
+  auto *addresses = static_cast<uint64_t *>(this->completion.descriptors);
+  for (; consumer != producer; consumer++) {
+    uint64_t address = addresses[consumer & this->completion.mask];
+    this->free_frames.push_back(address & ~static_cast<uint64_t>(FRAME_SIZE - 1));
+  }
+  __atomic_store_n(this->completion.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+void XdpBackend::receive_frames() {
+  uint32_t consumer = *this->rx.consumer;
+  uint32_t producer = __atomic_load_n(this->rx.producer, __ATOMIC_ACQUIRE);
+
+  auto *descriptors = static_cast<xdp_desc *>(this->rx.descriptors);
+  for (; consumer != producer; consumer++) {
+    xdp_desc descriptor = descriptors[consumer & this->rx.mask];
+    handle_frame(descriptor.addr, descriptor.len);
+  }
+  __atomic_store_n(this->rx.consumer, consumer, __ATOMIC_RELEASE);
+
+  if (this->tx_pending) {
+    // Copy-mode TX only goes out when the kernel is kicked.
+    sendto(this->xsk_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+    this->tx_pending = false;
+  }
+}
+
+// ============================================================================
+// XdpBackend Query Handling
+// ============================================================================
+
+static uint16_t read_u16(const unsigned char *bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+static void write_u16(unsigned char *bytes, uint16_t value) {
+  bytes[0] = value >> 8;
+  bytes[1] = value & 0xFF;
+}
+
+static uint16_t ipv4_checksum(const unsigned char *header) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < IPV4_HEADER_SIZE; i += 2) {
+    sum += read_u16(header + i);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return ~sum & 0xFFFF;
+}
+
+void XdpBackend::handle_frame(uint64_t address, uint32_t length) {
+  unsigned char *frame = this->umem + address;
+  uint64_t frame_base = address & ~static_cast<uint64_t>(FRAME_SIZE - 1);
+
+  // The program already checked these, but the frame is all we trust.
+  bool is_dns_over_udp = length >= PAYLOAD_OFFSET && read_u16(frame + 12) == 0x0800 &&
+                         frame[IPV4_OFFSET] == 0x45 && frame[IPV4_OFFSET + 9] == IPPROTO_UDP &&
+                         read_u16(frame + UDP_OFFSET + 2) == DNS_PORT;
+  size_t udp_length = is_dns_over_udp ? read_u16(frame + UDP_OFFSET + 4) : 0;
+  if (!is_dns_over_udp || udp_length < UDP_HEADER_SIZE || UDP_OFFSET + udp_length > length) {
+    this->free_frames.push_back(frame_base);
+    return;
+  }
+
+  sockaddr_in client = {};
+  client.sin_family = AF_INET;
+  std::memcpy(&client.sin_addr.s_addr, frame + IPV4_OFFSET + 12, 4);
+  std::memcpy(&client.sin_port, frame + UDP_OFFSET, 2);
+
+  // Longer datagrams are cut to BUFFER_SIZE, the same as recvfrom would.
+  int payload_size = udp_length - UDP_HEADER_SIZE;
+  if (payload_size > BUFFER_SIZE) {
+    payload_size = BUFFER_SIZE;
+  }
+  auto result = this->handler.admit_query(reinterpret_cast<char *>(frame + PAYLOAD_OFFSET),
+                                          payload_size, client);
+
+  if (result.disposition == QueryDisposition::Respond) {
+    if (!queue_reply_in_place(address, result.response)) {
+      send_through_socket(client, result.response);
+      this->free_frames.push_back(frame_base);
+    }
+    return;
+  }
+
+  this->free_frames.push_back(frame_base);
+  if (result.disposition == QueryDisposition::Forward) {
+    dispatch(result, client);
+  }
+}
+
+bool XdpBackend::queue_reply_in_place(uint64_t address, const std::vector<unsigned char> &response) {
+  uint64_t frame_end = (address & ~static_cast<uint64_t>(FRAME_SIZE - 1)) + FRAME_SIZE;
+  if (address + PAYLOAD_OFFSET + response.size() > frame_end) {
+    return false;
+  }
+
+  uint32_t producer = *this->tx.producer;
+  uint32_t consumer = __atomic_load_n(this->tx.consumer, __ATOMIC_ACQUIRE);
+  if (producer - consumer >= XSK_RING_SIZE) {
+    return false;
+  }
+
+  unsigned char *frame = this->umem + address;
+  unsigned char swap[6];
+
+  // Ethernet: swap the MAC addresses.
+  std::memcpy(swap, frame, 6);
+  std::memcpy(frame, frame + 6, 6);
+  std::memcpy(frame + 6, swap, 6);
+
+  // IPv4: swap the addresses, fix the length, recompute the checksum.
+  unsigned char *ip = frame + IPV4_OFFSET;
+  std::memcpy(swap, ip + 12, 4);
+  std::memcpy(ip + 12, ip + 16, 4);
+  std::memcpy(ip + 16, swap, 4);
+  write_u16(ip + 2, IPV4_HEADER_SIZE + UDP_HEADER_SIZE + response.size());
+  write_u16(ip + 4, 0);
+  write_u16(ip + 6, 0x4000);  // DF, no fragments
+  ip[8] = 64;
+  write_u16(ip + 10, 0);
+  write_u16(ip + 10, ipv4_checksum(ip));
+
+  // UDP: swap the ports, fix the length. A zero checksum means "none".
+  unsigned char *udp = frame + UDP_OFFSET;
+  std::memcpy(swap, udp, 2);
+  std::memcpy(udp, udp + 2, 2);
+  std::memcpy(udp + 2, swap, 2);
+  write_u16(udp + 4, UDP_HEADER_SIZE + response.size());
+  write_u16(udp + 6, 0);
+
+  // DNS payload.
+  std::memcpy(frame + PAYLOAD_OFFSET, response.data(), response.size());
+
+  auto *descriptors = static_cast<xdp_desc *>(this->tx.descriptors);
+  xdp_desc &descriptor = descriptors[producer & this->tx.mask];
+  descriptor.addr = address;
+  descriptor.len = PAYLOAD_OFFSET + response.size();
+  descriptor.options = 0;
+  __atomic_store_n(this->tx.producer, producer + 1, __ATOMIC_RELEASE);
+  this->tx_pending = true;
+  return true;
+}
+
+void XdpBackend::send_through_socket(const sockaddr_in &client, const std::vector<unsigned char> &response) {
+  if (sendto(this->fallback_socket, response.data(), response.size(), 0,
+             reinterpret_cast<const sockaddr *>(&client), sizeof(client)) == -1) {
+    perror("Failed to send response");
+  }
+}
+
+void XdpBackend::handle_fallback_socket() {
+  char buffer[BUFFER_SIZE];
+  sockaddr_in client;
+  socklen_t client_length = sizeof(client);
+
+  while (true) {
+    int bytes_read = recvfrom(this->fallback_socket, buffer, sizeof(buffer), MSG_DONTWAIT,
+                              reinterpret_cast<sockaddr *>(&client), &client_length);
+    if (bytes_read == -1) {
+      return;
+    }
+
+    auto result = this->handler.admit_query(buffer, bytes_read, client);
+    if (result.disposition == QueryDisposition::Respond) {
+      send_through_socket(client, result.response);
+    } else if (result.disposition == QueryDisposition::Forward) {
+      dispatch(result, client);
+    }
+  }
+}
+
+// Hands a Forward result to the forwarding threads, or drops it if they're
+// that far behind.
+void XdpBackend::dispatch(QueryResult &result, const sockaddr_in &client) {
+  size_t admission_cost = result.admission_cost;
+  ForwardedQuery query{std::move(result), client, now_ms()};
+  if (!this->forward_queue.try_push(query)) {
+    this->handler.release_upstream_slot(client, admission_cost);
+    return;
+  }
+  this->work_signal.fetch_add(1);
+  if (this->idle_forwarders.load() > 0) {
+    this->work_signal.notify_one();
+  }
+}
+
+// ============================================================================
+// XdpBackend Forwarding Threads
+// ============================================================================
+
+void XdpBackend::run_forward_thread() {
+  ForwardedQuery query;
+  while (!this->stopping.load(std::memory_order_relaxed)) {
+    if (this->forward_queue.try_pop(&query)) {
+      forward(query);
+      continue;
+    }
+
+    // Read the signal, then look once more: a query queued after this look
+    // has bumped the signal, so the wait returns straight away.
+    uint32_t seen = this->work_signal.load();
+    if (this->forward_queue.try_pop(&query)) {
+      forward(query);
+      continue;
+    }
+    this->idle_forwarders.fetch_add(1);
+    this->work_signal.wait(seen);
+    this->idle_forwarders.fetch_sub(1);
+  }
+}
+
+void XdpBackend::forward(ForwardedQuery &query) {
+  // Too stale to be worth answering; the client has retried by now.
+  if (this->handler.record_queue_delay(now_ms() - query.received_ms)) {
+    auto reply = this->handler.forward_query(query.result);
+    if (this->handler.limit_response(query.client, &reply)) {
+      send_through_socket(query.client, reply);
+    }
+    this->handler.cache_relayed_reply(query.result);
+  }
+  this->handler.release_upstream_slot(query.client, query.result.admission_cost);
+}
+
+// ============================================================================
+// XdpBackend Event Loop
+// ============================================================================
+
+void XdpBackend::run() {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < this->forward_threads; i++) {
+    threads.emplace_back(&XdpBackend::run_forward_thread, this);
+  }
+  refill();
+
+  pollfd poll_fds[2] = {
+      {this->xsk_fd, POLLIN, 0},
+      {this->fallback_socket, POLLIN, 0},
+  };
+
+  while (!shutdown_requested()) {
+    int ready = poll(poll_fds, 2, 100);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll failed");
+      break;
+    }
+
+    reclaim_completions();
+    if (ready > 0 && (poll_fds[0].revents & POLLIN) != 0) {
+      receive_frames();
+    }
+    if (ready > 0 && (poll_fds[1].revents & POLLIN) != 0) {
+      handle_fallback_socket();
+    }
+    refill();
+    this->handler.tick();
+  }
+
+  this->stopping.store(true);
+  this->work_signal.fetch_add(1);
+  this->work_signal.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Queries nobody got to still hold their slots.
+  ForwardedQuery query;
+  while (this->forward_queue.try_pop(&query)) {
+    this->handler.release_upstream_slot(query.client, query.result.admission_cost);
+  }
+}
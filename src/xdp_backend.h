@@ -0,0 +1,103 @@
+#pragma once
+
+#include "mpmc_queue.h"
+#include "query_handler.h"
+#include "server_options.h"
+#include <netinet/in.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// AF_XDP fast path. An XDP program on the interface redirects IPv4 UDP
+// packets for port 2053 into an AF_XDP socket; everything else (IP options,
+// fragments, other traffic) is passed to the kernel stack as usual. Queries
+// are parsed straight out of the UMEM frame and, when they can be answered
+// locally, the reply is built in the same frame by swapping the addresses and
+// ports and rewriting the DNS payload.
+//
+// Queries that need upstream work go over a bounded queue to a pool of
+// forwarding threads (--resolver-threads of them), which wait on upstream and
+// answer through the normal UDP socket, so a cache miss never stalls the ring.
+// The same loop keeps serving that socket for traffic the XDP program passes
+// on. Generic (SKB) mode is the default so this runs on any driver, veth
+// included.
+class XdpBackend {
+private:
+  // A Forward result waiting for a forwarding thread.
+  struct ForwardedQuery {
+    QueryResult result;
+    sockaddr_in client;
+    // When it was admitted, for the queueing delay.
+    int64_t received_ms;
+  };
+
+  // One of the four AF_XDP rings mapped from the kernel.
+  struct XskRing {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descriptors;
+    uint32_t mask;
+    void *map;
+    size_t map_size;
+  };
+
+  QueryHandler &handler;
+  int fallback_socket;
+  std::string interface_name;
+  int interface_index;
+  int queue_id;
+  bool native_mode;
+
+  int map_fd;
+  int program_fd;
+  bool attached;
+  int xsk_fd;
+
+  unsigned char *umem;
+  size_t umem_size;
+  XskRing rx;
+  XskRing tx;
+  XskRing fill;
+  XskRing completion;
+  std::vector<uint64_t> free_frames;
+  bool tx_pending;
+
+  MpmcQueue<ForwardedQuery> forward_queue;
+  int forward_threads;
+  // Bumped for every queued query; idle forwarding threads wait on it.
+  std::atomic<uint32_t> work_signal;
+  std::atomic<int> idle_forwarders;
+  std::atomic<bool> stopping;
+
+  void load_program();
+  void set_interface_program(int program_fd);
+  void setup_socket();
+  void map_ring(XskRing &ring, int ring_size, uint64_t page_offset, size_t descriptor_size,
+                uint64_t producer, uint64_t consumer, uint64_t descriptors, uint64_t flags);
+  void release_resources();
+
+  void refill();
+  void reclaim_completions();
+  void receive_frames();
+  void handle_frame(uint64_t address, uint32_t length);
+  bool queue_reply_in_place(uint64_t address, const std::vector<unsigned char> &response);
+  void send_through_socket(const sockaddr_in &client, const std::vector<unsigned char> &response);
+  void handle_fallback_socket();
+  void dispatch(QueryResult &result, const sockaddr_in &client);
+
+  void run_forward_thread();
+  void forward(ForwardedQuery &query);
+
+public:
+  XdpBackend(int fallback_socket, QueryHandler &handler, const ServerOptions &options);
+  ~XdpBackend();
+
+  XdpBackend(const XdpBackend &) = delete;
+  XdpBackend &operator=(const XdpBackend &) = delete;
+
+  // Runs until shutdown is requested. The destructor detaches the program.
+  void run();
+};
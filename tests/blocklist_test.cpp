@@ -0,0 +1,185 @@
+// Blocklist compilation, images and matching.
+
+#include "../src/blocklist.h"
+#include "test_support.h"
+#include <iterator>
+
+static BlocklistMatch match(const Blocklist &blocklist, const std::string &name) {
+  return blocklist.match(make_name(name));
+}
+
+static std::vector<unsigned char> read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const std::vector<unsigned char> &bytes) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+static uint32_t read_u32(const std::vector<unsigned char> &bytes, size_t offset) {
+  return static_cast<uint32_t>(bytes[offset]) << 24 | bytes[offset + 1] << 16 | bytes[offset + 2] << 8 |
+         bytes[offset + 3];
+}
+
+// A wildcard covers everything below its domain but not the domain itself.
+static void test_exact_and_wildcard() {
+  TempFile source("ads.example.com\n"
+                  "*.tracker.net\n"
+                  "*.both.org\n"
+                  "both.org\n"
+                  "Mixed.Case.TEST.\n");
+  auto blocklist = Blocklist::load(source.get_path());
+  CHECK(blocklist.get_entry_count() == 5);
+
+  CHECK(match(blocklist, "ads.example.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "ADS.Example.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "example.com") == BlocklistMatch::None);
+  CHECK(match(blocklist, "www.ads.example.com") == BlocklistMatch::None);
+
+  CHECK(match(blocklist, "tracker.net") == BlocklistMatch::None);
+  CHECK(match(blocklist, "a.tracker.net") == BlocklistMatch::Wildcard);
+  CHECK(match(blocklist, "a.b.tracker.net") == BlocklistMatch::Wildcard);
+  CHECK(match(blocklist, "nottracker.net") == BlocklistMatch::None);
+
+  CHECK(match(blocklist, "both.org") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "www.both.org") == BlocklistMatch::Wildcard);
+
+  CHECK(match(blocklist, "mixed.case.test") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "com") == BlocklistMatch::None);
+  CHECK(match(blocklist, ".") == BlocklistMatch::None);
+}
+
+// Listing a name twice changes nothing but the entry count, and names that
+// are prefixes of each other, by label or by bytes, stay distinct.
+static void test_duplicates_and_prefixes() {
+  TempFile once("ads.example.com\n");
+  TempFile twice("ads.example.com\nads.example.com\nADS.EXAMPLE.COM.\n");
+  auto single_image = Blocklist::compile(once.get_path());
+  auto duplicate_image = Blocklist::compile(twice.get_path());
+  CHECK(single_image.size() == duplicate_image.size());
+  CHECK(std::equal(single_image.begin() + 12, single_image.end(), duplicate_image.begin() + 12));
+  auto duplicates = Blocklist::load(twice.get_path());
+  CHECK(duplicates.get_entry_count() == 3);
+  CHECK(match(duplicates, "ads.example.com") == BlocklistMatch::Exact);
+
+  TempFile prefixes("example.com\n"
+                    "a.b.example.com\n"
+                    "ad.com\n"
+                    "adserver.com\n");
+  auto blocklist = Blocklist::load(prefixes.get_path());
+  CHECK(match(blocklist, "example.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "a.b.example.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "b.example.com") == BlocklistMatch::None);
+  CHECK(match(blocklist, "x.a.b.example.com") == BlocklistMatch::None);
+  CHECK(match(blocklist, "ad.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "adserver.com") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "ads.com") == BlocklistMatch::None);
+  CHECK(match(blocklist, "a.com") == BlocklistMatch::None);
+}
+
+// Hosts-file lines contribute every name after the address, except the
+// single-label ones like localhost.
+static void test_hosts_lines() {
+  TempFile source("# a hosts file\n"
+                  "127.0.0.1 localhost\n"
+                  "::1 localhost ip6-localhost\n"
+                  "0.0.0.0 ads.hosts.test tracker.hosts.test # trailing comment\n"
+                  "\n"
+                  "   \n"
+                  "plain.hosts.test\n");
+  auto blocklist = Blocklist::load(source.get_path());
+  CHECK(blocklist.get_entry_count() == 3);
+  CHECK(match(blocklist, "localhost") == BlocklistMatch::None);
+  CHECK(match(blocklist, "ip6-localhost") == BlocklistMatch::None);
+  CHECK(match(blocklist, "ads.hosts.test") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "tracker.hosts.test") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "plain.hosts.test") == BlocklistMatch::Exact);
+  CHECK(match(blocklist, "0.0.0.0") == BlocklistMatch::None);
+
+  TempFile bad("fine.test\nbad..name.test\n");
+  CHECK(throws_runtime_error([&] { Blocklist::compile(bad.get_path()); }, ":2:"));
+  TempFile single_label("localhost\n");
+  CHECK(Blocklist::load(single_label.get_path()).get_entry_count() == 1);
+}
+
+// The image compile_file writes maps back in and matches like the text.
+static void test_image_round_trip() {
+  TempFile source("ads.example.com\n*.tracker.net\n0.0.0.0 hosts.example.org\n");
+  TempFile image;
+  CHECK(Blocklist::compile_file(source.get_path(), image.get_path()) == 3);
+
+  auto compiled = Blocklist::load(source.get_path());
+  auto mapped = Blocklist::load(image.get_path());
+  CHECK(mapped.get_entry_count() == 3);
+  CHECK(mapped.get_image_size() == read_file(image.get_path()).size());
+  CHECK(read_file(image.get_path()) == Blocklist::compile(source.get_path()));
+  std::vector<std::string> names = {"ads.example.com", "example.com",       "tracker.net",
+                                    "x.tracker.net",   "hosts.example.org", "www.hosts.example.org"};
+  for (const auto &name : names) {
+    CHECK(mapped.match(make_name(name)) == compiled.match(make_name(name)));
+  }
+  CHECK(match(mapped, "x.tracker.net") == BlocklistMatch::Wildcard);
+
+  // Still usable after a move.
+  Blocklist moved = std::move(mapped);
+  CHECK(match(moved, "ads.example.com") == BlocklistMatch::Exact);
+}
+
+// attach refuses an image whose header or offsets don't add up, and load
+// says so rather than mapping it.
+static void test_corrupted_images() {
+  TempFile source("ads.example.com\n*.tracker.net\n");
+  auto image = Blocklist::compile(source.get_path());
+  uint32_t node_count = read_u32(image, 12);
+  uint32_t edge_count = read_u32(image, 16);
+  size_t edges = 28 + node_count * 8;
+  size_t labels = edges + edge_count * 8;
+
+  auto rejects = [](std::vector<unsigned char> corrupted) {
+    TempFile file;
+    write_file(file.get_path(), corrupted);
+    return throws_runtime_error([&] { Blocklist::load(file.get_path()); }, "malformed");
+  };
+
+  auto truncated = image;
+  truncated.pop_back();
+  CHECK(rejects(truncated));
+
+  auto wrong_version = image;
+  wrong_version[7] ^= 0xFF;
+  CHECK(rejects(wrong_version));
+
+  auto bad_root = image;
+  bad_root[27] = node_count;
+  CHECK(rejects(bad_root));
+
+  auto bad_child = image;
+  bad_child[edges + 4] = 0xFF;
+  CHECK(rejects(bad_child));
+
+  auto bad_label_offset = image;
+  bad_label_offset[edges] = 0xFF;
+  CHECK(rejects(bad_label_offset));
+
+  auto bad_label_size = image;
+  bad_label_size[labels] = 0;
+  CHECK(rejects(bad_label_size));
+
+  auto too_many_edges = image;
+  too_many_edges[28 + 7] = edge_count + 1;
+  CHECK(rejects(too_many_edges));
+
+  // The untouched image still loads.
+  CHECK(!rejects(image));
+}
+
+int main() {
+  test_exact_and_wildcard();
+  test_duplicates_and_prefixes();
+  test_hosts_lines();
+  test_image_round_trip();
+  test_corrupted_images();
+  return finish_tests();
+}
@@ -0,0 +1,222 @@
+// Stand-in authoritative servers for resolver tests. Each zone is served over
+// UDP from its own loopback address, all on one port, so a Resolver started
+// with matching root hints and --nameserver-port walks them like the real
+// hierarchy: referrals from a parent, answers from the zone itself.
+
+#pragma once
+
+#include "test_support.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+
+class FakeAuthority {
+private:
+  // How often the serving thread checks whether it should stop.
+  static constexpr int POLL_INTERVAL_MS = 50;
+
+  struct Zone {
+    std::string address;
+    WireName apex;
+    // Everything the server answers from: the zone's own records, NS records
+    // for the zones it delegates, and whatever glue it hands out with them,
+    // in bailiwick or not.
+    std::vector<Answer> records;
+    int socket_fd = -1;
+    std::atomic<int> queries{0};
+  };
+
+  std::vector<std::unique_ptr<Zone>> zones;
+  uint16_t port = 0;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+
+  static std::vector<Answer> select(const std::vector<Answer> &records, const WireName &name, uint16_t type) {
+    std::vector<Answer> selected;
+    for (const auto &record : records) {
+      if (record.get_domain_name() == name && record.get_type_code() == type) {
+        selected.push_back(record);
+      }
+    }
+    return selected;
+  }
+
+  // A referral for the deepest delegation covering the name, an answer, a
+  // CNAME, or NODATA/NXDOMAIN with the zone's SOA.
+  static std::vector<unsigned char> respond(const Zone &zone, const char *query, int size) {
+    auto packet = DNSPacket(query, size);
+    const auto &question = packet.get_question_section().front();
+    const auto &name = question.get_domain_name();
+    auto ns_type = static_cast<uint16_t>(RecordType::NS);
+    auto soa = select(zone.records, zone.apex, static_cast<uint16_t>(RecordType::SOA));
+
+    std::vector<Answer> answer, authority, additional;
+    bool authoritative = true;
+    unsigned char response_code = 0;
+
+    const Answer *delegation = nullptr;
+    for (const auto &record : zone.records) {
+      if (record.get_type_code() == ns_type && !(record.get_domain_name() == zone.apex) &&
+          name.is_subdomain_of(record.get_domain_name()) &&
+          (delegation == nullptr ||
+           record.get_domain_name().get_label_count() > delegation->get_domain_name().get_label_count())) {
+        delegation = &record;
+      }
+    }
+
+    if (delegation != nullptr) {
+      authoritative = false;
+      authority = select(zone.records, delegation->get_domain_name(), ns_type);
+      for (const auto &record : authority) {
+        WireName nameserver;
+        record.as<RecordType::NS>(&nameserver);
+        auto glue = select(zone.records, nameserver, static_cast<uint16_t>(RecordType::A));
+        additional.insert(additional.end(), glue.begin(), glue.end());
+      }
+    } else {
+      answer = select(zone.records, name, question.get_type_code());
+      if (answer.empty()) {
+        answer = select(zone.records, name, static_cast<uint16_t>(RecordType::CNAME));
+      }
+      if (answer.empty()) {
+        bool name_exists = false;
+        for (const auto &record : zone.records) {
+          name_exists = name_exists || record.get_domain_name() == name;
+        }
+        response_code = name_exists ? 0 : 3;
+        authority = soa;
+      }
+    }
+
+    auto bytes = reinterpret_cast<const unsigned char *>(query);
+    unsigned char flags = 0x80 | (authoritative ? 0x04 : 0) | (bytes[2] & RECURSION_DESIRED_FLAG);
+    // Every section holds well under 256 records, so the high count bytes stay zero.
+    std::vector<unsigned char> reply = {bytes[0], bytes[1], flags, response_code, 0, 1};
+    for (const auto *section : {&answer, &authority, &additional}) {
+      reply.push_back(0);
+      reply.push_back(static_cast<unsigned char>(section->size()));
+    }
+    question.add_question_into_return_packet(&reply);
+    for (const auto *section : {&answer, &authority, &additional}) {
+      for (const auto &record : *section) {
+        record.add_answer_into_return_packet(&reply);
+      }
+    }
+    return reply;
+  }
+
+  void serve() {
+    std::vector<pollfd> descriptors;
+    for (const auto &zone : this->zones) {
+      descriptors.push_back(pollfd{zone->socket_fd, POLLIN, 0});
+    }
+    while (!this->stopping) {
+      if (poll(descriptors.data(), descriptors.size(), POLL_INTERVAL_MS) <= 0) {
+        continue;
+      }
+      for (size_t i = 0; i < descriptors.size(); i++) {
+        if ((descriptors[i].revents & POLLIN) == 0) {
+          continue;
+        }
+        char buffer[BUFFER_SIZE];
+        sockaddr_in client = {};
+        socklen_t client_size = sizeof(client);
+        auto size = recvfrom(descriptors[i].fd, buffer, sizeof(buffer), 0,
+                             reinterpret_cast<sockaddr *>(&client), &client_size);
+        if (size <= 0 ||
+            validate_query(reinterpret_cast<unsigned char *>(buffer), size) != PacketVerdict::Valid) {
+          continue;
+        }
+        this->zones[i]->queries++;
+        auto reply = respond(*this->zones[i], buffer, size);
+        sendto(descriptors[i].fd, reply.data(), reply.size(), 0, reinterpret_cast<sockaddr *>(&client),
+               client_size);
+      }
+    }
+  }
+
+  Zone *find(const std::string &address) const {
+    for (const auto &zone : this->zones) {
+      if (zone->address == address) {
+        return zone.get();
+      }
+    }
+    throw std::runtime_error("No fake zone at " + address);
+  }
+
+public:
+  FakeAuthority() = default;
+  FakeAuthority(const FakeAuthority &) = delete;
+  FakeAuthority &operator=(const FakeAuthority &) = delete;
+
+  ~FakeAuthority() {
+    this->stopping = true;
+    if (this->thread.joinable()) {
+      this->thread.join();
+    }
+    for (const auto &zone : this->zones) {
+      if (zone->socket_fd != -1) {
+        close(zone->socket_fd);
+      }
+    }
+  }
+
+  // Serves `apex` from `address`, a 127.0.0.0/8 address of its own. Call
+  // before start.
+  void add_zone(const std::string &address, const std::string &apex, std::vector<Answer> records) {
+    auto zone = std::make_unique<Zone>();
+    zone->address = address;
+    zone->apex = make_name(apex);
+    zone->records = std::move(records);
+    this->zones.push_back(std::move(zone));
+  }
+
+  // Binds every zone's address on one free port and starts answering.
+  // Throws std::runtime_error if an address can't be bound.
+  void start() {
+    for (const auto &zone : this->zones) {
+      zone->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_port = htons(this->port);
+      inet_pton(AF_INET, zone->address.c_str(), &address.sin_addr);
+      if (zone->socket_fd == -1 ||
+          bind(zone->socket_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        throw std::runtime_error("Couldn't bind a fake zone to " + zone->address);
+      }
+      // The first bind picks the port the rest share.
+      socklen_t address_size = sizeof(address);
+      getsockname(zone->socket_fd, reinterpret_cast<sockaddr *>(&address), &address_size);
+      this->port = ntohs(address.sin_port);
+    }
+    this->thread = std::thread([this] { serve(); });
+  }
+
+  uint16_t get_port() const { return this->port; }
+
+  // Queries the zone at `address` has answered so far.
+  int get_query_count(const std::string &address) const { return find(address)->queries; }
+};
+
+// Record builders for fake zones, class IN.
+inline Answer make_a(const std::string &name, RecordCodec<RecordType::A>::Value address,
+                     uint32_t ttl = 3600) {
+  return Answer::make<RecordType::A>(make_name(name), 1, ttl, address);
+}
+
+inline Answer make_ns(const std::string &zone, const std::string &nameserver, uint32_t ttl = 3600) {
+  return Answer::make<RecordType::NS>(make_name(zone), 1, ttl, make_name(nameserver));
+}
+
+inline Answer make_cname(const std::string &name, const std::string &target, uint32_t ttl = 3600) {
+  return Answer::make<RecordType::CNAME>(make_name(name), 1, ttl, make_name(target));
+}
+
+inline Answer make_soa(const std::string &zone, uint32_t minimum = 300) {
+  SoaData soa = {make_name("ns." + zone), make_name("admin." + zone), 1, 3600, 600, 86400, minimum};
+  return Answer::make<RecordType::SOA>(make_name(zone), 1, 3600, soa);
+}
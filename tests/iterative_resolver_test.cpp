@@ -0,0 +1,142 @@
+// Iterative resolution against a fake hierarchy on loopback: the root, com
+// and net, and the zones below them.
+
+#include "../src/query_handler.h"
+#include "fake_authority.h"
+#include "test_support.h"
+
+const std::string ROOT = "127.0.0.2";
+const std::string COM = "127.0.0.3";
+const std::string EXAMPLE = "127.0.0.4";
+const std::string NET = "127.0.0.5";
+const std::string HOSTER = "127.0.0.6";
+const std::string VICTIM = "127.0.0.7";
+// Claims victim.com through glue the com servers have no business giving.
+const std::string POISONED = "127.0.0.66";
+
+static void add_zones(FakeAuthority &authority) {
+  authority.add_zone(ROOT, ".",
+                     {make_ns("com", "ns.com-servers.com"), make_a("ns.com-servers.com", {127, 0, 0, 3}),
+                      make_ns("net", "ns.net-servers.net"), make_a("ns.net-servers.net", {127, 0, 0, 5})});
+  authority.add_zone(COM, "com",
+                     {make_soa("com"), make_ns("example.com", "ns1.example.com"),
+                      make_a("ns1.example.com", {127, 0, 0, 4}),
+                      // victim.com is served from under net, so this glue
+                      // is out of the com zone's bailiwick.
+                      make_ns("victim.com", "dns.hoster.net"), make_a("dns.hoster.net", {127, 0, 0, 66})});
+  authority.add_zone(EXAMPLE, "example.com",
+                     {make_soa("example.com"), make_a("www.example.com", {10, 0, 0, 1}),
+                      make_cname("alias.example.com", "www.hoster.net")});
+  authority.add_zone(NET, "net",
+                     {make_soa("net"), make_ns("hoster.net", "ns.hoster.net"),
+                      make_a("ns.hoster.net", {127, 0, 0, 6})});
+  authority.add_zone(HOSTER, "hoster.net",
+                     {make_soa("hoster.net"), make_a("ns.hoster.net", {127, 0, 0, 6}),
+                      make_a("dns.hoster.net", {127, 0, 0, 7}), make_a("www.hoster.net", {10, 0, 0, 2})});
+  authority.add_zone(VICTIM, "victim.com",
+                     {make_soa("victim.com"), make_a("www.victim.com", {10, 0, 0, 3})});
+  authority.add_zone(POISONED, "victim.com",
+                     {make_soa("victim.com"), make_a("www.victim.com", {6, 6, 6, 6})});
+}
+
+static DNSPacket resolve(QueryHandler &handler, const std::string &name) {
+  auto query = make_query(name, static_cast<uint16_t>(RecordType::A));
+  sockaddr_in client = {};
+  client.sin_family = AF_INET;
+  client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::vector<unsigned char> response;
+  handler.handle_query(reinterpret_cast<const char *>(query.data()), query.size(), client,
+                       [&](std::vector<unsigned char> &reply) { response = reply; });
+  if (response.empty()) {
+    throw std::runtime_error("No response for " + name);
+  }
+  return parse_reply(response);
+}
+
+static int total_queries(const FakeAuthority &authority) {
+  int total = 0;
+  for (const auto &address : {ROOT, COM, EXAMPLE, NET, HOSTER, VICTIM, POISONED}) {
+    total += authority.get_query_count(address);
+  }
+  return total;
+}
+
+// Root to com to example.com, then straight from the cache.
+static void test_referrals(QueryHandler &handler, FakeAuthority &authority) {
+  auto reply = resolve(handler, "www.example.com");
+  CHECK(reply.get_response_code() == 0);
+  CHECK(addresses_in(reply.get_answer_section(), "www.example.com") == std::vector<std::string>{"10.0.0.1"});
+  CHECK(authority.get_query_count(ROOT) == 1);
+  CHECK(authority.get_query_count(COM) == 1);
+  CHECK(authority.get_query_count(EXAMPLE) == 1);
+
+  int before = total_queries(authority);
+  reply = resolve(handler, "www.example.com");
+  CHECK(addresses_in(reply.get_answer_section(), "www.example.com") == std::vector<std::string>{"10.0.0.1"});
+  CHECK(total_queries(authority) == before);
+}
+
+// com's glue for dns.hoster.net is ignored: the address comes from hoster.net
+// itself, by way of net.
+static void test_out_of_bailiwick_glue(QueryHandler &handler, FakeAuthority &authority) {
+  auto reply = resolve(handler, "www.victim.com");
+  CHECK(reply.get_response_code() == 0);
+  CHECK(addresses_in(reply.get_answer_section(), "www.victim.com") == std::vector<std::string>{"10.0.0.3"});
+  CHECK(authority.get_query_count(POISONED) == 0);
+  CHECK(authority.get_query_count(NET) >= 1);
+  CHECK(authority.get_query_count(HOSTER) >= 1);
+  CHECK(authority.get_query_count(VICTIM) == 1);
+
+  reply = resolve(handler, "dns.hoster.net");
+  CHECK(addresses_in(reply.get_answer_section(), "dns.hoster.net") == std::vector<std::string>{"127.0.0.7"});
+}
+
+// The CNAME target is in another tree, so resolution starts again from the
+// closest cut we know for it.
+static void test_cname_out_of_zone(QueryHandler &handler) {
+  auto reply = resolve(handler, "alias.example.com");
+  CHECK(reply.get_response_code() == 0);
+  const auto &answers = reply.get_answer_section();
+  CHECK(answers.size() == 2);
+  WireName target;
+  CHECK(!answers.empty() && answers.front().as<RecordType::CNAME>(&target) &&
+        target == make_name("www.hoster.net"));
+  CHECK(addresses_in(answers, "www.hoster.net") == std::vector<std::string>{"10.0.0.2"});
+}
+
+// NXDOMAIN comes back with the zone's SOA, and is cached.
+static void test_nxdomain(QueryHandler &handler, FakeAuthority &authority) {
+  int before = authority.get_query_count(EXAMPLE);
+  auto reply = resolve(handler, "missing.example.com");
+  CHECK(reply.get_response_code() == 3);
+  CHECK(reply.get_answer_section().empty());
+  const auto &authority_section = reply.get_authority_section();
+  CHECK(authority_section.size() == 1);
+  CHECK(!authority_section.empty() &&
+        authority_section.front().get_type_code() == static_cast<uint16_t>(RecordType::SOA) &&
+        authority_section.front().get_domain_name() == make_name("example.com"));
+  CHECK(authority.get_query_count(EXAMPLE) == before + 1);
+
+  reply = resolve(handler, "missing.example.com");
+  CHECK(reply.get_response_code() == 3);
+  CHECK(authority.get_query_count(EXAMPLE) == before + 1);
+}
+
+int main() {
+  FakeAuthority authority;
+  add_zones(authority);
+  authority.start();
+
+  TempFile hints(". 3600000 NS a.root-servers.test.\n"
+                 "a.root-servers.test. 3600000 A " + ROOT + "\n");
+  ServerOptions options;
+  options.root_hints = hints.get_path();
+  options.nameserver_port = authority.get_port();
+  QueryHandler handler(options);
+
+  test_referrals(handler, authority);
+  test_out_of_bailiwick_glue(handler, authority);
+  test_cname_out_of_zone(handler);
+  test_nxdomain(handler, authority);
+  return finish_tests();
+}
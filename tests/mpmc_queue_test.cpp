@@ -0,0 +1,125 @@
+// MpmcQueue at its limits and under contention.
+
+#include "../src/mpmc_queue.h"
+#include "test_support.h"
+#include <thread>
+
+// Producers and consumers in the stress test, and what each producer pushes.
+const int STRESS_THREADS = 4;
+const uint64_t ITEMS_PER_PRODUCER = 200000;
+// Small, so producers keep finding it full and consumers empty.
+const size_t STRESS_CAPACITY = 64;
+
+static void test_capacity() {
+  bool rejected = false;
+  try {
+    MpmcQueue<int> queue(6);
+  } catch (const std::invalid_argument &) {
+    rejected = true;
+  }
+  CHECK(rejected);
+
+  MpmcQueue<int> queue(8);
+  int value = -1;
+  CHECK(!queue.try_pop(&value));
+
+  // Several laps around the ring, filling it each time.
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 8; i++) {
+      int pushed = lap * 100 + i;
+      CHECK(queue.try_push(pushed));
+    }
+    int extra = 999;
+    CHECK(!queue.try_push(extra));
+    CHECK(extra == 999);
+
+    for (int i = 0; i < 8; i++) {
+      CHECK(queue.try_pop(&value));
+      CHECK(value == lap * 100 + i);
+    }
+    CHECK(!queue.try_pop(&value));
+  }
+
+  // A pop frees exactly one slot.
+  for (int i = 0; i < 8; i++) {
+    CHECK(queue.try_push(i));
+  }
+  CHECK(queue.try_pop(&value) && value == 0);
+  int last = 8;
+  CHECK(queue.try_push(last));
+  int full = 9;
+  CHECK(!queue.try_push(full));
+}
+
+// Values are moved in and out, not copied.
+static void test_move_only_values() {
+  MpmcQueue<std::unique_ptr<int>> queue(2);
+  auto pushed = std::make_unique<int>(42);
+  CHECK(queue.try_push(pushed));
+  CHECK(pushed == nullptr);
+  std::unique_ptr<int> popped;
+  CHECK(queue.try_pop(&popped) && popped != nullptr && *popped == 42);
+}
+
+// Every item arrives exactly once, and each consumer sees any one producer's
+// items in the order they were pushed.
+static void test_stress() {
+  MpmcQueue<uint64_t> queue(STRESS_CAPACITY);
+  const uint64_t total = STRESS_THREADS * ITEMS_PER_PRODUCER;
+  std::vector<std::atomic<uint8_t>> seen(total);
+  std::atomic<uint64_t> consumed{0};
+  std::atomic<int> order_violations{0};
+
+  std::vector<std::thread> threads;
+  for (int producer = 0; producer < STRESS_THREADS; producer++) {
+    threads.emplace_back([&, producer] {
+      for (uint64_t i = 0; i < ITEMS_PER_PRODUCER; i++) {
+        uint64_t item = static_cast<uint64_t>(producer) << 32 | i;
+        while (!queue.try_push(item)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int consumer = 0; consumer < STRESS_THREADS; consumer++) {
+    threads.emplace_back([&] {
+      std::vector<int64_t> last_seen(STRESS_THREADS, -1);
+      uint64_t item;
+      while (consumed.load() < total) {
+        if (!queue.try_pop(&item)) {
+          std::this_thread::yield();
+          continue;
+        }
+        uint64_t producer = item >> 32;
+        int64_t index = item & 0xFFFFFFFF;
+        if (producer >= STRESS_THREADS || index <= last_seen[producer]) {
+          order_violations++;
+          continue;
+        }
+        last_seen[producer] = index;
+        seen[producer * ITEMS_PER_PRODUCER + index]++;
+        consumed++;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  CHECK(order_violations == 0);
+  CHECK(consumed == total);
+  uint64_t exactly_once = 0;
+  for (const auto &count : seen) {
+    exactly_once += count == 1;
+  }
+  CHECK(exactly_once == total);
+  uint64_t leftover;
+  CHECK(!queue.try_pop(&leftover));
+}
+
+int main() {
+  test_capacity();
+  test_move_only_values();
+  test_stress();
+  return finish_tests();
+}
@@ -0,0 +1,157 @@
+// The pipeline backend end to end over loopback: queries in through an I/O
+// thread, answered on the resolution threads, replies back out.
+
+#include "../src/pipeline_backend.h"
+#include "../src/query_handler.h"
+#include "../src/shutdown.h"
+#include "test_support.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <map>
+#include <sys/socket.h>
+#include <thread>
+
+// Queries the smoke test sends, in rounds small enough that the replies to a
+// round fit in the client's socket buffer.
+const int SMOKE_QUERIES = 500;
+const int SMOKE_ROUND = 50;
+// Far below FORWARD_TIMEOUT_MS, which is how long the stuck thread is out.
+const int64_t STOLEN_REPLY_DEADLINE_MS = 500;
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A UDP socket on 127.0.0.1 with a port of its own.
+static int bind_loopback(uint16_t *port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    throw std::runtime_error("Couldn't bind a loopback socket");
+  }
+  socklen_t size = sizeof(address);
+  getsockname(fd, reinterpret_cast<sockaddr *>(&address), &size);
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+class Client {
+private:
+  int fd;
+  sockaddr_in server;
+
+public:
+  Client(uint16_t server_port) {
+    uint16_t port;
+    this->fd = bind_loopback(&port);
+    timeval timeout = {5, 0};
+    setsockopt(this->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    this->server = {};
+    this->server.sin_family = AF_INET;
+    this->server.sin_port = htons(server_port);
+    this->server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+  ~Client() { close(this->fd); }
+
+  void send(const std::string &name, uint16_t id) {
+    auto query = make_query(name, static_cast<uint16_t>(RecordType::A), id);
+    sendto(this->fd, query.data(), query.size(), 0, reinterpret_cast<sockaddr *>(&this->server),
+           sizeof(this->server));
+  }
+
+  // False if nothing came back in time.
+  bool receive(std::vector<unsigned char> *reply) {
+    reply->resize(BUFFER_SIZE);
+    ssize_t size = recv(this->fd, reply->data(), reply->size(), 0);
+    if (size <= 0) {
+      return false;
+    }
+    reply->resize(size);
+    return true;
+  }
+};
+
+// Bursts of queries, each answered from the zone with its own ID.
+static void test_answers_through_queues(Client &client) {
+  std::vector<bool> answered(SMOKE_QUERIES, false);
+  int good = 0;
+  std::vector<unsigned char> reply;
+  for (int round = 0; round < SMOKE_QUERIES; round += SMOKE_ROUND) {
+    for (int id = round; id < round + SMOKE_ROUND; id++) {
+      client.send("www.pipeline.test", id);
+    }
+    for (int i = 0; i < SMOKE_ROUND && client.receive(&reply); i++) {
+      auto packet = parse_reply(reply);
+      int id = packet.get_transaction_id();
+      auto addresses = addresses_in(packet.get_answer_section(), "www.pipeline.test");
+      if (id < SMOKE_QUERIES && !answered[id] && addresses == std::vector<std::string>{"192.0.2.1"}) {
+        answered[id] = true;
+        good++;
+      }
+    }
+  }
+  CHECK(good == SMOKE_QUERIES);
+}
+
+// One resolution thread is stuck on an upstream that never answers. Queries
+// queued behind it on its own queue are stolen by the idle one and answered
+// long before the stuck one returns.
+static void test_idle_threads_steal(Client &client) {
+  client.send("stuck.example", 1000);
+  // Let a resolution thread pick it up and block.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // Round-robin puts these on both resolution queues.
+  int64_t sent_ms = now_ms();
+  for (uint16_t id = 1001; id <= 1004; id++) {
+    client.send("www.pipeline.test", id);
+  }
+
+  std::map<int, int64_t> replied_ms;
+  std::vector<unsigned char> reply;
+  while (replied_ms.size() < 5 && client.receive(&reply)) {
+    replied_ms[parse_reply(reply).get_transaction_id()] = now_ms();
+  }
+  for (int id = 1001; id <= 1004; id++) {
+    CHECK(replied_ms.contains(id) && replied_ms[id] - sent_ms < STOLEN_REPLY_DEADLINE_MS);
+  }
+  // The stuck query still gets its SERVFAIL once the forward times out.
+  CHECK(replied_ms.contains(1000));
+}
+
+int main() {
+  // Forwarded queries go to a socket nobody reads.
+  uint16_t silent_port;
+  int silent_upstream = bind_loopback(&silent_port);
+
+  TempFile zone("www.pipeline.test 300 A 192.0.2.1\n");
+  ServerOptions options;
+  options.zone_file = zone.get_path();
+  options.resolver_ip = "127.0.0.1";
+  options.resolver_port = std::to_string(silent_port);
+  options.max_inflight_per_client = 0;
+  QueryHandler handler(options);
+
+  uint16_t server_port;
+  int listen_socket = bind_loopback(&server_port);
+  PipelineBackend backend({listen_socket}, handler, 2);
+  install_shutdown_handlers();
+  std::thread server([&] { backend.run(); });
+
+  {
+    Client client(server_port);
+    test_answers_through_queues(client);
+    test_idle_threads_steal(client);
+  }
+
+  kill(getpid(), SIGTERM);
+  server.join();
+  close(listen_socket);
+  close(silent_upstream);
+  return finish_tests();
+}
@@ -0,0 +1,162 @@
+// Response rate limiting: which responses share a bucket, and what a limited
+// client gets back.
+
+#include "../src/query_handler.h"
+#include "../src/rate_limiter.h"
+#include "fake_authority.h"
+#include "test_support.h"
+
+// Small, so a burst from one test runs through the bucket long before it
+// refills.
+const int RESPONSES_PER_SECOND = 2;
+const int SLIP = 2;
+// Queries in each flood.
+const int FLOOD_SIZE = 20;
+
+static sockaddr_in make_client(const std::string &address) {
+  sockaddr_in client = {};
+  client.sin_family = AF_INET;
+  inet_pton(AF_INET, address.c_str(), &client.sin_addr);
+  return client;
+}
+
+// A response to an A query for `name`, with `answer` and `authority`.
+static std::vector<unsigned char> make_response(const std::string &name, unsigned char response_code,
+                                                const std::vector<Answer> &answer,
+                                                const std::vector<Answer> &authority) {
+  auto reply = make_query(name, static_cast<uint16_t>(RecordType::A));
+  reply[2] |= RESPONSE_FLAG;
+  reply[3] = response_code;
+  reply[7] = answer.size();
+  reply[9] = authority.size();
+  for (const auto *section : {&answer, &authority}) {
+    for (const auto &record : *section) {
+      record.add_answer_into_return_packet(&reply);
+    }
+  }
+  return reply;
+}
+
+// Runs `responses` through a fresh limiter and counts how many it allows.
+static int count_allowed(const std::vector<std::vector<unsigned char>> &responses,
+                         const sockaddr_in &client = make_client("192.0.2.1")) {
+  RateLimiter limiter(RESPONSES_PER_SECOND, 0, 0);
+  int allowed = 0;
+  for (const auto &response : responses) {
+    allowed += limiter.check_response(client, response.data(), response.size()) == RateLimitAction::Allow;
+  }
+  return allowed;
+}
+
+// Denials under one zone share its bucket however the names vary; answers
+// are kept apart by name, and from the denials.
+static void test_keys() {
+  std::vector<std::vector<unsigned char>> nxdomain, nodata, answers, no_soa, errors;
+  for (int i = 0; i < FLOOD_SIZE; i++) {
+    std::string name = "r" + std::to_string(i) + ".example.com";
+    nxdomain.push_back(make_response(name, RCODE_NAME_ERROR, {}, {make_soa("example.com")}));
+    nodata.push_back(make_response(name, RCODE_NO_ERROR, {}, {make_soa("example.com")}));
+    answers.push_back(make_response(name, RCODE_NO_ERROR, {make_a(name, {10, 0, 0, 1})}, {}));
+    no_soa.push_back(make_response(name, RCODE_NAME_ERROR, {}, {}));
+    errors.push_back(make_response(name, RCODE_SERVER_FAILURE, {}, {}));
+  }
+  CHECK(count_allowed(nxdomain) == RESPONSES_PER_SECOND);
+  CHECK(count_allowed(nodata) == RESPONSES_PER_SECOND);
+  CHECK(count_allowed(answers) == FLOOD_SIZE);
+  CHECK(count_allowed(no_soa) == FLOOD_SIZE);
+  CHECK(count_allowed(errors) == RESPONSES_PER_SECOND);
+
+  // NXDOMAIN at the end of a CNAME chain is the target zone's denial.
+  std::vector<std::vector<unsigned char>> chained;
+  for (int i = 0; i < FLOOD_SIZE; i++) {
+    std::string name = "c" + std::to_string(i) + ".example.com";
+    chained.push_back(make_response(name, RCODE_NAME_ERROR, {make_cname(name, "r" + name + ".other.test")},
+                                    {make_soa("other.test")}));
+  }
+  CHECK(count_allowed(chained) == RESPONSES_PER_SECOND);
+
+  // Other zones, kinds and /24s draw on their own tokens.
+  RateLimiter limiter(RESPONSES_PER_SECOND, 0, 0);
+  auto client = make_client("192.0.2.1");
+  auto check = [&](const std::vector<unsigned char> &response, const sockaddr_in &from) {
+    return limiter.check_response(from, response.data(), response.size());
+  };
+  for (int i = 0; i < RESPONSES_PER_SECOND; i++) {
+    CHECK(check(nxdomain[i], client) == RateLimitAction::Allow);
+  }
+  CHECK(check(nxdomain.back(), client) == RateLimitAction::Drop);
+  CHECK(check(make_response("x.other.test", RCODE_NAME_ERROR, {}, {make_soa("other.test")}), client) ==
+        RateLimitAction::Allow);
+  CHECK(check(make_response("example.com", RCODE_NO_ERROR, {make_a("example.com", {10, 0, 0, 1})}, {}),
+              client) == RateLimitAction::Allow);
+  CHECK(check(nxdomain.back(), make_client("192.0.2.200")) == RateLimitAction::Drop);
+  CHECK(check(nxdomain.back(), make_client("192.0.3.1")) == RateLimitAction::Allow);
+}
+
+// A random-subdomain flood through the resolver: past the first few, the
+// NXDOMAINs are dropped or slipped as truncated replies, while answers from
+// the same zone still go out whole.
+static void test_random_subdomain_flood() {
+  FakeAuthority authority;
+  authority.add_zone("127.0.0.2", ".",
+                     {make_ns("example.com", "ns.example.com"), make_a("ns.example.com", {127, 0, 0, 3})});
+  authority.add_zone("127.0.0.3", "example.com",
+                     {make_soa("example.com"), make_a("www.example.com", {10, 0, 0, 1})});
+  authority.start();
+
+  TempFile hints(". 3600000 NS a.root-servers.test.\n"
+                 "a.root-servers.test. 3600000 A 127.0.0.2\n");
+  ServerOptions options;
+  options.root_hints = hints.get_path();
+  options.nameserver_port = authority.get_port();
+  options.rrl_responses_per_second = RESPONSES_PER_SECOND;
+  options.rrl_slip = SLIP;
+  QueryHandler handler(options);
+
+  auto client = make_client("127.0.0.1");
+  auto resolve = [&](const std::string &name, uint16_t id) {
+    auto query = make_query(name, static_cast<uint16_t>(RecordType::A), id);
+    std::vector<unsigned char> response;
+    handler.handle_query(reinterpret_cast<const char *>(query.data()), query.size(), client,
+                         [&](std::vector<unsigned char> &reply) { response = reply; });
+    return response;
+  };
+
+  int whole = 0, slipped = 0, dropped = 0;
+  for (int i = 0; i < FLOOD_SIZE; i++) {
+    std::string name = "r" + std::to_string(i) + ".example.com";
+    auto response = resolve(name, i);
+    if (response.empty()) {
+      dropped++;
+      continue;
+    }
+    auto reply = parse_reply(response);
+    CHECK(reply.get_transaction_id() == i);
+    if ((response[2] & TRUNCATION_FLAG) != 0) {
+      // Just the question, for the client to retry over TCP.
+      CHECK(reply.get_question_section().size() == 1 &&
+            reply.get_question_section().front().get_domain_name() == make_name(name));
+      CHECK(reply.get_answer_section().empty() && reply.get_authority_section().empty());
+      slipped++;
+    } else {
+      CHECK(reply.get_response_code() == RCODE_NAME_ERROR);
+      whole++;
+    }
+  }
+  // Every name reached the authority, but most denials never went out.
+  CHECK(authority.get_query_count("127.0.0.3") == FLOOD_SIZE);
+  CHECK(whole >= RESPONSES_PER_SECOND && whole <= RESPONSES_PER_SECOND + 1);
+  CHECK(slipped > 0 && dropped > 0);
+  CHECK(whole + slipped + dropped == FLOOD_SIZE);
+
+  auto answer = resolve("www.example.com", 1000);
+  CHECK(!answer.empty() &&
+        addresses_in(parse_reply(answer).get_answer_section(), "www.example.com") ==
+            std::vector<std::string>{"10.0.0.1"});
+}
+
+int main() {
+  test_keys();
+  test_random_subdomain_flood();
+  return finish_tests();
+}
@@ -0,0 +1,76 @@
+// Kernel receive timestamps measure how long a datagram sat before it was read.
+
+#include "../src/receive_timestamp.h"
+#include "test_support.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <thread>
+
+// How long the datagram is left in the socket buffer, and how far either side
+// of that the measured delay may land: the stamp and the sleep are on
+// different clocks, and a loaded machine oversleeps.
+const int64_t BUFFERED_MS = 100;
+const int64_t EARLY_MS = 10;
+const int64_t LATE_MS = 1000;
+
+// Reads one datagram from `fd` and returns its delay, -1 if unstamped.
+static int64_t receive_one(int fd) {
+  char buffer[64];
+  alignas(cmsghdr) char control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+  iovec payload = {buffer, sizeof(buffer)};
+  msghdr message = {};
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  if (recvmsg(fd, &message, 0) <= 0) {
+    throw std::runtime_error("Nothing received");
+  }
+  return receive_delay_ms(message);
+}
+
+int main() {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t size = sizeof(address);
+  if (fd == -1 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&address), &size) != 0) {
+    throw std::runtime_error("Couldn't bind a loopback socket");
+  }
+  auto send_one = [&] {
+    sendto(fd, "x", 1, 0, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+  };
+
+  // Unstamped until asked for.
+  send_one();
+  CHECK(receive_one(fd) == -1);
+
+  CHECK(enable_receive_timestamps(fd));
+  // Stamping on arrival starts a moment later; until then the kernel stamps
+  // datagrams as they're read.
+  bool stamped_on_arrival = false;
+  for (int attempt = 0; attempt < 100 && !stamped_on_arrival; attempt++) {
+    send_one();
+    std::this_thread::sleep_for(std::chrono::milliseconds(EARLY_MS));
+    stamped_on_arrival = receive_one(fd) > 0;
+  }
+  CHECK(stamped_on_arrival);
+
+  send_one();
+  std::this_thread::sleep_for(std::chrono::milliseconds(BUFFERED_MS));
+  int64_t delay_ms = receive_one(fd);
+  CHECK(delay_ms >= BUFFERED_MS - EARLY_MS && delay_ms < BUFFERED_MS + LATE_MS);
+
+  // Read straight away, it has hardly waited at all.
+  send_one();
+  CHECK(receive_one(fd) < BUFFERED_MS - EARLY_MS);
+
+  // A bad descriptor is refused, not ignored.
+  CHECK(!enable_receive_timestamps(-1));
+
+  close(fd);
+  return finish_tests();
+}
@@ -0,0 +1,129 @@
+// Shared helpers for the test executables. Each test is a plain program that
+// runs its checks, reports the ones that failed and exits non-zero if any did,
+// so CTest needs nothing more than the exit code.
+
+#pragma once
+
+#include "../src/answer.h"
+#include "../src/dns_packet.h"
+#include "../src/packet_validator.h"
+#include "../src/wire_name.h"
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+inline int test_failures = 0;
+
+// Records a failure and carries on, so one run reports every broken check.
+#define CHECK(condition)                                                                       \
+  do {                                                                                         \
+    if (!(condition)) {                                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+      test_failures++;                                                                         \
+    }                                                                                          \
+  } while (0)
+
+// True if `action` throws std::runtime_error with `expected` somewhere in its
+// message.
+template <typename Action>
+bool throws_runtime_error(Action action, const std::string &expected = "") {
+  try {
+    action();
+  } catch (const std::runtime_error &error) {
+    return std::string(error.what()).find(expected) != std::string::npos;
+  }
+  return false;
+}
+
+// What main returns once every check has run.
+inline int finish_tests() {
+  if (test_failures != 0) {
+    std::cerr << test_failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}
+
+// "www.example.com" as a wire name. "" and "." are the root.
+inline WireName make_name(const std::string &dotted) {
+  std::vector<unsigned char> bytes;
+  size_t start = 0;
+  while (start < dotted.size()) {
+    auto end = dotted.find('.', start);
+    if (end == std::string::npos) {
+      end = dotted.size();
+    }
+    if (end > start) {
+      bytes.push_back(static_cast<unsigned char>(end - start));
+      bytes.insert(bytes.end(), dotted.begin() + start, dotted.begin() + end);
+    }
+    start = end + 1;
+  }
+  bytes.push_back(0);
+  return WireName(bytes.data(), bytes.size());
+}
+
+// A query for one question, class IN.
+inline std::vector<unsigned char> make_query(const std::string &name, uint16_t type, uint16_t id = 0x1234,
+                                             bool recursion_desired = true) {
+  unsigned char flags = recursion_desired ? RECURSION_DESIRED_FLAG : 0;
+  // One question, no records.
+  unsigned char id_high = id >> 8;
+  unsigned char id_low = id & 0xFF;
+  std::vector<unsigned char> query = {id_high, id_low, flags, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+  make_name(name).add_name_into_return_packet(&query);
+  query.insert(query.end(), {static_cast<unsigned char>(type >> 8), static_cast<unsigned char>(type & 0xFF),
+                             0x00, 0x01});
+  return query;
+}
+
+// Parses a reply, failing the test rather than crashing on a bad one.
+inline DNSPacket parse_reply(const std::vector<unsigned char> &reply) {
+  if (reply.size() > BUFFER_SIZE ||
+      validate_packet(reply.data(), reply.size()) != PacketVerdict::Valid) {
+    throw std::runtime_error("Reply doesn't parse");
+  }
+  return DNSPacket(reinterpret_cast<const char *>(reply.data()), reply.size());
+}
+
+// The A records for `name` in a parsed section, as dotted quads.
+inline std::vector<std::string> addresses_in(const std::vector<Answer> &records, const std::string &name) {
+  std::vector<std::string> addresses;
+  for (const auto &record : records) {
+    RecordCodec<RecordType::A>::Value address;
+    if (record.get_domain_name() == make_name(name) && record.as<RecordType::A>(&address)) {
+      addresses.push_back(std::to_string(address[0]) + "." + std::to_string(address[1]) + "." +
+                          std::to_string(address[2]) + "." + std::to_string(address[3]));
+    }
+  }
+  return addresses;
+}
+
+// A file under /tmp holding `contents`, removed when this goes out of scope.
+class TempFile {
+private:
+  std::string path;
+
+public:
+  TempFile(const std::string &contents = "") {
+    char name[] = "/tmp/dns-server-test-XXXXXX";
+    int fd = mkstemp(name);
+    if (fd == -1) {
+      throw std::runtime_error("Couldn't create a temporary file");
+    }
+    close(fd);
+    this->path = name;
+    std::ofstream(this->path, std::ios::binary) << contents;
+  }
+  ~TempFile() { unlink(this->path.c_str()); }
+  TempFile(const TempFile &) = delete;
+  TempFile &operator=(const TempFile &) = delete;
+
+  const std::string &get_path() const { return this->path; }
+};
@@ -0,0 +1,357 @@
+// The XDP backend on a veth pair in generic (SKB) mode. The server side of the
+// pair stays here; the client side goes into a network namespace of its own,
+// so queries cross the pair and hit the XDP program like real traffic. Needs
+// root and iproute2, and is skipped without them.
+
+#include "../src/query_handler.h"
+#include "../src/shutdown.h"
+#include "../src/xdp_backend.h"
+#include "fake_authority.h"
+#include "test_support.h"
+#include <arpa/inet.h>
+#include <csignal>
+#include <fcntl.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <thread>
+
+// What CTest takes as "skipped" (SKIP_RETURN_CODE in CMakeLists.txt).
+const int SKIP_EXIT_CODE = 77;
+// TEST-NET-2, so nothing real is ever in the way.
+const std::string SERVER_ADDRESS = "198.51.100.1";
+const std::string CLIENT_ADDRESS = "198.51.100.2";
+// Where the forwarded queries go: a fake resolver on loopback.
+const std::string UPSTREAM_ADDRESS = "127.0.0.2";
+const uint16_t SERVER_PORT = 2053;
+// Ethernet, IPv4 without options and UDP headers, in front of the DNS payload.
+const size_t ETHERNET_SIZE = 14;
+const size_t IP_SIZE = 20;
+const size_t UDP_SIZE = 8;
+
+static uint16_t read_u16(const unsigned char *bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+// One's complement sum over an IPv4 header; zero when its checksum is right.
+static uint16_t header_checksum(const unsigned char *header, size_t size) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < size; i += 2) {
+    sum += read_u16(header + i);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return ~sum & 0xFFFF;
+}
+
+static bool run(const std::string &command) {
+  return system((command + " >/dev/null 2>&1").c_str()) == 0;
+}
+
+// The veth pair and namespace, torn down again however the test ends.
+class VethPair {
+private:
+  bool created = false;
+
+public:
+  std::string server_interface;
+  std::string client_interface;
+  std::string namespace_name;
+
+  VethPair() {
+    std::string suffix = std::to_string(getpid() % 100000);
+    this->server_interface = "xdpts" + suffix;
+    this->client_interface = "xdptc" + suffix;
+    this->namespace_name = "dns-xdp-test-" + suffix;
+  }
+
+  ~VethPair() {
+    if (this->created) {
+      run("ip link del " + this->server_interface);
+      run("ip netns del " + this->namespace_name);
+    }
+  }
+
+  // False if this machine won't let us.
+  bool create() {
+    this->created = run("ip netns add " + this->namespace_name);
+    std::string in_namespace = "ip -n " + this->namespace_name + " ";
+    return this->created &&
+           run("ip link add " + this->server_interface + " type veth peer name " + this->client_interface) &&
+           run("ip link set " + this->client_interface + " netns " + this->namespace_name) &&
+           run("ip addr add " + SERVER_ADDRESS + "/24 dev " + this->server_interface) &&
+           run("ip link set " + this->server_interface + " up") &&
+           run(in_namespace + "addr add " + CLIENT_ADDRESS + "/24 dev " + this->client_interface) &&
+           run(in_namespace + "link set " + this->client_interface + " up") &&
+           run(in_namespace + "link set lo up");
+  }
+};
+
+// A frame the client side saw: the raw bytes, and whether it was going out.
+struct Frame {
+  std::vector<unsigned char> bytes;
+  bool outgoing;
+};
+
+// Lives in the client namespace: a UDP socket to query from and a packet
+// socket on the veth end to see exactly what went over the wire.
+class Client {
+private:
+  int udp_fd;
+  int packet_fd;
+  uint16_t port;
+  sockaddr_in server;
+
+public:
+  Client(const std::string &interface) {
+    this->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, CLIENT_ADDRESS.c_str(), &address.sin_addr);
+    socklen_t size = sizeof(address);
+    if (this->udp_fd == -1 || bind(this->udp_fd, reinterpret_cast<sockaddr *>(&address), size) != 0 ||
+        getsockname(this->udp_fd, reinterpret_cast<sockaddr *>(&address), &size) != 0) {
+      throw std::runtime_error("Couldn't bind the client socket");
+    }
+    this->port = ntohs(address.sin_port);
+
+    // Only ETH_P_ALL sockets see what goes out as well as what comes in.
+    this->packet_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    sockaddr_ll link = {};
+    link.sll_family = AF_PACKET;
+    link.sll_protocol = htons(ETH_P_ALL);
+    link.sll_ifindex = if_nametoindex(interface.c_str());
+    if (this->packet_fd == -1 ||
+        bind(this->packet_fd, reinterpret_cast<sockaddr *>(&link), sizeof(link)) != 0) {
+      throw std::runtime_error("Couldn't open a packet socket on " + interface);
+    }
+
+    timeval timeout = {2, 0};
+    setsockopt(this->udp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(this->packet_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    this->server = {};
+    this->server.sin_family = AF_INET;
+    this->server.sin_port = htons(SERVER_PORT);
+    inet_pton(AF_INET, SERVER_ADDRESS.c_str(), &this->server.sin_addr);
+  }
+
+  ~Client() {
+    close(this->udp_fd);
+    close(this->packet_fd);
+  }
+
+  uint16_t get_port() const { return this->port; }
+
+  // Carries IP options on what it sends from now on, which the XDP program
+  // leaves to the kernel.
+  void set_ip_options() {
+    // Four NOPs: the header grows to 24 bytes and nothing else changes.
+    unsigned char options[] = {1, 1, 1, 1};
+    setsockopt(this->udp_fd, IPPROTO_IP, IP_OPTIONS, options, sizeof(options));
+  }
+
+  // Frames captured before this are thrown away, so capture sees this
+  // exchange first.
+  void send(const std::vector<unsigned char> &query) {
+    unsigned char discarded[ETH_FRAME_LEN];
+    while (recv(this->packet_fd, discarded, sizeof(discarded), MSG_DONTWAIT) > 0) {
+    }
+    sendto(this->udp_fd, query.data(), query.size(), 0, reinterpret_cast<sockaddr *>(&this->server),
+           sizeof(this->server));
+  }
+
+  // The reply as the client's UDP socket sees it. Empty if none came.
+  std::vector<unsigned char> receive() {
+    std::vector<unsigned char> reply(BUFFER_SIZE);
+    ssize_t size = recv(this->udp_fd, reply.data(), reply.size(), 0);
+    reply.resize(size > 0 ? size : 0);
+    return reply;
+  }
+
+  // The next IPv4 UDP frame on the veth end to or from `port` on our side.
+  // Empty bytes if none came.
+  Frame capture() {
+    while (true) {
+      Frame frame{std::vector<unsigned char>(ETH_FRAME_LEN), false};
+      sockaddr_ll link = {};
+      socklen_t link_size = sizeof(link);
+      ssize_t size = recvfrom(this->packet_fd, frame.bytes.data(), frame.bytes.size(), 0,
+                              reinterpret_cast<sockaddr *>(&link), &link_size);
+      if (size <= 0) {
+        return Frame{{}, false};
+      }
+      frame.bytes.resize(size);
+      frame.outgoing = link.sll_pkttype == PACKET_OUTGOING;
+      const unsigned char *ip = frame.bytes.data() + ETHERNET_SIZE;
+      if (frame.bytes.size() < ETHERNET_SIZE + IP_SIZE || read_u16(frame.bytes.data() + 12) != ETH_P_IP ||
+          ip[9] != IPPROTO_UDP) {
+        continue;
+      }
+      const unsigned char *udp = ip + (ip[0] & 0x0F) * 4;
+      if (udp + UDP_SIZE > frame.bytes.data() + frame.bytes.size()) {
+        continue;
+      }
+      uint16_t our_port = frame.outgoing ? read_u16(udp) : read_u16(udp + 2);
+      if (our_port == this->port) {
+        return frame;
+      }
+    }
+  }
+};
+
+static std::string address_at(const unsigned char *bytes) {
+  char text[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, bytes, text, sizeof(text));
+  return text;
+}
+
+// Answered from the zone: the reply is the query's own frame turned around in
+// UMEM, so every header is checked against the query that went out.
+static void test_answered_in_place(Client &client) {
+  client.send(make_query("www.xdp.test", static_cast<uint16_t>(RecordType::A), 0x0101));
+  Frame query = client.capture();
+  Frame reply = client.capture();
+  CHECK(query.outgoing && !reply.bytes.empty() && !reply.outgoing);
+  if (!query.outgoing || reply.bytes.size() < ETHERNET_SIZE + IP_SIZE + UDP_SIZE) {
+    return;
+  }
+
+  const unsigned char *ethernet = reply.bytes.data();
+  CHECK(std::equal(ethernet, ethernet + 6, query.bytes.data() + 6));
+  CHECK(std::equal(ethernet + 6, ethernet + 12, query.bytes.data()));
+
+  const unsigned char *ip = ethernet + ETHERNET_SIZE;
+  CHECK(ip[0] == 0x45);
+  CHECK(address_at(ip + 12) == SERVER_ADDRESS && address_at(ip + 16) == CLIENT_ADDRESS);
+  CHECK(read_u16(ip + 2) == reply.bytes.size() - ETHERNET_SIZE);
+  CHECK(header_checksum(ip, IP_SIZE) == 0);
+
+  const unsigned char *udp = ip + IP_SIZE;
+  CHECK(read_u16(udp) == SERVER_PORT && read_u16(udp + 2) == client.get_port());
+  CHECK(read_u16(udp + 4) == reply.bytes.size() - ETHERNET_SIZE - IP_SIZE);
+  CHECK(read_u16(udp + 6) == 0);
+
+  // The kernel takes it, checksum and all, and it answers the question.
+  auto answer = client.receive();
+  CHECK(!answer.empty() && std::equal(answer.begin(), answer.end(), udp + UDP_SIZE));
+  if (answer.empty()) {
+    return;
+  }
+  auto packet = parse_reply(answer);
+  CHECK(packet.get_transaction_id() == 0x0101);
+  CHECK(addresses_in(packet.get_answer_section(), "www.xdp.test") == std::vector<std::string>{"192.0.2.1"});
+}
+
+// A cache miss goes to the forwarding threads, whose reply goes out through
+// the ordinary socket with a real UDP checksum.
+static void test_forwarded(Client &client) {
+  client.send(make_query("www.forward.test", static_cast<uint16_t>(RecordType::A), 0x0202));
+  auto answer = client.receive();
+  CHECK(!answer.empty());
+  if (answer.empty()) {
+    return;
+  }
+  auto packet = parse_reply(answer);
+  CHECK(packet.get_transaction_id() == 0x0202);
+  CHECK(addresses_in(packet.get_answer_section(), "www.forward.test") ==
+        std::vector<std::string>{"10.0.0.9"});
+}
+
+// Queries with IP options are passed to the kernel and answered from the
+// fallback socket.
+static void test_fallback_socket(Client &client) {
+  client.set_ip_options();
+  client.send(make_query("www.xdp.test", static_cast<uint16_t>(RecordType::A), 0x0303));
+  Frame query = client.capture();
+  Frame reply = client.capture();
+  CHECK(query.outgoing && (query.bytes[ETHERNET_SIZE] & 0x0F) > 5);
+  CHECK(!reply.bytes.empty() && !reply.outgoing);
+  if (reply.bytes.size() >= ETHERNET_SIZE + IP_SIZE + UDP_SIZE) {
+    const unsigned char *udp = reply.bytes.data() + ETHERNET_SIZE + (reply.bytes[ETHERNET_SIZE] & 0x0F) * 4;
+    // Sent by the kernel, which always fills the checksum in.
+    CHECK(read_u16(udp) == SERVER_PORT && read_u16(udp + 6) != 0);
+  }
+
+  auto answer = client.receive();
+  CHECK(!answer.empty());
+  if (!answer.empty()) {
+    auto packet = parse_reply(answer);
+    CHECK(packet.get_transaction_id() == 0x0303);
+    CHECK(addresses_in(packet.get_answer_section(), "www.xdp.test") == std::vector<std::string>{"192.0.2.1"});
+  }
+}
+
+// Runs the client side in the pair's namespace, on a thread of its own so
+// the rest of the process stays where the server is.
+static void run_client(const VethPair &pair) {
+  int namespace_fd = open(("/var/run/netns/" + pair.namespace_name).c_str(), O_RDONLY);
+  if (namespace_fd == -1 || setns(namespace_fd, CLONE_NEWNET) != 0) {
+    throw std::runtime_error("Couldn't enter " + pair.namespace_name);
+  }
+  close(namespace_fd);
+
+  Client client(pair.client_interface);
+  test_answered_in_place(client);
+  test_forwarded(client);
+  test_fallback_socket(client);
+}
+
+int main() {
+  if (geteuid() != 0) {
+    std::cout << "Skipped: needs root" << std::endl;
+    return SKIP_EXIT_CODE;
+  }
+  VethPair pair;
+  if (!pair.create()) {
+    std::cout << "Skipped: couldn't set up a veth pair and namespace" << std::endl;
+    return SKIP_EXIT_CODE;
+  }
+
+  FakeAuthority upstream;
+  upstream.add_zone(UPSTREAM_ADDRESS, "forward.test",
+                    {make_soa("forward.test"), make_a("www.forward.test", {10, 0, 0, 9})});
+  upstream.start();
+
+  TempFile zone("www.xdp.test 300 A 192.0.2.1\n");
+  ServerOptions options;
+  options.zone_file = zone.get_path();
+  options.resolver_ip = UPSTREAM_ADDRESS;
+  options.resolver_port = std::to_string(upstream.get_port());
+  options.xdp_interface = pair.server_interface;
+  options.xdp_mode = "skb";
+  QueryHandler handler(options);
+
+  int fallback_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(SERVER_PORT);
+  inet_pton(AF_INET, SERVER_ADDRESS.c_str(), &address.sin_addr);
+  if (fallback_socket == -1 ||
+      bind(fallback_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    throw std::runtime_error("Couldn't bind the fallback socket");
+  }
+
+  {
+    XdpBackend backend(fallback_socket, handler, options);
+    install_shutdown_handlers();
+    std::thread server([&] { backend.run(); });
+    std::thread client([&] {
+      // Reported like a failed check, so the server still stops and the
+      // pair is torn down.
+      try {
+        run_client(pair);
+      } catch (const std::exception &error) {
+        std::cerr << "Client failed: " << error.what() << std::endl;
+        test_failures++;
+      }
+    });
+    client.join();
+    kill(getpid(), SIGTERM);
+    server.join();
+  }
+  close(fallback_socket);
+  return finish_tests();
+}